@@ -0,0 +1,337 @@
+// Headless animation benchmark: poses many Animator instances against the vanguard clips without a
+// GL context and reports the cost per character per frame.
+//
+//   animbench [--characters N] [--frames M] [--warmup W] [--switch-frames S] [--dt SECONDS]
+//             [--mix steady|transitions|blend|mixed] [--model PATH] [--resources DIR] [--json PATH]
+//
+// Every mix is timed per character update, so the percentiles show the spread between cheap and
+// expensive poses as well as the mean. The checksum folds the final bone matrices of every
+// character; it changes when the animation math does, and keeps the work from being optimized out.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "animator.hpp"
+#include "skeleton.hpp"
+
+namespace fs = std::filesystem;
+
+// The clips main.cpp loads, in its order
+const char* const CLIP_FILES[] = {
+	"Offensive_Idle.dae", "Running.dae", "Left_Strafe.dae", "Right_Strafe.dae", "Running Backward.dae",
+	"Jump.dae", "HipHopDancing.dae", "Wave_Hip_Hop_Dance.dae", "Moonwalk.dae", "Bboy Hip Hop Move.dae",
+	"Punching.dae", "Flair.dae", "Male Dance Pose.dae", "Idle.dae",
+};
+
+enum Mix
+{
+	// Each character loops one clip
+	MIX_STEADY,
+	// Characters switch clips every switchFrames frames, spending part of the time in transitions
+	MIX_TRANSITIONS,
+	// Characters blend two clips with a per-character factor
+	MIX_BLEND,
+	// A third of the characters in each of the modes above
+	MIX_MIXED,
+	MIX_COUNT,
+};
+
+const char* const MIX_NAMES[MIX_COUNT] = { "steady", "transitions", "blend", "mixed" };
+
+struct BenchSettings
+{
+	int characters = 100;
+	int frames = 600;
+	int warmup = 30;
+	// Frames between clip switches in the transition mix; transitions last 0.2 s
+	int switchFrames = 30;
+	float dt = 1.0f / 60.0f;
+	int mix = -1;
+	std::string model;
+	std::string resources;
+	std::string json;
+};
+
+struct MixResult
+{
+	const char* name;
+	size_t samples = 0;
+	double meanNs = 0.0;
+	double p50Ns = 0.0;
+	double p90Ns = 0.0;
+	double p99Ns = 0.0;
+	double maxNs = 0.0;
+	// Average total time to pose every character once
+	double frameUs = 0.0;
+	double checksum = 0.0;
+};
+
+struct Character
+{
+	Animator animator;
+	Mix mode;
+	int clip;
+	int otherClip;
+	float blendFactor;
+};
+
+// Upward from the working directory, the first resource/vanguard folder
+std::string findResources()
+{
+	fs::path path = fs::current_path();
+	while (true)
+	{
+		if (fs::exists(path / "resource" / "vanguard"))
+			return (path / "resource" / "vanguard").string();
+		if (!path.has_parent_path() || path.parent_path() == path)
+			return "";
+		path = path.parent_path();
+	}
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void updateCharacter(Character& c, std::vector<Animation>& clips, int frame, const BenchSettings& settings)
+{
+	switch (c.mode)
+	{
+	case MIX_TRANSITIONS:
+		if (frame > 0 && frame % settings.switchFrames == 0)
+		{
+			c.clip = (c.clip + 1) % clips.size();
+			c.animator.playAnimation(&clips[c.clip]);
+		}
+		c.animator.updateAnimation(settings.dt);
+		break;
+	case MIX_BLEND:
+		c.animator.blendAnimations(settings.dt, &clips[c.clip], &clips[c.otherClip], c.blendFactor);
+		break;
+	default:
+		c.animator.updateAnimation(settings.dt);
+		break;
+	}
+}
+
+MixResult runMix(Mix mix, std::vector<Animation>& clips, const BenchSettings& settings)
+{
+	std::vector<Character> characters(settings.characters);
+	for (int i = 0; i < settings.characters; i++)
+	{
+		Character& c = characters[i];
+		c.mode = mix == MIX_MIXED ? (Mix)(i % 3) : mix;
+		c.clip = i % clips.size();
+		c.otherClip = (i + 1) % clips.size();
+		c.blendFactor = (i % 11) / 10.0f;
+		c.animator.playAnimation(&clips[c.clip]);
+		// Spread the characters over their clips
+		c.animator.updateAnimation(settings.dt * i);
+	}
+
+	// Character i sees frame f as f + i, so clip switches do not all land on the same frame
+	for (int frame = 0; frame < settings.warmup; frame++)
+	{
+		for (int i = 0; i < settings.characters; i++)
+			updateCharacter(characters[i], clips, frame + i, settings);
+	}
+
+	std::vector<double> samples;
+	samples.reserve((size_t)settings.characters * settings.frames);
+	double totalNs = 0.0;
+	for (int frame = 0; frame < settings.frames; frame++)
+	{
+		for (int i = 0; i < settings.characters; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			updateCharacter(characters[i], clips, frame + settings.warmup + i, settings);
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			samples.push_back(ns);
+			totalNs += ns;
+		}
+	}
+
+	MixResult result;
+	result.name = MIX_NAMES[mix];
+	result.samples = samples.size();
+	for (Character& c : characters)
+	{
+		for (const glm::mat4& m : c.animator.getFinalBoneMatrices())
+			result.checksum += m[3][0] + m[3][1] + m[3][2];
+	}
+	std::sort(samples.begin(), samples.end());
+	if (!samples.empty())
+	{
+		result.meanNs = totalNs / samples.size();
+		result.p50Ns = percentile(samples, 0.50);
+		result.p90Ns = percentile(samples, 0.90);
+		result.p99Ns = percentile(samples, 0.99);
+		result.maxNs = samples.back();
+		result.frameUs = totalNs / settings.frames / 1000.0;
+	}
+	return result;
+}
+
+bool writeJson(const std::string& path, const BenchSettings& settings, size_t bones, size_t clips, const std::vector<MixResult>& results)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	fprintf(file, "{\n  \"benchmark\": \"animation\",\n  \"characters\": %d,\n  \"frames\": %d,\n  \"dt\": %g,\n  \"bones\": %zu,\n  \"clips\": %zu,\n  \"mixes\": [\n",
+		settings.characters, settings.frames, settings.dt, bones, clips);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const MixResult& r = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"samples\": %zu, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f, \"frame_us\": %.2f, \"checksum\": %.6g}%s\n",
+			r.name, r.samples, r.meanNs, r.p50Ns, r.p90Ns, r.p99Ns, r.maxNs, r.frameUs, r.checksum, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+void printUsage()
+{
+	printf("usage: animbench [--characters N] [--frames M] [--warmup W] [--switch-frames S] [--dt SECONDS]\n"
+		"                 [--mix steady|transitions|blend|mixed] [--model PATH] [--resources DIR] [--json PATH]\n");
+}
+
+bool parseArguments(int argc, char** argv, BenchSettings& settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+			return false;
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+		if (arg == "--characters")
+			settings.characters = std::max(1, atoi(value));
+		else if (arg == "--frames")
+			settings.frames = std::max(1, atoi(value));
+		else if (arg == "--warmup")
+			settings.warmup = std::max(0, atoi(value));
+		else if (arg == "--switch-frames")
+			settings.switchFrames = std::max(1, atoi(value));
+		else if (arg == "--dt")
+			settings.dt = (float)atof(value);
+		else if (arg == "--model")
+			settings.model = value;
+		else if (arg == "--resources")
+			settings.resources = value;
+		else if (arg == "--json")
+			settings.json = value;
+		else if (arg == "--mix")
+		{
+			settings.mix = -1;
+			for (int m = 0; m < MIX_COUNT; m++)
+			{
+				if (MIX_NAMES[m] == std::string(value))
+					settings.mix = m;
+			}
+			if (settings.mix < 0)
+			{
+				fprintf(stderr, "unknown mix %s\n", value);
+				return false;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BenchSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (settings.resources.empty())
+		settings.resources = findResources();
+	if (settings.resources.empty())
+	{
+		fprintf(stderr, "resource/vanguard not found above the working directory; pass --resources\n");
+		return 1;
+	}
+
+	std::vector<std::string> clipPaths;
+	for (const char* file : CLIP_FILES)
+	{
+		fs::path path = fs::path(settings.resources) / file;
+		if (fs::exists(path))
+			clipPaths.push_back(path.string());
+		else
+			fprintf(stderr, "Warning: clip %s not found\n", path.string().c_str());
+	}
+	if (clipPaths.empty())
+	{
+		fprintf(stderr, "no clips in %s\n", settings.resources.c_str());
+		return 1;
+	}
+
+	// The clips are exported with the skinned mesh, so any of them carries the skeleton when the
+	// model file is not around
+	if (settings.model.empty())
+	{
+		fs::path model = fs::path(settings.resources) / "vanguard.dae";
+		settings.model = fs::exists(model) ? model.string() : clipPaths[0];
+	}
+	std::vector<BoneProps> skeleton;
+	if (!loadSkeleton(settings.model, skeleton))
+	{
+		fprintf(stderr, "could not import %s\n", settings.model.c_str());
+		return 1;
+	}
+	size_t modelBones = skeleton.size();
+
+	auto loadStart = std::chrono::steady_clock::now();
+	std::vector<Animation> clips;
+	clips.reserve(clipPaths.size());
+	for (const std::string& path : clipPaths)
+		clips.emplace_back(path, skeleton);
+	double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+
+	printf("Skeleton: %s, %zu bones (%zu with clip-only bones)\n", settings.model.c_str(), modelBones, skeleton.size());
+	printf("Loaded %zu clips in %.1f ms\n", clips.size(), loadMs);
+	printf("%d characters, %d frames after %d warm-up frames, dt %.4f s\n\n", settings.characters, settings.frames, settings.warmup, settings.dt);
+	printf("%-12s %10s %10s %10s %10s %10s %12s %14s\n", "mix", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns", "frame us", "checksum");
+
+	std::vector<MixResult> results;
+	for (int mix = 0; mix < MIX_COUNT; mix++)
+	{
+		if (settings.mix >= 0 && settings.mix != mix)
+			continue;
+		MixResult r = runMix((Mix)mix, clips, settings);
+		printf("%-12s %10.0f %10.0f %10.0f %10.0f %10.0f %12.1f %14.6g\n", r.name, r.meanNs, r.p50Ns, r.p90Ns, r.p99Ns, r.maxNs, r.frameUs, r.checksum);
+		results.push_back(r);
+	}
+
+	if (!settings.json.empty() && !writeJson(settings.json, settings, skeleton.size(), clips.size(), results))
+	{
+		fprintf(stderr, "could not write %s\n", settings.json.c_str());
+		return 1;
+	}
+	return 0;
+}
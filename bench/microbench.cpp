@@ -0,0 +1,529 @@
+// Micro-benchmarks of the animation, import and math kernels, on fixed inputs from a shipped clip.
+//
+//   microbench [--asset PATH] [--filter TEXT] [--repetitions R] [--min-time-ms T]
+//              [--json PATH] [--compare BASELINE --threshold PERCENT]
+//
+// Each benchmark runs its operation enough times for one repetition to take at least min-time-ms,
+// then repeats that R times and reports the median and the fastest ns per operation. --json writes
+// the results; --compare reads such a file and exits with 1 when the median of any benchmark grew by
+// more than the threshold, so a stored baseline can gate changes:
+//
+//   microbench --json bench/baseline.json              (on the reference build)
+//   microbench --compare bench/baseline.json --threshold 10
+
+#include <glm/glm.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "animator.hpp"
+#include "meshimport.hpp"
+#include "scenetransforms.hpp"
+#include "skeleton.hpp"
+
+namespace fs = std::filesystem;
+
+// Read by nothing; results are folded into it so the work cannot be optimized out
+volatile float benchSink = 0.0f;
+
+struct Benchmark
+{
+	std::string name;
+	// Run the operation the given number of times
+	std::function<void(size_t)> run;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	double nsPerOp = 0.0;
+	double minNsPerOp = 0.0;
+	size_t iterations = 0;
+	int repetitions = 0;
+};
+
+struct SuiteSettings
+{
+	std::string asset;
+	std::string filter;
+	int repetitions = 5;
+	double minTimeMs = 50.0;
+	std::string json;
+	std::string compare;
+	double threshold = 10.0;
+};
+
+// Everything the benchmarks read, loaded once
+struct Fixture
+{
+	Assimp::Importer importer;
+	const aiScene* scene = nullptr;
+	const aiMesh* mesh = nullptr;
+	std::vector<BoneProps> skeleton;
+	std::vector<Animation> clips;
+	// Names of the clip's animated bones
+	std::vector<std::string> boneNames;
+	// Sample times spread over the clip, in ticks
+	std::vector<float> times;
+	// Non-indexed copy of the mesh, the layout computeTangentBasis expects
+	std::vector<glm::vec3> flatVertices;
+	std::vector<glm::vec2> flatUVs;
+	std::vector<glm::vec3> flatNormals;
+};
+
+double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+BenchmarkResult measure(const Benchmark& benchmark, const SuiteSettings& settings)
+{
+	// Grow the iteration count until one repetition is long enough to time
+	size_t iterations = 1;
+	while (true)
+	{
+		auto start = std::chrono::steady_clock::now();
+		benchmark.run(iterations);
+		double ns = elapsedNs(start);
+		if (ns >= settings.minTimeMs * 1e6 || iterations >= ((size_t)1 << 40))
+			break;
+		double scale = ns > 0.0 ? settings.minTimeMs * 1e6 / ns : 100.0;
+		iterations = (size_t)(iterations * std::min(100.0, std::max(2.0, scale * 1.2)));
+	}
+
+	std::vector<double> samples;
+	for (int r = 0; r < settings.repetitions; r++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		benchmark.run(iterations);
+		samples.push_back(elapsedNs(start) / iterations);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	BenchmarkResult result;
+	result.name = benchmark.name;
+	result.nsPerOp = samples[samples.size() / 2];
+	result.minNsPerOp = samples.front();
+	result.iterations = iterations;
+	result.repetitions = settings.repetitions;
+	return result;
+}
+
+bool loadFixture(const std::string& asset, Fixture& fixture)
+{
+	// The flags Model imports with, so the mesh kernels see the same data as at runtime
+	fixture.scene = fixture.importer.ReadFile(asset, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+	if (!fixture.scene || !fixture.scene->mRootNode || fixture.scene->mNumMeshes == 0 || fixture.scene->mNumAnimations == 0)
+		return false;
+
+	// The mesh with the most bones is the one the skin kernels are about
+	fixture.mesh = fixture.scene->mMeshes[0];
+	for (unsigned int i = 1; i < fixture.scene->mNumMeshes; i++)
+	{
+		if (fixture.scene->mMeshes[i]->mNumBones > fixture.mesh->mNumBones)
+			fixture.mesh = fixture.scene->mMeshes[i];
+	}
+
+	if (!loadSkeleton(asset, fixture.skeleton))
+		return false;
+	fixture.clips.emplace_back(asset, fixture.skeleton);
+	Animation& clip = fixture.clips[0];
+
+	// The channel with the most keys first; the index searches and interpolation run on it
+	const aiAnimation* animation = fixture.scene->mAnimations[0];
+	unsigned int mostKeys = 0;
+	for (unsigned int i = 0; i < animation->mNumChannels; i++)
+	{
+		const aiNodeAnim* channel = animation->mChannels[i];
+		std::string name = channel->mNodeName.C_Str();
+		if (!clip.findBone(name))
+			continue;
+		fixture.boneNames.push_back(name);
+		unsigned int keys = std::min({ channel->mNumPositionKeys, channel->mNumRotationKeys, channel->mNumScalingKeys });
+		if (keys > mostKeys)
+		{
+			mostKeys = keys;
+			std::swap(fixture.boneNames.front(), fixture.boneNames.back());
+		}
+	}
+	// The searches need at least one pair of keys
+	if (mostKeys < 2)
+		return false;
+
+	// Fixed, unevenly spaced times so index searches do not always land on the same key
+	const int sampleCount = 64;
+	for (int i = 0; i < sampleCount; i++)
+		fixture.times.push_back(clip.getDuration() * ((i * 37) % sampleCount + 0.5f) / sampleCount);
+
+	for (unsigned int f = 0; f < fixture.mesh->mNumFaces; f++)
+	{
+		const aiFace& face = fixture.mesh->mFaces[f];
+		if (face.mNumIndices != 3)
+			continue;
+		for (unsigned int k = 0; k < 3; k++)
+		{
+			unsigned int v = face.mIndices[k];
+			const aiVector3D& p = fixture.mesh->mVertices[v];
+			fixture.flatVertices.push_back(glm::vec3(p.x, p.y, p.z));
+			const aiVector3D& n = fixture.mesh->HasNormals() ? fixture.mesh->mNormals[v] : aiVector3D(0.0f, 1.0f, 0.0f);
+			fixture.flatNormals.push_back(glm::vec3(n.x, n.y, n.z));
+			const aiVector3D uv = fixture.mesh->mTextureCoords[0] ? fixture.mesh->mTextureCoords[0][v] : aiVector3D(p.x, p.z, 0.0f);
+			fixture.flatUVs.push_back(glm::vec2(uv.x, uv.y));
+		}
+	}
+	return true;
+}
+
+std::vector<Benchmark> makeBenchmarks(Fixture& fixture)
+{
+	std::vector<Benchmark> benchmarks;
+	Animation* clip = &fixture.clips[0];
+	Bone* bone = clip->findBone(fixture.boneNames[0]);
+	const std::vector<float>& times = fixture.times;
+
+	// One op: one bone of the clip posed at one time
+	benchmarks.push_back({ "Bone::update", [&fixture, clip](size_t n) {
+		std::vector<Bone*> bones;
+		for (const std::string& name : fixture.boneNames)
+			bones.push_back(clip->findBone(name));
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			Bone* b = bones[i % bones.size()];
+			b->update(fixture.times[(i / bones.size()) % fixture.times.size()]);
+			sum += b->getTransform()[3][0];
+		}
+		benchSink = sum;
+	} });
+
+	benchmarks.push_back({ "Bone::getPositionIndex", [bone, &times](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+			sum += bone->getPositionIndex(times[i % times.size()]);
+		benchSink = (float)sum;
+	} });
+
+	benchmarks.push_back({ "Bone::getRotationIndex", [bone, &times](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+			sum += bone->getRotationIndex(times[i % times.size()]);
+		benchSink = (float)sum;
+	} });
+
+	benchmarks.push_back({ "Bone::getScaleIndex", [bone, &times](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+			sum += bone->getScaleIndex(times[i % times.size()]);
+		benchSink = (float)sum;
+	} });
+
+	// Key pairs around each sample time, as Bone::update picks them
+	std::vector<std::pair<KeyRotation, KeyRotation>> rotationKeys;
+	for (float t : times)
+	{
+		KeyRotation from = bone->getRotations(t);
+		KeyRotation to = bone->getRotations(std::min(clip->getDuration(), t + 1.0f));
+		if (to.timeStamp <= from.timeStamp)
+			to.timeStamp = from.timeStamp + 1.0f;
+		rotationKeys.push_back({ from, to });
+	}
+	benchmarks.push_back({ "interpolateRotation", [rotationKeys](size_t n) {
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			const std::pair<KeyRotation, KeyRotation>& keys = rotationKeys[i % rotationKeys.size()];
+			float t = (keys.first.timeStamp + keys.second.timeStamp) * 0.5f;
+			sum += interpolateRotation(t, keys.first, keys.second)[0][0];
+		}
+		benchSink = sum;
+	} });
+
+	std::vector<aiMatrix4x4> matrices;
+	for (unsigned int i = 0; i < fixture.mesh->mNumBones; i++)
+		matrices.push_back(fixture.mesh->mBones[i]->mOffsetMatrix);
+	if (matrices.empty())
+		matrices.push_back(fixture.scene->mRootNode->mTransformation);
+	benchmarks.push_back({ "aiMatrix4x4ToGlm", [matrices](size_t n) {
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+			sum += aiMatrix4x4ToGlm(&matrices[i % matrices.size()])[3][1];
+		benchSink = sum;
+	} });
+
+	// Model::processMesh without the material lookups, which need GL: the importMesh half
+	benchmarks.push_back({ "Model::processMesh (geometry)", [&fixture](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			std::vector<BoneProps> boneProps;
+			MeshOptimizationStats stats;
+			Mesh m = importMesh(fixture.mesh, boneProps, true, stats);
+			sum += m.indices.size();
+		}
+		benchSink = (float)sum;
+	} });
+
+	// Includes resetting the slots and the bone list, which is small next to the weight sort
+	benchmarks.push_back({ "extractBoneWeightForVertices", [&fixture](size_t n) {
+		std::vector<glm::ivec4> boneIDs;
+		std::vector<glm::vec4> weights;
+		std::vector<BoneProps> boneProps;
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			boneIDs.assign(fixture.mesh->mNumVertices, glm::ivec4(-1));
+			weights.assign(fixture.mesh->mNumVertices, glm::vec4(0.0f));
+			boneProps.clear();
+			extractBoneWeightForVertices(boneIDs, weights, fixture.mesh, boneProps);
+			sum += weights[i % weights.size()].x;
+		}
+		benchSink = sum;
+	} });
+
+	benchmarks.push_back({ "computeTangentBasis", [&fixture](size_t n) {
+		std::vector<glm::vec3> tangents, bitangents;
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			tangents.clear();
+			bitangents.clear();
+			computeTangentBasis(fixture.flatVertices, fixture.flatUVs, fixture.flatNormals, tangents, bitangents);
+			sum += tangents.empty() ? 0.0f : tangents[i % tangents.size()].x;
+		}
+		benchSink = sum;
+	} });
+
+	// One op: the whole hierarchy posed at one time
+	benchmarks.push_back({ "Animator::calculateBoneTransform", [clip, &times](size_t n) {
+		Animator animator;
+		float sum = 0.0f;
+		for (size_t i = 0; i < n; i++)
+		{
+			animator.calculateBoneTransform(clip->getRootNode(), glm::mat4(1.0f), clip, times[i % times.size()]);
+			sum += animator.getFinalBoneMatrices()[0][3][0];
+		}
+		benchSink = sum;
+	} });
+
+	// One op: one update of a 10k-node hierarchy, four children per node. With nothing moved it
+	// should cost next to nothing; with 100 nodes moved it recomputes only their subtrees.
+	const unsigned int nodeCount = 10000;
+	SceneTransforms& transforms = sceneTransforms();
+	transforms.grow(nodeCount);
+	for (unsigned int i = 0; i < nodeCount; i++)
+	{
+		transforms.reset(i);
+		transforms.setPosition(i, glm::vec3((float)(i % 7), (float)(i % 5), (float)(i % 3)));
+		if (i > 0)
+			transforms.setParent(i, (i - 1) / 4);
+	}
+	transforms.update();
+
+	benchmarks.push_back({ "SceneTransforms::update (10k static)", [&transforms](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+			sum += transforms.update();
+		benchSink = (float)sum;
+	} });
+
+	// The moved nodes start at slot 341, the first level of the tree whose subtrees are a few nodes
+	// deep, and are spread from there to the leaves as characters are
+	benchmarks.push_back({ "SceneTransforms::update (10k, 100 moved)", [&transforms, nodeCount](size_t n) {
+		size_t sum = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			for (unsigned int slot = 341 + (unsigned int)(i % 100); slot < nodeCount; slot += 100)
+				transforms.setRotation(slot, glm::vec3(0.0f, (float)i * 0.01f, 0.0f));
+			sum += transforms.update();
+		}
+		benchSink = (float)sum;
+	} });
+
+	return benchmarks;
+}
+
+bool writeJson(const std::string& path, const std::string& asset, const std::vector<BenchmarkResult>& results)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	fprintf(file, "{\n  \"suite\": \"microbench\",\n  \"asset\": \"%s\",\n  \"results\": [\n", fs::path(asset).filename().string().c_str());
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"iterations\": %zu, \"repetitions\": %d}%s\n",
+			r.name.c_str(), r.nsPerOp, r.minNsPerOp, r.iterations, r.repetitions, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+// Name and ns_per_op of every result in a file written by writeJson
+bool readBaseline(const std::string& path, std::vector<BenchmarkResult>& baseline)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string text = buffer.str();
+
+	const std::string nameKey = "\"name\": \"";
+	const std::string timeKey = "\"ns_per_op\": ";
+	size_t position = 0;
+	while ((position = text.find(nameKey, position)) != std::string::npos)
+	{
+		size_t nameStart = position + nameKey.size();
+		size_t nameEnd = text.find('"', nameStart);
+		size_t timeStart = text.find(timeKey, nameEnd);
+		if (nameEnd == std::string::npos || timeStart == std::string::npos)
+			return false;
+		BenchmarkResult r;
+		r.name = text.substr(nameStart, nameEnd - nameStart);
+		r.nsPerOp = atof(text.c_str() + timeStart + timeKey.size());
+		baseline.push_back(r);
+		position = timeStart;
+	}
+	return true;
+}
+
+// Print the change of every benchmark against the baseline; true when none regressed
+bool compareResults(const std::vector<BenchmarkResult>& results, const std::vector<BenchmarkResult>& baseline, double threshold)
+{
+	bool passed = true;
+	printf("\n%-36s %14s %14s %9s\n", "benchmark", "baseline ns", "current ns", "change");
+	for (const BenchmarkResult& r : results)
+	{
+		auto base = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult& b) { return b.name == r.name; });
+		if (base == baseline.end() || base->nsPerOp <= 0.0)
+		{
+			printf("%-36s %14s %14.1f %9s\n", r.name.c_str(), "-", r.nsPerOp, "new");
+			continue;
+		}
+		double change = (r.nsPerOp - base->nsPerOp) / base->nsPerOp * 100.0;
+		bool regressed = change > threshold;
+		passed = passed && !regressed;
+		printf("%-36s %14.1f %14.1f %+8.1f%%%s\n", r.name.c_str(), base->nsPerOp, r.nsPerOp, change, regressed ? "  REGRESSED" : "");
+	}
+	printf(passed ? "\nNo benchmark regressed by more than %.1f%%\n" : "\nRegressions above %.1f%%\n", threshold);
+	return passed;
+}
+
+// Upward from the working directory, the first shipped clip
+std::string findAsset()
+{
+	fs::path path = fs::current_path();
+	while (true)
+	{
+		fs::path clip = path / "resource" / "vanguard" / "Offensive_Idle.dae";
+		if (fs::exists(clip))
+			return clip.string();
+		if (!path.has_parent_path() || path.parent_path() == path)
+			return "";
+		path = path.parent_path();
+	}
+}
+
+void printUsage()
+{
+	printf("usage: microbench [--asset PATH] [--filter TEXT] [--repetitions R] [--min-time-ms T]\n"
+		"                  [--json PATH] [--compare BASELINE] [--threshold PERCENT]\n");
+}
+
+bool parseArguments(int argc, char** argv, SuiteSettings& settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+			return false;
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+		if (arg == "--asset")
+			settings.asset = value;
+		else if (arg == "--filter")
+			settings.filter = value;
+		else if (arg == "--repetitions")
+			settings.repetitions = std::max(1, atoi(value));
+		else if (arg == "--min-time-ms")
+			settings.minTimeMs = std::max(0.1, atof(value));
+		else if (arg == "--json")
+			settings.json = value;
+		else if (arg == "--compare")
+			settings.compare = value;
+		else if (arg == "--threshold")
+			settings.threshold = atof(value);
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	SuiteSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		printUsage();
+		return 2;
+	}
+
+	if (settings.asset.empty())
+		settings.asset = findAsset();
+	Fixture fixture;
+	if (settings.asset.empty() || !loadFixture(settings.asset, fixture))
+	{
+		fprintf(stderr, "could not load a skinned, animated asset; pass --asset\n");
+		return 2;
+	}
+	printf("Asset: %s (%u vertices, %u bones, %zu animated bones)\n\n", settings.asset.c_str(),
+		fixture.mesh->mNumVertices, fixture.mesh->mNumBones, fixture.boneNames.size());
+
+	std::vector<BenchmarkResult> results;
+	printf("%-36s %14s %14s %14s\n", "benchmark", "median ns/op", "min ns/op", "iterations");
+	for (const Benchmark& benchmark : makeBenchmarks(fixture))
+	{
+		if (!settings.filter.empty() && benchmark.name.find(settings.filter) == std::string::npos)
+			continue;
+		BenchmarkResult r = measure(benchmark, settings);
+		printf("%-36s %14.1f %14.1f %14zu\n", r.name.c_str(), r.nsPerOp, r.minNsPerOp, r.iterations);
+		results.push_back(r);
+	}
+
+	if (!settings.json.empty() && !writeJson(settings.json, settings.asset, results))
+	{
+		fprintf(stderr, "could not write %s\n", settings.json.c_str());
+		return 2;
+	}
+
+	if (!settings.compare.empty())
+	{
+		std::vector<BenchmarkResult> baseline;
+		if (!readBaseline(settings.compare, baseline))
+		{
+			fprintf(stderr, "could not read %s\n", settings.compare.c_str());
+			return 2;
+		}
+		if (!compareResults(results, baseline, settings.threshold))
+			return 1;
+	}
+	return 0;
+}
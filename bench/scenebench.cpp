@@ -0,0 +1,239 @@
+// Headless benchmark of the scene structures on a scene of its own, built from plain nodes without
+// meshes or a GL context.
+//
+//   scenebench [--nodes N] [--rounds R] [--queries Q]
+//
+// The node pool is timed spawning N nodes, each with a child, under one parent and despawning them
+// again, R rounds over. The pool only grows in the first round; later rounds reuse its slots. The
+// "pool" figure creates, links and destroys nodes only; "spawn" also places each node, brings the
+// transforms up to date and adds the node to the scene index, as spawning in the renderer does.
+//
+// The BVH of the scene index is timed on 1k, 10k and 100k random boxes: building it leaf by leaf
+// and with rebuild, moving boxes, and Q frustum, ray and radius queries, with a frustum test of
+// every box for comparison.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "scene.hpp"
+
+struct BenchSettings
+{
+	unsigned int nodes = 2000;
+	int rounds = 10;
+	int queries = 100;
+};
+
+double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Nanoseconds per node spawned and despawned with its child
+double timeSpawns(Node* parent, unsigned int count, int rounds, bool place)
+{
+	NodePool& pool = sceneNodes();
+	SceneTransforms& transforms = sceneTransforms();
+	BoundingBox unitBox;
+	unitBox.expand(glm::vec3(-0.5f));
+	unitBox.expand(glm::vec3(0.5f));
+
+	std::vector<Node*> spawned(count);
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; round++)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			Node* node = pool.create();
+			addChild(parent, node);
+			addChild(node, pool.create());
+			if (place)
+			{
+				node->bounds = unitBox;
+				transforms.setPosition(node->slot, glm::vec3((float)(i % 100), 0.0f, (float)(i / 100)));
+			}
+			spawned[i] = node;
+		}
+		if (place)
+		{
+			transforms.update();
+			for (Node* node : spawned)
+			{
+				node->currentTransformationMatrix = transforms.world(node->slot);
+				indexSceneNode(node);
+			}
+		}
+		for (Node* node : spawned)
+			pool.destroy(node);
+	}
+	double ns = elapsedNs(start);
+	// Nothing of the benchmark is left for the next round's update to recompute
+	transforms.update();
+	return ns / ((double)count * rounds);
+}
+
+// Milliseconds of the BVH's operations on count random boxes, against testing every box
+struct BvhBenchmark
+{
+	unsigned int count;
+	double insertMilliseconds;
+	double rebuildMilliseconds;
+	// Moving a tenth of the boxes, as a frame of moving characters would
+	double refitMilliseconds;
+	double frustumMilliseconds;
+	double linearFrustumMilliseconds;
+	double rayMilliseconds;
+	double radiusMilliseconds;
+	// Leaves the frustum query returned, and boxes the linear test found; the leaves' margins let
+	// a few more through
+	unsigned int frustumHits;
+	unsigned int linearFrustumHits;
+};
+
+BvhBenchmark benchmarkBvh(unsigned int count, int queries)
+{
+	// Boxes of 0.5 to 2 units at the same density at every count
+	std::mt19937 random(count);
+	float side = 4.0f * std::cbrt((float)count);
+	std::uniform_real_distribution<float> position(0.0f, side), size(0.5f, 2.0f), step(-0.1f, 0.1f);
+	std::vector<BoundingBox> boxes(count);
+	for (BoundingBox& box : boxes)
+	{
+		box.minimum = glm::vec3(position(random), position(random), position(random));
+		box.maximum = box.minimum + glm::vec3(size(random), size(random), size(random));
+	}
+
+	BvhBenchmark result;
+	result.count = count;
+	Bvh tree(0.1f);
+	std::vector<unsigned int> leaves(count);
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < count; i++)
+		leaves[i] = tree.insert(boxes[i], i);
+	result.insertMilliseconds = elapsedNs(start) * 1e-6;
+
+	start = std::chrono::steady_clock::now();
+	tree.rebuild();
+	result.rebuildMilliseconds = elapsedNs(start) * 1e-6;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < count; i += 10)
+	{
+		glm::vec3 offset(step(random), step(random), step(random));
+		boxes[i].minimum += offset;
+		boxes[i].maximum += offset;
+		tree.move(leaves[i], boxes[i]);
+	}
+	result.refitMilliseconds = elapsedNs(start) * 1e-6;
+
+	// A camera at one corner looking across the volume
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, side * 0.5f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(side), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = frustumFromMatrix(projection * view);
+	unsigned int hits = 0;
+	start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+		tree.queryFrustum(frustum, [&](unsigned int) { hits++; });
+	result.frustumMilliseconds = elapsedNs(start) * 1e-6 / queries;
+	result.frustumHits = hits / queries;
+
+	unsigned int linearHits = 0;
+	start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+	{
+		for (const BoundingBox& box : boxes)
+			linearHits += boxInFrustum(frustum, box);
+	}
+	result.linearFrustumMilliseconds = elapsedNs(start) * 1e-6 / queries;
+	result.linearFrustumHits = linearHits / queries;
+
+	start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+	{
+		glm::vec3 origin(position(random), position(random), 0.0f);
+		tree.raycast(origin, glm::vec3(step(random), step(random), 1.0f), side);
+	}
+	result.rayMilliseconds = elapsedNs(start) * 1e-6 / queries;
+
+	start = std::chrono::steady_clock::now();
+	for (int q = 0; q < queries; q++)
+	{
+		glm::vec3 center(position(random), position(random), position(random));
+		tree.queryRadius(center, 5.0f, [&](unsigned int) { hits++; });
+	}
+	result.radiusMilliseconds = elapsedNs(start) * 1e-6 / queries;
+	return result;
+}
+
+void printUsage()
+{
+	printf("usage: scenebench [--nodes N] [--rounds R] [--queries Q]\n");
+}
+
+bool parseArguments(int argc, char** argv, BenchSettings& settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+			return false;
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+		if (arg == "--nodes")
+			settings.nodes = (unsigned int)std::max(1, atoi(value));
+		else if (arg == "--rounds")
+			settings.rounds = std::max(1, atoi(value));
+		else if (arg == "--queries")
+			settings.queries = std::max(1, atoi(value));
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	BenchSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		printUsage();
+		return 1;
+	}
+
+	Node* root = createSceneNode();
+	NodePool& pool = sceneNodes();
+	printf("Node pool, %u nodes with a child each, %d rounds:\n", settings.nodes, settings.rounds);
+	unsigned int slotsBefore = pool.slotCount();
+	double poolNs = timeSpawns(root, settings.nodes, settings.rounds, false);
+	unsigned int slotsAfter = pool.slotCount();
+	double spawnNs = timeSpawns(root, settings.nodes, settings.rounds, true);
+	printf("  pool:  %8.1f ns per node\n", poolNs);
+	printf("  spawn: %8.1f ns per node\n", spawnNs);
+	printf("  %u slots before, %u after, %u after spawning, %u nodes live\n", slotsBefore, slotsAfter, pool.slotCount(), pool.nodeCount());
+
+	printf("\nBVH, ms per build or query, %d queries:\n", settings.queries);
+	printf("%8s %9s %9s %9s %9s %9s %9s %9s %13s\n", "boxes", "insert", "rebuild", "refit", "frustum", "linear", "ray", "radius", "frustum hits");
+	for (unsigned int count : { 1000u, 10000u, 100000u })
+	{
+		BvhBenchmark r = benchmarkBvh(count, settings.queries);
+		printf("%8u %9.3f %9.3f %9.4f %9.4f %9.4f %9.4f %9.4f %6u/%6u\n", r.count, r.insertMilliseconds, r.rebuildMilliseconds, r.refitMilliseconds,
+			r.frustumMilliseconds, r.linearFrustumMilliseconds, r.rayMilliseconds, r.radiusMilliseconds, r.frustumHits, r.linearFrustumHits);
+	}
+	return 0;
+}
@@ -0,0 +1,154 @@
+// Headless check of the CPU skinning paths against the scalar reference, on a generated mesh and
+// palette, followed by their throughput.
+//
+//   skintest [--vertices N] [--tolerance T]
+//
+// Every path this CPU runs skins the mesh serially and split across threads. The run fails (exit 1)
+// when any position or normal component differs from the reference by more than the tolerance.
+// Bone IDs include -1 and IDs past the palette, which every path must skip.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cpuskin.hpp"
+
+struct TestSettings
+{
+	size_t vertices = 100003;
+	float tolerance = 1e-4f;
+};
+
+const size_t PALETTE_SIZE = 64;
+
+// Positions and unit normals in [-1, 1], up to MAX_BONE_INFLUENCE influences with weights summing to
+// one, and about one slot in eight holding an ID no path may read
+Mesh makeMesh(size_t count, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f), weight(0.05f, 1.0f);
+	std::uniform_int_distribution<int> bone(0, (int)PALETTE_SIZE - 1), influences(1, MAX_BONE_INFLUENCE), invalid(0, 7);
+	Mesh mesh;
+	for (size_t v = 0; v < count; v++)
+	{
+		mesh.vertices.push_back(glm::vec3(unit(random), unit(random), unit(random)));
+		mesh.normals.push_back(glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 2.0f)));
+
+		glm::ivec4 ids(-1);
+		glm::vec4 weights(0.0f);
+		int used = influences(random);
+		for (int i = 0; i < used; i++)
+		{
+			ids[i] = bone(random);
+			weights[i] = weight(random);
+		}
+		weights /= weights.x + weights.y + weights.z + weights.w;
+		if (invalid(random) == 0)
+			ids[MAX_BONE_INFLUENCE - 1] = invalid(random) < 4 ? -1 : (int)PALETTE_SIZE + 3;
+		mesh.boneIDs.push_back(ids);
+		mesh.weights.push_back(weights);
+	}
+	return mesh;
+}
+
+// Rotations, scales of 0.5 to 1.5 and translations in [-1, 1], as a posed skeleton has
+std::vector<glm::mat4> makePalette(std::mt19937& random)
+{
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f), angle(-3.14159f, 3.14159f), scale(0.5f, 1.5f);
+	std::vector<glm::mat4> palette;
+	for (size_t i = 0; i < PALETTE_SIZE; i++)
+	{
+		glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 2.0f, 0.0f));
+		glm::mat4 bone = glm::translate(glm::mat4(1.0f), glm::vec3(unit(random), unit(random), unit(random)));
+		bone = glm::rotate(bone, angle(random), axis);
+		palette.push_back(glm::scale(bone, glm::vec3(scale(random))));
+	}
+	return palette;
+}
+
+void printUsage()
+{
+	printf("usage: skintest [--vertices N] [--tolerance T]\n");
+}
+
+bool parseArguments(int argc, char** argv, TestSettings& settings)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h")
+			return false;
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const char* value = argv[++i];
+		if (arg == "--vertices")
+			settings.vertices = (size_t)std::max(1, atoi(value));
+		else if (arg == "--tolerance")
+			settings.tolerance = (float)atof(value);
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	TestSettings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		printUsage();
+		return 2;
+	}
+
+	std::mt19937 random(1234);
+	Mesh mesh = makeMesh(settings.vertices, random);
+	std::vector<glm::mat4> palette = makePalette(random);
+
+	bool passed = true;
+	Mesh partial = mesh;
+	partial.normals.pop_back();
+	if (!canSkinOnCpu(mesh) || canSkinOnCpu(partial))
+	{
+		printf("FAIL canSkinOnCpu accepts a mesh without a normal per vertex, or rejects a complete one\n");
+		passed = false;
+	}
+
+	std::vector<SkinningPath> paths = { SKIN_REFERENCE };
+#ifdef CPUSKIN_X86
+	paths.push_back(SKIN_SSE);
+	if (cpuHasAvx2())
+		paths.push_back(SKIN_AVX2);
+	else
+		printf("AVX2 not supported here, skipped\n");
+#endif
+
+	unsigned int extraThreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	printf("%zu vertices, %zu bones, tolerance %g\n\n", mesh.vertices.size(), palette.size(), settings.tolerance);
+	printf("%-10s %8s %14s %14s %16s\n", "path", "threads", "position error", "normal error", "vertices/ms");
+	for (SkinningPath path : paths)
+	{
+		for (unsigned int extra : { 0u, extraThreads })
+		{
+			CpuSkinner skinner(path, extra);
+			// Small enough ranges that every thread gets some
+			skinner.minVerticesPerThread = 1024;
+			SkinningError error = validateCpuSkinning(skinner, mesh, palette);
+			bool ok = error.position <= settings.tolerance && error.normal <= settings.tolerance;
+			printf("%-10s %8u %14g %14g %16.0f%s\n", skinningPathName(skinner.path), skinner.threadCount(), error.position, error.normal,
+				benchmarkCpuSkinning(skinner, mesh, palette), ok ? "" : "  FAIL");
+			passed = passed && ok;
+		}
+	}
+	return passed ? 0 : 1;
+}
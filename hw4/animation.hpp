@@ -4,13 +4,16 @@
 #include <glm/glm.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
+#include <assimp/postprocess.h>
 
+#include <cassert>
 #include <string>
 #include <vector>
 #include <map>
 
 #include "bone.hpp"
-#include "model.hpp"
+#include "skeleton.hpp"
+#include "profiler.hpp"
 
 struct AssimpNodeData
 {
@@ -24,8 +27,11 @@ struct AssimpNodeData
 class Animation
 {
 public:
-	Animation(const std::string& animationPath, Model* model)
+	// Bones of the clip that skeleton lacks are appended to it, so every clip loaded against one
+	// skeleton shares its bone IDs
+	Animation(const std::string& animationPath, std::vector<BoneProps>& skeleton)
 	{
+		PROFILE_SCOPE("Load animation");
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
 		assert(scene && scene->mRootNode);
@@ -37,7 +43,7 @@ public:
 		generateBoneTree(&rootNode, scene->mRootNode);
 		// Reset all root transformations
 		rootNode.transformation = glm::mat4(1.0f);
-		loadIntermediateBones(animation, model);
+		loadIntermediateBones(animation, skeleton);
 	}
 
 	Bone* findBone(const std::string& name)
@@ -69,9 +75,9 @@ private:
 	AssimpNodeData rootNode;
 	std::vector<BoneProps> boneProps;
 
-	void loadIntermediateBones(const aiAnimation* animation, Model* model)
+	void loadIntermediateBones(const aiAnimation* animation, std::vector<BoneProps>& skeleton)
 	{
-		auto& boneProps = model->boneProps;
+		auto& boneProps = skeleton;
 
 		for (int i = 0; i < animation->mNumChannels; i++)
 		{
@@ -2,6 +2,7 @@
 #define ANIMATOR_HPP
 
 #include "animation.hpp"
+#include "profiler.hpp"
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>  // slerp һݪ禡
@@ -17,6 +18,9 @@ private:
     float currentTime;                       // eʵeɶW
     bool interpolating;                      // O_biʵeL
     float haltTime;                          // ʵeȰɶI]LΡ^
+    int updateInterval;                      // Frames between pose evaluations, see setUpdateInterval
+    int skippedFrames;                       // Frames since the last evaluation
+    float skippedTime;                       // Time accumulated over those frames
     float interTime;                         // ʵeL窺eɶ
 
 public:
@@ -27,6 +31,9 @@ public:
         interpolating = false;
         haltTime = 0.0;
         interTime = 0.0;
+        updateInterval = 1;
+        skippedFrames = 0;
+        skippedTime = 0.0f;
 
         currentAnimation = nullptr;
         nextAnimation = nullptr;
@@ -41,6 +48,7 @@ public:
     // sʵeACVIs@
     void updateAnimation(float dt)
     {
+        PROFILE_SCOPE("Animator::updateAnimation");
         if (currentAnimation) {
             // seɶAھڰʵetשMɶWqis
             currentTime = fmod(currentTime + currentAnimation->getTicksPerSecond() * dt, currentAnimation->getDuration());
@@ -184,12 +192,38 @@ public:
             calculateBoneTransform(&node->children[i], globalTransformation, animation, currentTime);
     }
 
+    // Evaluate the pose only every given number of frames, e.g. while the character is culled.
+    // The animation clock still advances by the full time.
+    void setUpdateInterval(int frames)
+    {
+        updateInterval = frames < 1 ? 1 : frames;
+    }
+
+    // Call once per frame. Returns whether to evaluate the pose this frame, with dt replaced by the
+    // time since the last evaluation.
+    bool consumeUpdate(float& dt)
+    {
+        skippedTime += dt;
+        if (++skippedFrames < updateInterval)
+            return false;
+        dt = skippedTime;
+        skippedFrames = 0;
+        skippedTime = 0.0f;
+        return true;
+    }
+
     // ̲װfx}
     std::vector<glm::mat4> getFinalBoneMatrices()
     {
         return finalBoneMatrices;
     }
 
+    // The palette without a copy, for filling storage that already has the right size
+    const std::vector<glm::mat4>& boneMatrices() const
+    {
+        return finalBoneMatrices;
+    }
+
     Animation* getNextAnimation() {
         return nextAnimation;
     }
@@ -266,6 +300,7 @@ public:
 
     void blendAnimations(float dt, Animation* animA, Animation* animB, float blendFactor)
     {
+        PROFILE_SCOPE("Animator::blendAnimations");
         if (animA && animB) {
             // pӰʵeU۪ɶI
             float currentTimeA = fmod(currentTime, animA->getDuration());
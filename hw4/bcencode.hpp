@@ -0,0 +1,469 @@
+#ifndef BCENCODE_HPP
+#define BCENCODE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// CPU encoders for the GPU block formats used by the texture cook. Every format works on 4x4
+// pixel blocks; edge blocks of images that are not a multiple of 4 repeat the last row/column.
+//
+//   BC1  8 bytes   RGB, two 565 endpoints + 2-bit indices
+//   BC3  16 bytes  RGBA, BC4 alpha block + BC1 color block
+//   BC4  8 bytes   one channel, two 8-bit endpoints + 3-bit indices
+//   BC5  16 bytes  two channels, two BC4 blocks
+//   BC7  16 bytes  RGBA, mode 6 only: 7-bit endpoints with a p-bit each + 4-bit indices
+//
+// Nothing here touches GL, so it runs on loader threads and in headless cook tools.
+
+enum TextureCompression : uint32_t
+{
+	COMPRESS_NONE = 0,
+	COMPRESS_BC1,
+	COMPRESS_BC3,
+	COMPRESS_BC4,
+	COMPRESS_BC5,
+	COMPRESS_BC7,
+};
+
+inline size_t compressedBlockBytes(TextureCompression compression)
+{
+	return compression == COMPRESS_BC1 || compression == COMPRESS_BC4 ? 8 : 16;
+}
+
+inline const char* compressionName(TextureCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESS_BC1: return "bc1";
+	case COMPRESS_BC3: return "bc3";
+	case COMPRESS_BC4: return "bc4";
+	case COMPRESS_BC5: return "bc5";
+	case COMPRESS_BC7: return "bc7";
+	default: return "rgba";
+	}
+}
+
+inline size_t compressedLevelBytes(TextureCompression compression, uint32_t width, uint32_t height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * compressedBlockBytes(compression);
+}
+
+// Gather one 4x4 block as RGBA. One channel images become (r, r, r, 1), two channel ones (r, g, 0, 1).
+inline void fetchBlock(const uint8_t* pixels, int width, int height, int channels, int blockX, int blockY, uint8_t block[16][4])
+{
+	for (int y = 0; y < 4; y++)
+	{
+		int sy = std::min(blockY * 4 + y, height - 1);
+		for (int x = 0; x < 4; x++)
+		{
+			int sx = std::min(blockX * 4 + x, width - 1);
+			const uint8_t* in = pixels + ((size_t)sy * width + sx) * channels;
+			uint8_t* out = block[y * 4 + x];
+			out[0] = in[0];
+			out[1] = channels == 1 ? in[0] : in[1];
+			out[2] = channels == 1 ? in[0] : channels == 2 ? 0 : in[2];
+			out[3] = channels == 4 ? in[3] : 255;
+		}
+	}
+}
+
+// Dominant direction of a point cloud around its mean (power iteration on the covariance)
+inline glm::vec4 principalAxis(const glm::vec4 points[16], const glm::vec4& mean, int dimensions)
+{
+	glm::mat4 covariance(0.0f);
+	for (int i = 0; i < 16; i++)
+	{
+		glm::vec4 d = points[i] - mean;
+		covariance += glm::outerProduct(d, d);
+	}
+
+	glm::vec4 axis(1.0f, 1.0f, 1.0f, dimensions == 4 ? 1.0f : 0.0f);
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		glm::vec4 next = covariance * axis;
+		float length = glm::length(next);
+		if (length < 1e-8f)
+			break;
+		axis = next / length;
+	}
+	return axis;
+}
+
+// Endpoints a, b minimizing sum |(1 - t_i) a + t_i b - x_i|^2 for fixed interpolation weights t_i.
+// Returns false when the system is singular (all pixels on one index).
+inline bool leastSquaresEndpoints(const glm::vec4 points[16], const float weights[16], glm::vec4& a, glm::vec4& b)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	glm::vec4 ax(0.0f), bx(0.0f);
+	for (int i = 0; i < 16; i++)
+	{
+		float t = weights[i];
+		float s = 1.0f - t;
+		aa += s * s;
+		ab += s * t;
+		bb += t * t;
+		ax += s * points[i];
+		bx += t * points[i];
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabs(determinant) < 1e-6f)
+		return false;
+	a = (ax * bb - bx * ab) / determinant;
+	b = (bx * aa - ax * ab) / determinant;
+	return true;
+}
+
+// Range of the block's points along the principal axis
+inline void axisEndpoints(const glm::vec4 points[16], int dimensions, glm::vec4& low, glm::vec4& high)
+{
+	glm::vec4 mean(0.0f);
+	for (int i = 0; i < 16; i++)
+		mean += points[i];
+	mean /= 16.0f;
+
+	glm::vec4 axis = principalAxis(points, mean, dimensions);
+	float minimum = 0.0f, maximum = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = glm::dot(points[i] - mean, axis);
+		minimum = std::min(minimum, t);
+		maximum = std::max(maximum, t);
+	}
+	low = mean + axis * minimum;
+	high = mean + axis * maximum;
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC1
+
+inline uint16_t packColor565(const glm::vec4& color)
+{
+	int r = (int)glm::clamp(color.r * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+	int g = (int)glm::clamp(color.g * 63.0f / 255.0f + 0.5f, 0.0f, 63.0f);
+	int b = (int)glm::clamp(color.b * 31.0f / 255.0f + 0.5f, 0.0f, 31.0f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline glm::vec4 unpackColor565(uint16_t color)
+{
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	return glm::vec4((float)((r << 3) | (r >> 2)), (float)((g << 2) | (g >> 4)), (float)((b << 3) | (b >> 2)), 255.0f);
+}
+
+// Pick the nearest of the four palette entries for every pixel; returns the summed squared RGB error
+inline float assignColorIndices(const glm::vec4 points[16], uint16_t color0, uint16_t color1, uint8_t indices[16])
+{
+	glm::vec3 palette[4];
+	palette[0] = glm::vec3(unpackColor565(color0));
+	palette[1] = glm::vec3(unpackColor565(color1));
+	palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+	float error = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		glm::vec3 p(points[i]);
+		float best = 1e30f;
+		for (int j = 0; j < 4; j++)
+		{
+			glm::vec3 d = p - palette[j];
+			float distance = glm::dot(d, d);
+			if (distance < best)
+			{
+				best = distance;
+				indices[i] = (uint8_t)j;
+			}
+		}
+		error += best;
+	}
+	return error;
+}
+
+// Always uses the four color mode (color0 > color1), which BC3 requires
+inline void encodeColorBlock(const uint8_t block[16][4], uint8_t* out)
+{
+	glm::vec4 points[16];
+	for (int i = 0; i < 16; i++)
+		points[i] = glm::vec4(block[i][0], block[i][1], block[i][2], 0.0f);
+
+	glm::vec4 low, high;
+	axisEndpoints(points, 3, low, high);
+
+	uint16_t color0 = packColor565(high);
+	uint16_t color1 = packColor565(low);
+	uint8_t indices[16];
+	float error = assignColorIndices(points, color0, color1, indices);
+
+	// One refinement pass with endpoints fitted to the chosen indices
+	const float indexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = indexWeights[indices[i]];
+	glm::vec4 a, b;
+	if (leastSquaresEndpoints(points, weights, a, b))
+	{
+		uint16_t refined0 = packColor565(a);
+		uint16_t refined1 = packColor565(b);
+		uint8_t refinedIndices[16];
+		float refinedError = assignColorIndices(points, refined0, refined1, refinedIndices);
+		if (refinedError < error)
+		{
+			color0 = refined0;
+			color1 = refined1;
+			memcpy(indices, refinedIndices, sizeof(indices));
+		}
+	}
+
+	if (color0 < color1)
+	{
+		std::swap(color0, color1);
+		for (int i = 0; i < 16; i++)
+			indices[i] ^= 1;
+	}
+	else if (color0 == color1)
+	{
+		memset(indices, 0, sizeof(indices));
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= (uint32_t)indices[i] << (2 * i);
+	out[0] = (uint8_t)(color0 & 0xFF);
+	out[1] = (uint8_t)(color0 >> 8);
+	out[2] = (uint8_t)(color1 & 0xFF);
+	out[3] = (uint8_t)(color1 >> 8);
+	memcpy(out + 4, &bits, 4);
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC4 / BC5 / BC3 alpha
+
+// Eight-value mode: endpoints are the block's extremes, six interpolated values between them
+inline void encodeChannelBlock(const uint8_t block[16][4], int channel, uint8_t* out)
+{
+	int maximum = 0, minimum = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		maximum = std::max(maximum, (int)block[i][channel]);
+		minimum = std::min(minimum, (int)block[i][channel]);
+	}
+
+	out[0] = (uint8_t)maximum;
+	out[1] = (uint8_t)minimum;
+
+	int palette[8];
+	palette[0] = maximum;
+	palette[1] = minimum;
+	for (int i = 1; i < 7; i++)
+		palette[i + 1] = ((7 - i) * maximum + i * minimum + 3) / 7;
+
+	uint64_t bits = 0;
+	for (int i = 0; i < 16 && maximum != minimum; i++)
+	{
+		int value = block[i][channel];
+		int bestIndex = 0, best = 256;
+		for (int j = 0; j < 8; j++)
+		{
+			int distance = abs(value - palette[j]);
+			if (distance < best)
+			{
+				best = distance;
+				bestIndex = j;
+			}
+		}
+		bits |= (uint64_t)bestIndex << (3 * i);
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+// ---------------------------------------------------------------------------------------------
+// BC7 mode 6
+
+const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Mode6
+{
+	int endpoints[2][4]; // 7-bit
+	int pbits[2];
+	uint8_t indices[16];
+	float error;
+};
+
+inline int bc7Expand(int endpoint, int pbit)
+{
+	return (endpoint << 1) | pbit;
+}
+
+// Quantize both float endpoints for one p-bit pair and assign the best index to every pixel
+inline void bc7Evaluate(const glm::vec4 points[16], const glm::vec4& a, const glm::vec4& b, int pbit0, int pbit1, Bc7Mode6& result)
+{
+	result.pbits[0] = pbit0;
+	result.pbits[1] = pbit1;
+	int expanded[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		result.endpoints[0][c] = (int)glm::clamp((a[c] - pbit0) / 2.0f + 0.5f, 0.0f, 127.0f);
+		result.endpoints[1][c] = (int)glm::clamp((b[c] - pbit1) / 2.0f + 0.5f, 0.0f, 127.0f);
+		expanded[0][c] = bc7Expand(result.endpoints[0][c], pbit0);
+		expanded[1][c] = bc7Expand(result.endpoints[1][c], pbit1);
+	}
+
+	glm::vec4 palette[16];
+	for (int j = 0; j < 16; j++)
+	{
+		for (int c = 0; c < 4; c++)
+			palette[j][c] = (float)(((64 - BC7_WEIGHTS4[j]) * expanded[0][c] + BC7_WEIGHTS4[j] * expanded[1][c] + 32) >> 6);
+	}
+
+	result.error = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float best = 1e30f;
+		for (int j = 0; j < 16; j++)
+		{
+			glm::vec4 d = points[i] - palette[j];
+			float distance = glm::dot(d, d);
+			if (distance < best)
+			{
+				best = distance;
+				result.indices[i] = (uint8_t)j;
+			}
+		}
+		result.error += best;
+	}
+}
+
+inline Bc7Mode6 bc7BestPbits(const glm::vec4 points[16], const glm::vec4& a, const glm::vec4& b)
+{
+	Bc7Mode6 best, candidate;
+	best.error = 1e30f;
+	for (int p = 0; p < 4; p++)
+	{
+		bc7Evaluate(points, a, b, p & 1, p >> 1, candidate);
+		if (candidate.error < best.error)
+			best = candidate;
+	}
+	return best;
+}
+
+// Little-endian bit writer for the 128-bit block
+struct BlockWriter
+{
+	uint8_t* out;
+	int position = 0;
+
+	void write(uint32_t value, int bits)
+	{
+		for (int i = 0; i < bits; i++, position++)
+		{
+			if (value & (1u << i))
+				out[position >> 3] |= (uint8_t)(1u << (position & 7));
+		}
+	}
+};
+
+inline void encodeBc7Block(const uint8_t block[16][4], uint8_t* out)
+{
+	glm::vec4 points[16];
+	for (int i = 0; i < 16; i++)
+		points[i] = glm::vec4(block[i][0], block[i][1], block[i][2], block[i][3]);
+
+	glm::vec4 low, high;
+	axisEndpoints(points, 4, low, high);
+	Bc7Mode6 best = bc7BestPbits(points, low, high);
+
+	// Refit the endpoints to the chosen indices until it stops helping
+	for (int iteration = 0; iteration < 2; iteration++)
+	{
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = BC7_WEIGHTS4[best.indices[i]] / 64.0f;
+		glm::vec4 a, b;
+		if (!leastSquaresEndpoints(points, weights, a, b))
+			break;
+		Bc7Mode6 refined = bc7BestPbits(points, glm::clamp(a, 0.0f, 255.0f), glm::clamp(b, 0.0f, 255.0f));
+		if (refined.error >= best.error)
+			break;
+		best = refined;
+	}
+
+	// The anchor index (pixel 0) is stored without its top bit, so it must be below 8
+	if (best.indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; c++)
+			std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+		std::swap(best.pbits[0], best.pbits[1]);
+		for (int i = 0; i < 16; i++)
+			best.indices[i] = (uint8_t)(15 - best.indices[i]);
+	}
+
+	memset(out, 0, 16);
+	BlockWriter writer = { out };
+	writer.write(1u << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		writer.write(best.endpoints[0][c], 7);
+		writer.write(best.endpoints[1][c], 7);
+	}
+	writer.write(best.pbits[0], 1);
+	writer.write(best.pbits[1], 1);
+	writer.write(best.indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.write(best.indices[i], 4);
+}
+
+// ---------------------------------------------------------------------------------------------
+
+// Encode one image into out, which must hold compressedLevelBytes(compression, width, height) bytes
+inline void compressImage(const uint8_t* pixels, int width, int height, int channels, TextureCompression compression, uint8_t* out)
+{
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	size_t blockBytes = compressedBlockBytes(compression);
+
+	uint8_t block[16][4];
+	for (int by = 0; by < blocksY; by++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			fetchBlock(pixels, width, height, channels, bx, by, block);
+			uint8_t* target = out + ((size_t)by * blocksX + bx) * blockBytes;
+			switch (compression)
+			{
+			case COMPRESS_BC1:
+				encodeColorBlock(block, target);
+				break;
+			case COMPRESS_BC3:
+				encodeChannelBlock(block, 3, target);
+				encodeColorBlock(block, target + 8);
+				break;
+			case COMPRESS_BC4:
+				// Color sources are reduced to luma; the upload swizzles red back out to RGB
+				if (channels >= 3)
+				{
+					for (int i = 0; i < 16; i++)
+						block[i][0] = (uint8_t)((54 * block[i][0] + 183 * block[i][1] + 19 * block[i][2] + 128) >> 8);
+				}
+				encodeChannelBlock(block, 0, target);
+				break;
+			case COMPRESS_BC5:
+				encodeChannelBlock(block, 0, target);
+				encodeChannelBlock(block, 1, target + 8);
+				break;
+			case COMPRESS_BC7:
+				encodeBc7Block(block, target);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "culling.hpp"
+
+// Dynamic bounding volume hierarchy over boxes that each carry a value. Leaves are added and
+// removed one at a time, choosing the sibling that grows the tree's surface area least. A moving
+// leaf keeps its place: its box is stored with a margin, boxes that stay inside it change nothing,
+// and others refit the leaf and its ancestors. Refits loosen the tree over time; rebuild replaces
+// the whole tree by a top-down surface area heuristic build, which is best for content that stays
+// put. Queries use one traversal stack and are not thread-safe.
+class Bvh
+{
+public:
+	static constexpr unsigned int none = ~0u;
+
+	// Work done by the last query
+	struct QueryStats
+	{
+		unsigned int boxTests = 0;
+		unsigned int hits = 0;
+	};
+
+	explicit Bvh(float margin = 0.0f) : margin(margin)
+	{
+	}
+
+	// Add a leaf for box, which must not be empty; returns the leaf's ID
+	unsigned int insert(const BoundingBox& box, unsigned int value)
+	{
+		unsigned int leaf = allocate();
+		nodes[leaf].box = fatten(box);
+		nodes[leaf].value = value;
+		leaves++;
+		insertLeaf(leaf);
+		return leaf;
+	}
+
+	void remove(unsigned int leaf)
+	{
+		removeLeaf(leaf);
+		release(leaf);
+		leaves--;
+	}
+
+	// Give a leaf a new box. Returns false when the stored box still holds it and nothing changed.
+	bool move(unsigned int leaf, const BoundingBox& box)
+	{
+		const BoundingBox& stored = nodes[leaf].box;
+		if (glm::all(glm::greaterThanEqual(box.minimum, stored.minimum)) && glm::all(glm::lessThanEqual(box.maximum, stored.maximum)))
+			return false;
+		nodes[leaf].box = fatten(box);
+		refit(nodes[leaf].parent);
+		return true;
+	}
+
+	// Rebuild the tree over the current leaves, splitting each range where binned centroids give the
+	// lowest surface area cost
+	void rebuild()
+	{
+		std::vector<unsigned int> leafIDs;
+		leafIDs.reserve(leaves);
+		for (unsigned int i = 0; i < nodes.size(); i++)
+		{
+			if (nodes[i].allocated && nodes[i].leaf())
+				leafIDs.push_back(i);
+			else if (nodes[i].allocated)
+				release(i);
+		}
+		root = leafIDs.empty() ? none : build(leafIDs, 0, (unsigned int)leafIDs.size());
+		if (root != none)
+			nodes[root].parent = none;
+	}
+
+	unsigned int value(unsigned int leaf) const
+	{
+		return nodes[leaf].value;
+	}
+
+	unsigned int leafCount() const
+	{
+		return leaves;
+	}
+
+	// Visit the value of every leaf whose box is at least partly inside the frustum. Subtrees wholly
+	// inside are visited without testing their boxes.
+	template <typename Visit>
+	void queryFrustum(const Frustum& frustum, Visit visit)
+	{
+		lastQuery = QueryStats();
+		if (root == none)
+			return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			unsigned int index = stack.back();
+			stack.pop_back();
+			const TreeNode& node = nodes[index];
+			lastQuery.boxTests++;
+			if (!boxInFrustum(frustum, node.box))
+				continue;
+			if (node.leaf())
+			{
+				lastQuery.hits++;
+				visit(node.value);
+			}
+			else if (boxInsideFrustum(frustum, node.box))
+				visitSubtree(index, visit);
+			else
+			{
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+
+	// Visit the value of every leaf whose box comes within radius of center
+	template <typename Visit>
+	void queryRadius(const glm::vec3& center, float radius, Visit visit)
+	{
+		lastQuery = QueryStats();
+		if (root == none)
+			return;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			const TreeNode& node = nodes[stack.back()];
+			stack.pop_back();
+			lastQuery.boxTests++;
+			glm::vec3 nearest = glm::clamp(center, node.box.minimum, node.box.maximum);
+			if (glm::dot(nearest - center, nearest - center) > radius * radius)
+				continue;
+			if (node.leaf())
+			{
+				lastQuery.hits++;
+				visit(node.value);
+			}
+			else
+			{
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+
+	// The value of the leaf whose box the ray enters first within maxDistance, with that distance
+	// in distance, or none. direction need not be normalized; distances are in its lengths.
+	unsigned int raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float* distance = nullptr)
+	{
+		lastQuery = QueryStats();
+		unsigned int hit = none;
+		if (root == none)
+			return hit;
+		glm::vec3 inverse = 1.0f / direction;
+		float best = maxDistance;
+		stack.clear();
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			const TreeNode& node = nodes[stack.back()];
+			stack.pop_back();
+			lastQuery.boxTests++;
+			float entry;
+			if (!rayHitsBox(origin, inverse, node.box, best, entry))
+				continue;
+			if (node.leaf())
+			{
+				best = entry;
+				hit = node.value;
+				continue;
+			}
+			// The nearer child goes on top, so its hits can prune the other
+			float leftEntry, rightEntry;
+			bool left = rayHitsBox(origin, inverse, nodes[node.left].box, best, leftEntry);
+			bool right = rayHitsBox(origin, inverse, nodes[node.right].box, best, rightEntry);
+			if (left && right && leftEntry < rightEntry)
+			{
+				stack.push_back(node.right);
+				stack.push_back(node.left);
+			}
+			else
+			{
+				if (left)
+					stack.push_back(node.left);
+				if (right)
+					stack.push_back(node.right);
+			}
+		}
+		if (hit != none)
+		{
+			lastQuery.hits = 1;
+			if (distance)
+				*distance = best;
+		}
+		return hit;
+	}
+
+	QueryStats lastQuery;
+
+private:
+	struct TreeNode
+	{
+		BoundingBox box;
+		unsigned int parent = none;
+		unsigned int left = none;
+		unsigned int right = none;
+		unsigned int value = 0;
+		bool allocated = false;
+
+		bool leaf() const
+		{
+			return left == none;
+		}
+	};
+
+	static float area(const BoundingBox& box)
+	{
+		glm::vec3 size = box.maximum - box.minimum;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	static BoundingBox merge(const BoundingBox& a, const BoundingBox& b)
+	{
+		BoundingBox box = a;
+		box.expand(b);
+		return box;
+	}
+
+	static bool rayHitsBox(const glm::vec3& origin, const glm::vec3& inverse, const BoundingBox& box, float maxDistance, float& entry)
+	{
+		glm::vec3 t0 = (box.minimum - origin) * inverse;
+		glm::vec3 t1 = (box.maximum - origin) * inverse;
+		glm::vec3 enter = glm::min(t0, t1), leave = glm::max(t0, t1);
+		entry = std::max(std::max(enter.x, enter.y), std::max(enter.z, 0.0f));
+		float exit = std::min(std::min(leave.x, leave.y), std::min(leave.z, maxDistance));
+		return entry <= exit;
+	}
+
+	BoundingBox fatten(const BoundingBox& box) const
+	{
+		BoundingBox fat = box;
+		fat.minimum -= glm::vec3(margin);
+		fat.maximum += glm::vec3(margin);
+		return fat;
+	}
+
+	unsigned int allocate()
+	{
+		unsigned int index;
+		if (!freeNodes.empty())
+		{
+			index = freeNodes.back();
+			freeNodes.pop_back();
+		}
+		else
+		{
+			index = (unsigned int)nodes.size();
+			nodes.emplace_back();
+		}
+		nodes[index] = TreeNode();
+		nodes[index].allocated = true;
+		return index;
+	}
+
+	void release(unsigned int index)
+	{
+		nodes[index].allocated = false;
+		freeNodes.push_back(index);
+	}
+
+	void insertLeaf(unsigned int leaf)
+	{
+		if (root == none)
+		{
+			root = leaf;
+			nodes[leaf].parent = none;
+			return;
+		}
+
+		// Walk down while pushing the leaf into a child costs less than pairing it with this node
+		const BoundingBox box = nodes[leaf].box;
+		unsigned int index = root;
+		while (!nodes[index].leaf())
+		{
+			const TreeNode& node = nodes[index];
+			float combined = area(merge(node.box, box));
+			float pairCost = combined;
+			// Every ancestor of the leaf grows by as much as this node does
+			float inherited = combined - area(node.box);
+			float leftCost = childCost(node.left, box) + inherited;
+			float rightCost = childCost(node.right, box) + inherited;
+			if (pairCost < leftCost && pairCost < rightCost)
+				break;
+			index = leftCost < rightCost ? node.left : node.right;
+		}
+
+		unsigned int sibling = index;
+		unsigned int oldParent = nodes[sibling].parent;
+		unsigned int parent = allocate();
+		nodes[parent].parent = oldParent;
+		nodes[parent].box = merge(box, nodes[sibling].box);
+		nodes[parent].left = sibling;
+		nodes[parent].right = leaf;
+		nodes[sibling].parent = parent;
+		nodes[leaf].parent = parent;
+		if (oldParent == none)
+			root = parent;
+		else if (nodes[oldParent].left == sibling)
+			nodes[oldParent].left = parent;
+		else
+			nodes[oldParent].right = parent;
+		refit(oldParent);
+	}
+
+	float childCost(unsigned int child, const BoundingBox& box) const
+	{
+		float combined = area(merge(nodes[child].box, box));
+		return nodes[child].leaf() ? combined : combined - area(nodes[child].box);
+	}
+
+	void removeLeaf(unsigned int leaf)
+	{
+		if (leaf == root)
+		{
+			root = none;
+			return;
+		}
+		unsigned int parent = nodes[leaf].parent;
+		unsigned int grandParent = nodes[parent].parent;
+		unsigned int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+		nodes[sibling].parent = grandParent;
+		if (grandParent == none)
+			root = sibling;
+		else if (nodes[grandParent].left == parent)
+			nodes[grandParent].left = sibling;
+		else
+			nodes[grandParent].right = sibling;
+		release(parent);
+		refit(grandParent);
+	}
+
+	// Recompute the boxes from index up to the root
+	void refit(unsigned int index)
+	{
+		for (; index != none; index = nodes[index].parent)
+			nodes[index].box = merge(nodes[nodes[index].left].box, nodes[nodes[index].right].box);
+	}
+
+	template <typename Visit>
+	void visitSubtree(unsigned int index, Visit& visit)
+	{
+		// Below the frustum query's entries on the same stack
+		size_t base = stack.size();
+		stack.push_back(index);
+		while (stack.size() > base)
+		{
+			const TreeNode& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.leaf())
+			{
+				lastQuery.hits++;
+				visit(node.value);
+			}
+			else
+			{
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+
+	unsigned int build(std::vector<unsigned int>& leafIDs, unsigned int begin, unsigned int end)
+	{
+		if (end - begin == 1)
+			return leafIDs[begin];
+
+		BoundingBox bounds, centroids;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			bounds.expand(nodes[leafIDs[i]].box);
+			centroids.expand(center(leafIDs[i]));
+		}
+		glm::vec3 extent = centroids.maximum - centroids.minimum;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		unsigned int middle = begin + (end - begin) / 2;
+		if (extent[axis] > 0.0f)
+		{
+			static const int binCount = 12;
+			BoundingBox binBoxes[binCount];
+			unsigned int binCounts[binCount] = {};
+			float scale = binCount / extent[axis];
+			auto binOf = [&](unsigned int leaf) {
+				return std::min(binCount - 1, (int)((center(leaf)[axis] - centroids.minimum[axis]) * scale));
+			};
+			for (unsigned int i = begin; i < end; i++)
+			{
+				int bin = binOf(leafIDs[i]);
+				binCounts[bin]++;
+				binBoxes[bin].expand(nodes[leafIDs[i]].box);
+			}
+
+			// Cost of splitting after each bin, from a sweep in each direction
+			float rightCosts[binCount] = {};
+			BoundingBox sweep;
+			unsigned int count = 0;
+			for (int bin = binCount - 1; bin > 0; bin--)
+			{
+				sweep.expand(binBoxes[bin]);
+				count += binCounts[bin];
+				rightCosts[bin - 1] = count ? count * area(sweep) : 0.0f;
+			}
+			int bestSplit = -1;
+			float bestCost = (float)(end - begin) * area(bounds);
+			sweep = BoundingBox();
+			count = 0;
+			for (int bin = 0; bin < binCount - 1; bin++)
+			{
+				sweep.expand(binBoxes[bin]);
+				count += binCounts[bin];
+				if (count == 0 || count == end - begin)
+					continue;
+				float cost = count * area(sweep) + rightCosts[bin];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = bin;
+				}
+			}
+			if (bestSplit >= 0)
+			{
+				middle = (unsigned int)(std::partition(leafIDs.begin() + begin, leafIDs.begin() + end,
+					[&](unsigned int leaf) { return binOf(leaf) <= bestSplit; }) - leafIDs.begin());
+			}
+			else
+			{
+				// No split beats a leaf per node either way; halve around the median
+				std::nth_element(leafIDs.begin() + begin, leafIDs.begin() + middle, leafIDs.begin() + end,
+					[&](unsigned int a, unsigned int b) { return center(a)[axis] < center(b)[axis]; });
+			}
+		}
+
+		unsigned int node = allocate();
+		unsigned int left = build(leafIDs, begin, middle);
+		unsigned int right = build(leafIDs, middle, end);
+		nodes[node].left = left;
+		nodes[node].right = right;
+		nodes[node].box = bounds;
+		nodes[left].parent = node;
+		nodes[right].parent = node;
+		return node;
+	}
+
+	glm::vec3 center(unsigned int index) const
+	{
+		return (nodes[index].box.minimum + nodes[index].box.maximum) * 0.5f;
+	}
+
+	float margin;
+	std::vector<TreeNode> nodes;
+	std::vector<unsigned int> freeNodes;
+	unsigned int root = none;
+	unsigned int leaves = 0;
+	std::vector<unsigned int> stack;
+};
+
+#endif
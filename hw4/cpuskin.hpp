@@ -0,0 +1,337 @@
+#ifndef CPUSKIN_HPP
+#define CPUSKIN_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// The SSE and AVX2 paths exist on x86 only; elsewhere every skinner uses the reference path
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPUSKIN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "mesh.hpp"
+#include "profiler.hpp"
+#include "workerpool.hpp"
+
+// CPU skinning: the linear blend skinning of skin.vert, for code that needs skinned vertices on the
+// CPU (picking, attachments, headless validation) or to take vertex work off the GPU. Nothing here
+// touches GL; cpuSkinNode in preskin.hpp writes the result into the pre-skinning buffers.
+//
+// An influence counts when its bone ID is in [0, palette size). This matches the packed layout; the
+// float layout in skin.vert falls back to the bind pose for IDs >= MAX_BONES, which the importer
+// never produces.
+
+// Per-vertex output of skin.vert, in the order of its captured varyings
+struct SkinnedVertex
+{
+	float position[3];
+	float normal[3];
+};
+
+enum SkinningPath
+{
+	SKIN_REFERENCE, // Scalar glm, the ground truth for the others
+	SKIN_SSE, // Blends the four bone matrices of one vertex, a column per register
+	SKIN_AVX2, // Eight vertices per iteration in SoA form, matrix rows fetched with gathers
+};
+
+inline const char* skinningPathName(SkinningPath path)
+{
+	switch (path)
+	{
+	case SKIN_REFERENCE: return "reference";
+	case SKIN_SSE: return "SSE";
+	case SKIN_AVX2: return "AVX2";
+	}
+	return "?";
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPUSKIN_AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define CPUSKIN_AVX2_TARGET
+#endif
+
+inline bool cpuHasAvx2()
+{
+#ifndef CPUSKIN_X86
+	return false;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	// The OS must save the upper halves of the YMM registers
+	return fma && osxsave && avx2 && (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+inline SkinningPath bestSkinningPath()
+{
+#ifdef CPUSKIN_X86
+	return cpuHasAvx2() ? SKIN_AVX2 : SKIN_SSE;
+#else
+	return SKIN_REFERENCE;
+#endif
+}
+
+// path, or the best path below it that this CPU runs
+inline SkinningPath supportedSkinningPath(SkinningPath path)
+{
+#ifdef CPUSKIN_X86
+	return path == SKIN_AVX2 && !cpuHasAvx2() ? SKIN_SSE : path;
+#else
+	return SKIN_REFERENCE;
+#endif
+}
+
+// Vertices [begin, end) of the mesh. The mesh must have a normal, bone IDs and weights per vertex.
+inline void skinVerticesReference(const Mesh& mesh, const glm::mat4* palette, size_t paletteSize, size_t begin, size_t end, SkinnedVertex* out)
+{
+	for (size_t v = begin; v < end; v++)
+	{
+		glm::vec4 position(0.0f);
+		glm::vec3 normal(0.0f);
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+		{
+			int bone = mesh.boneIDs[v][i];
+			if (bone < 0 || bone >= (int)paletteSize)
+				continue;
+			float weight = mesh.weights[v][i];
+			position += palette[bone] * glm::vec4(mesh.vertices[v], 1.0f) * weight;
+			normal += glm::mat3(palette[bone]) * mesh.normals[v] * weight;
+		}
+		memcpy(out[v].position, &position.x, sizeof(out[v].position));
+		memcpy(out[v].normal, &normal.x, sizeof(out[v].normal));
+	}
+}
+
+#ifdef CPUSKIN_X86
+// sum(w * B) * p equals sum(w * (B * p)), so one blended matrix transforms both position and normal
+inline void skinVerticesSSE(const Mesh& mesh, const glm::mat4* palette, size_t paletteSize, size_t begin, size_t end, SkinnedVertex* out)
+{
+	for (size_t v = begin; v < end; v++)
+	{
+		__m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+		{
+			int bone = mesh.boneIDs[v][i];
+			float weight = mesh.weights[v][i];
+			if (bone < 0 || bone >= (int)paletteSize || weight == 0.0f)
+				continue;
+			const float* m = glm::value_ptr(palette[bone]);
+			__m128 w = _mm_set1_ps(weight);
+			c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m), w));
+			c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m + 4), w));
+			c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m + 8), w));
+			c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m + 12), w));
+		}
+
+		const glm::vec3& p = mesh.vertices[v];
+		const glm::vec3& n = mesh.normals[v];
+		__m128 position = _mm_add_ps(_mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(p.x))),
+			_mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(p.y)), _mm_mul_ps(c2, _mm_set1_ps(p.z))));
+		__m128 normal = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n.x)),
+			_mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(n.y)), _mm_mul_ps(c2, _mm_set1_ps(n.z))));
+
+		float result[8];
+		_mm_storeu_ps(result, position);
+		_mm_storeu_ps(result + 4, normal);
+		memcpy(out[v].position, result, sizeof(out[v].position));
+		memcpy(out[v].normal, result + 4, sizeof(out[v].normal));
+	}
+}
+
+// Each lane is a vertex. Only the top three rows of the bone matrices are read; the bottom row of an
+// affine transform contributes nothing to the xyz outputs. The remainder goes through the SSE path.
+CPUSKIN_AVX2_TARGET inline void skinVerticesAVX2(const Mesh& mesh, const glm::mat4* palette, size_t paletteSize, size_t begin, size_t end, SkinnedVertex* out)
+{
+	const float* matrices = glm::value_ptr(palette[0]);
+	const float* positions = &mesh.vertices[0].x;
+	const float* normals = &mesh.normals[0].x;
+	const int* boneIDs = &mesh.boneIDs[0].x;
+	const float* weights = &mesh.weights[0].x;
+
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i noBone = _mm256_set1_epi32(-1);
+	const __m256i boneLimit = _mm256_set1_epi32((int)paletteSize);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t v = begin;
+	for (; v + 8 <= end; v += 8)
+	{
+		__m256i vertex = _mm256_add_epi32(_mm256_set1_epi32((int)v), lanes);
+		__m256i vec3Index = _mm256_add_epi32(_mm256_slli_epi32(vertex, 1), vertex);
+		__m256i vec4Index = _mm256_slli_epi32(vertex, 2);
+
+		__m256 px = _mm256_i32gather_ps(positions, vec3Index, 4);
+		__m256 py = _mm256_i32gather_ps(positions + 1, vec3Index, 4);
+		__m256 pz = _mm256_i32gather_ps(positions + 2, vec3Index, 4);
+		__m256 nx = _mm256_i32gather_ps(normals, vec3Index, 4);
+		__m256 ny = _mm256_i32gather_ps(normals + 1, vec3Index, 4);
+		__m256 nz = _mm256_i32gather_ps(normals + 2, vec3Index, 4);
+
+		__m256 outP[3] = { zero, zero, zero };
+		__m256 outN[3] = { zero, zero, zero };
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+		{
+			__m256i bone = _mm256_i32gather_epi32(boneIDs + i, vec4Index, 4);
+			__m256 weight = _mm256_i32gather_ps(weights + i, vec4Index, 4);
+			__m256i valid = _mm256_and_si256(_mm256_cmpgt_epi32(bone, noBone), _mm256_cmpgt_epi32(boneLimit, bone));
+			weight = _mm256_and_ps(weight, _mm256_castsi256_ps(valid));
+			if (_mm256_movemask_ps(_mm256_cmp_ps(weight, zero, _CMP_NEQ_OQ)) == 0)
+				continue;
+			// Invalid lanes read bone 0 with a zero weight
+			__m256i matrix = _mm256_slli_epi32(_mm256_and_si256(bone, valid), 4);
+
+			for (int row = 0; row < 3; row++)
+			{
+				__m256 m0 = _mm256_i32gather_ps(matrices + row, matrix, 4);
+				__m256 m1 = _mm256_i32gather_ps(matrices + 4 + row, matrix, 4);
+				__m256 m2 = _mm256_i32gather_ps(matrices + 8 + row, matrix, 4);
+				__m256 m3 = _mm256_i32gather_ps(matrices + 12 + row, matrix, 4);
+				__m256 p = _mm256_fmadd_ps(m0, px, _mm256_fmadd_ps(m1, py, _mm256_fmadd_ps(m2, pz, m3)));
+				__m256 n = _mm256_fmadd_ps(m0, nx, _mm256_fmadd_ps(m1, ny, _mm256_mul_ps(m2, nz)));
+				outP[row] = _mm256_fmadd_ps(weight, p, outP[row]);
+				outN[row] = _mm256_fmadd_ps(weight, n, outN[row]);
+			}
+		}
+
+		alignas(32) float result[6][8];
+		for (int row = 0; row < 3; row++)
+		{
+			_mm256_store_ps(result[row], outP[row]);
+			_mm256_store_ps(result[3 + row], outN[row]);
+		}
+		for (int lane = 0; lane < 8; lane++)
+		{
+			SkinnedVertex& o = out[v + lane];
+			o.position[0] = result[0][lane];
+			o.position[1] = result[1][lane];
+			o.position[2] = result[2][lane];
+			o.normal[0] = result[3][lane];
+			o.normal[1] = result[4][lane];
+			o.normal[2] = result[5][lane];
+		}
+	}
+	skinVerticesSSE(mesh, palette, paletteSize, v, end, out);
+}
+#endif
+
+inline void skinVertices(SkinningPath path, const Mesh& mesh, const glm::mat4* palette, size_t paletteSize, size_t begin, size_t end, SkinnedVertex* out)
+{
+	switch (path)
+	{
+#ifdef CPUSKIN_X86
+	case SKIN_SSE: skinVerticesSSE(mesh, palette, paletteSize, begin, end, out); break;
+	case SKIN_AVX2: skinVerticesAVX2(mesh, palette, paletteSize, begin, end, out); break;
+#endif
+	default: skinVerticesReference(mesh, palette, paletteSize, begin, end, out); break;
+	}
+}
+
+inline bool canSkinOnCpu(const Mesh& mesh)
+{
+	size_t count = mesh.vertices.size();
+	return count > 0 && mesh.normals.size() == count && mesh.boneIDs.size() == count && mesh.weights.size() == count;
+}
+
+// Skins meshes with one SIMD path, splitting large ones across a fixed set of threads. The calling
+// thread takes a share of the work, so a skinner with no extra threads skins serially.
+class CpuSkinner
+{
+public:
+	SkinningPath path;
+	// Meshes are split into ranges of at least this many vertices
+	size_t minVerticesPerThread = 4096;
+
+	explicit CpuSkinner(SkinningPath path = bestSkinningPath(), unsigned int extraThreads = std::max(1u, std::thread::hardware_concurrency()) - 1)
+		: path(supportedSkinningPath(path)), workers("Skinning worker", extraThreads)
+	{
+	}
+
+	// out must hold mesh.vertices.size() entries; it may be a mapped GL buffer. The mesh must pass
+	// canSkinOnCpu.
+	void skin(const Mesh& mesh, const std::vector<glm::mat4>& palette, SkinnedVertex* out)
+	{
+		PROFILE_SCOPE("CPU skinning");
+		size_t count = mesh.vertices.size();
+		size_t ranges = std::min<size_t>(threadCount(), std::max<size_t>(1, count / minVerticesPerThread));
+		if (ranges <= 1)
+		{
+			skinVertices(path, mesh, palette.data(), palette.size(), 0, count, out);
+			return;
+		}
+		workers.parallelFor(ranges, [&](size_t r)
+			{
+				PROFILE_SCOPE("Skin range");
+				skinVertices(path, mesh, palette.data(), palette.size(), count * r / ranges, count * (r + 1) / ranges, out);
+			});
+	}
+
+	unsigned int threadCount() const { return workers.threadCount() + 1; }
+
+private:
+	WorkerPool workers;
+};
+
+// Largest difference between a path's output and the reference over every vertex, for positions
+// and normals separately
+struct SkinningError
+{
+	float position = 0.0f;
+	float normal = 0.0f;
+};
+
+inline SkinningError validateCpuSkinning(CpuSkinner& skinner, const Mesh& mesh, const std::vector<glm::mat4>& palette)
+{
+	size_t count = mesh.vertices.size();
+	std::vector<SkinnedVertex> expected(count), actual(count);
+	skinVerticesReference(mesh, palette.data(), palette.size(), 0, count, expected.data());
+	skinner.skin(mesh, palette, actual.data());
+
+	SkinningError error;
+	for (size_t v = 0; v < count; v++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			error.position = std::max(error.position, std::abs(expected[v].position[c] - actual[v].position[c]));
+			error.normal = std::max(error.normal, std::abs(expected[v].normal[c] - actual[v].normal[c]));
+		}
+	}
+	return error;
+}
+
+// Throughput of the skinner in vertices per millisecond, best of the given number of runs
+inline double benchmarkCpuSkinning(CpuSkinner& skinner, const Mesh& mesh, const std::vector<glm::mat4>& palette, int runs = 20)
+{
+	std::vector<SkinnedVertex> out(mesh.vertices.size());
+	double best = 1e30;
+	for (int i = 0; i < runs; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		skinner.skin(mesh, palette, out.data());
+		best = std::min(best, millisecondsSince(start));
+	}
+	return mesh.vertices.size() / std::max(best, 1e-6);
+}
+
+#endif
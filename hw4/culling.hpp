@@ -0,0 +1,155 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "mesh.hpp"
+
+// Axis-aligned bounding boxes, view frustums and the animated bounds of skinned characters.
+//
+// A skinned vertex is sum(w_i * B_i * p) with weights summing to one, so it lies in the convex hull
+// of the B_i * p. Each B_i * p is inside bone i's bind-space box of influenced vertices transformed
+// by B_i, so the union of those transformed boxes bounds the whole posed mesh.
+
+struct BoundingBox
+{
+	glm::vec3 minimum = glm::vec3(1e30f);
+	glm::vec3 maximum = glm::vec3(-1e30f);
+
+	bool empty() const
+	{
+		return minimum.x > maximum.x;
+	}
+
+	void expand(const glm::vec3& point)
+	{
+		minimum = glm::min(minimum, point);
+		maximum = glm::max(maximum, point);
+	}
+
+	void expand(const BoundingBox& box)
+	{
+		minimum = glm::min(minimum, box.minimum);
+		maximum = glm::max(maximum, box.maximum);
+	}
+};
+
+// The box around a transformed box, built from the matrix columns instead of the eight corners
+inline BoundingBox transformBox(const glm::mat4& matrix, const BoundingBox& box)
+{
+	if (box.empty())
+		return box;
+	BoundingBox result;
+	result.minimum = result.maximum = glm::vec3(matrix[3]);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		glm::vec3 a = glm::vec3(matrix[axis]) * box.minimum[axis];
+		glm::vec3 b = glm::vec3(matrix[axis]) * box.maximum[axis];
+		result.minimum += glm::min(a, b);
+		result.maximum += glm::max(a, b);
+	}
+	return result;
+}
+
+inline BoundingBox meshBoundingBox(const Mesh& mesh)
+{
+	BoundingBox box;
+	for (const glm::vec3& v : mesh.vertices)
+		box.expand(v);
+	return box;
+}
+
+// For every bone, the bind-space box of the vertices it influences. Indexed by bone ID; bones that
+// influence nothing get an empty box.
+inline std::vector<BoundingBox> computeBoneBounds(const std::vector<Mesh>& meshes)
+{
+	std::vector<BoundingBox> bones;
+	for (const Mesh& mesh : meshes)
+	{
+		for (size_t v = 0; v < mesh.vertices.size() && v < mesh.boneIDs.size(); v++)
+		{
+			for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+			{
+				int bone = mesh.boneIDs[v][i];
+				if (bone < 0 || mesh.weights[v][i] <= 0.0f)
+					continue;
+				if (bone >= (int)bones.size())
+					bones.resize(bone + 1);
+				bones[bone].expand(mesh.vertices[v]);
+			}
+		}
+	}
+	return bones;
+}
+
+// Conservative bounds of the posed mesh, in the same space as the bind pose
+inline BoundingBox animatedBounds(const std::vector<BoundingBox>& boneBounds, const std::vector<glm::mat4>& palette)
+{
+	BoundingBox box;
+	for (size_t bone = 0; bone < boneBounds.size() && bone < palette.size(); bone++)
+		box.expand(transformBox(palette[bone], boneBounds[bone]));
+	return box;
+}
+
+struct Frustum
+{
+	// Inward-facing planes: left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+};
+
+// Planes of a projection * view matrix (Gribb and Hartmann)
+inline Frustum frustumFromMatrix(const glm::mat4& viewProjection)
+{
+	glm::mat4 m = glm::transpose(viewProjection);
+	Frustum frustum;
+	frustum.planes[0] = m[3] + m[0];
+	frustum.planes[1] = m[3] - m[0];
+	frustum.planes[2] = m[3] + m[1];
+	frustum.planes[3] = m[3] - m[1];
+	frustum.planes[4] = m[3] + m[2];
+	frustum.planes[5] = m[3] - m[2];
+	return frustum;
+}
+
+// False only when the box is entirely outside one of the planes. Boxes near a frustum corner can
+// pass without being visible, which is fine for culling.
+inline bool boxInFrustum(const Frustum& frustum, const BoundingBox& box)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// The corner furthest along the plane normal
+		glm::vec3 corner(plane.x >= 0.0f ? box.maximum.x : box.minimum.x,
+			plane.y >= 0.0f ? box.maximum.y : box.minimum.y,
+			plane.z >= 0.0f ? box.maximum.z : box.minimum.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+// True when the whole box is inside every plane
+inline bool boxInsideFrustum(const Frustum& frustum, const BoundingBox& box)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// The corner furthest against the plane normal
+		glm::vec3 corner(plane.x >= 0.0f ? box.minimum.x : box.maximum.x,
+			plane.y >= 0.0f ? box.minimum.y : box.maximum.y,
+			plane.z >= 0.0f ? box.minimum.z : box.maximum.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+struct CullingStats
+{
+	unsigned int tested = 0;
+	unsigned int culled = 0;
+	// Boxes tested to find the visible nodes, fewer than tested when a hierarchy culls them in groups
+	unsigned int boxTests = 0;
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef FRAMESCHEDULER_HPP
+#define FRAMESCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#else
+#include <time.h>
+#endif
+
+// Frame pacing for the main loop: a fixed-step simulation clock, a frame rate limiter that sleeps
+// most of the wait and spins the rest, and statistics on how evenly frames were delivered.
+
+// Splits variable frame times into whole simulation steps. The time left over is carried into the
+// next frame; alpha says how far into the next step it reaches, for interpolating what is drawn.
+class FixedStepClock
+{
+public:
+	FixedStepClock(double step, int maxSteps) : step(step), maxSteps(std::max(1, maxSteps))
+	{
+	}
+
+	// Steps to run for a frame that took frameSeconds. Beyond maxSteps the time is dropped, so a
+	// long stall slows the simulation down instead of making every following frame catch up.
+	int advance(double frameSeconds)
+	{
+		accumulator += std::max(0.0, frameSeconds);
+		// Frame times that are whole steps in theory should not land a hair short of one
+		int steps = (int)std::floor(accumulator / step + 1e-4);
+		accumulator = std::max(0.0, accumulator - steps * step);
+		if (steps > maxSteps)
+		{
+			droppedSeconds += (steps - maxSteps) * step;
+			steps = maxSteps;
+		}
+		totalSteps += steps;
+		return steps;
+	}
+
+	// Fraction of a step between the last simulated step and the present, in [0, 1)
+	float alpha() const
+	{
+		return (float)std::min(accumulator / step, 1.0);
+	}
+
+	double stepSeconds() const
+	{
+		return step;
+	}
+
+	unsigned long long steps() const
+	{
+		return totalSteps;
+	}
+
+	// Time not simulated because frames needed more than maxSteps
+	double dropped() const
+	{
+		return droppedSeconds;
+	}
+
+private:
+	double step;
+	int maxSteps;
+	double accumulator = 0.0;
+	double droppedSeconds = 0.0;
+	unsigned long long totalSteps = 0;
+};
+
+// Holds frames to a target rate. The OS wakes sleepers late by a varying amount, so the limiter
+// only sleeps while the deadline is further away than the worst wake-up it has seen recently, and
+// spins for the last stretch. Deadlines follow each other by exactly one period so the rate does
+// not drift, except after a frame overran, which starts a new schedule from the present.
+class FrameLimiter
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Total time spent waiting, and how much of it sleeping rather than spinning
+	double sleptSeconds = 0.0;
+	double spunSeconds = 0.0;
+
+	// targetFps of zero or less never waits
+	explicit FrameLimiter(double targetFps)
+	{
+		setTarget(targetFps);
+#ifdef _WIN32
+		// The default timer resolution of 15.6 ms would leave nearly all of the wait to spinning
+		timeBeginPeriod(1);
+#endif
+	}
+
+	~FrameLimiter()
+	{
+#ifdef _WIN32
+		timeEndPeriod(1);
+#endif
+	}
+
+	FrameLimiter(const FrameLimiter&) = delete;
+	FrameLimiter& operator=(const FrameLimiter&) = delete;
+
+	void setTarget(double targetFps)
+	{
+		period = targetFps > 0.0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / targetFps)) : Clock::duration::zero();
+		started = false;
+	}
+
+	// Return when the next frame is due
+	void wait()
+	{
+		if (period == Clock::duration::zero())
+			return;
+		Clock::time_point now = Clock::now();
+		if (!started || now - deadline > period)
+		{
+			// First frame, or one that overran by a whole period: no point catching up
+			started = true;
+			deadline = now + period;
+			return;
+		}
+
+		while (deadline - now > sleepEstimate())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			Clock::time_point woke = Clock::now();
+			double slept = std::chrono::duration<double>(woke - now).count();
+			recordSleep(slept);
+			sleptSeconds += slept;
+			now = woke;
+		}
+		Clock::time_point spinStart = now;
+		while (now < deadline)
+		{
+			std::this_thread::yield();
+			now = Clock::now();
+		}
+		spunSeconds += std::chrono::duration<double>(now - spinStart).count();
+		deadline += period;
+	}
+
+private:
+	Clock::duration period = Clock::duration::zero();
+	Clock::time_point deadline;
+	bool started = false;
+	// Running mean and variance of how long a 1 ms sleep really takes, in seconds
+	double sleepMean = 0.002;
+	double sleepVariance = 0.0;
+
+	void recordSleep(double seconds)
+	{
+		const double weight = 0.05;
+		double difference = seconds - sleepMean;
+		sleepMean += weight * difference;
+		sleepVariance = (1.0 - weight) * (sleepVariance + weight * difference * difference);
+	}
+
+	// Sleep only while more than a pessimistic sleep length remains
+	Clock::duration sleepEstimate() const
+	{
+		double seconds = sleepMean + 2.0 * std::sqrt(sleepVariance);
+		return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	}
+};
+
+// CPU time the calling thread has used, in seconds
+inline double threadCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	auto ticks = [](const FILETIME& t) { return ((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime; };
+	return (ticks(kernel) + ticks(user)) * 1e-7;
+#else
+	timespec t;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0)
+		return 0.0;
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+// Frame intervals and main thread CPU time over a run, as running sums
+class FramePacingStats
+{
+public:
+	// targetFps of zero or less measures distances from the mean frame time instead
+	void start(double targetFps)
+	{
+		target = targetFps > 0.0 ? 1.0 / targetFps : 0.0;
+		startTime = std::chrono::steady_clock::now();
+		startCpu = threadCpuSeconds();
+		frames = 0;
+		sum = sumSquares = distance = longest = 0.0;
+	}
+
+	void addFrame(double seconds)
+	{
+		// The first interval includes startup
+		if (++frames == 1)
+			return;
+		sum += seconds;
+		sumSquares += seconds * seconds;
+		if (target > 0.0)
+			distance += std::abs(seconds - target);
+		longest = std::max(longest, seconds);
+	}
+
+	// Mean frame time, jitter as the standard deviation of frame times and as the mean distance from
+	// the target, the longest frame, and the share of one core the main thread kept busy
+	void print(const FrameLimiter& limiter) const
+	{
+		if (frames < 2)
+			return;
+		double count = (double)(frames - 1);
+		double mean = sum / count;
+		double deviation = std::sqrt(std::max(0.0, sumSquares / count - mean * mean));
+		double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		double cpu = threadCpuSeconds() - startCpu;
+		double waited = limiter.sleptSeconds + limiter.spunSeconds;
+		std::cout << "Frame pacing over " << frames - 1 << " frames: mean " << mean * 1e3 << " ms, jitter " << deviation * 1e3 << " ms (standard deviation)";
+		if (target > 0.0)
+			std::cout << ", " << distance / count * 1e3 << " ms mean distance from " << target * 1e3 << " ms";
+		std::cout << ", longest " << longest * 1e3 << " ms" << std::endl;
+		std::cout << "Main thread CPU: " << (wall > 0.0 ? 100.0 * cpu / wall : 0.0) << "% of one core";
+		if (waited > 0.0)
+			std::cout << "; the limiter waited " << waited << " s, " << 100.0 * limiter.sleptSeconds / waited << "% of it asleep";
+		std::cout << std::endl;
+	}
+
+private:
+	double target = 0.0;
+	std::chrono::steady_clock::time_point startTime;
+	double startCpu = 0.0;
+	unsigned long long frames = 0;
+	double sum = 0.0;
+	double sumSquares = 0.0;
+	double distance = 0.0;
+	double longest = 0.0;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef FRAMESTATS_HPP
+#define FRAMESTATS_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+// Per-frame measurements kept in a fixed ring of recent frames. Channels are registered once at
+// startup; recording a frame then only writes into storage that already exists, and percentiles
+// are worked out when a report asks for them. A run can also be streamed to CSV or JSON, written a
+// ring's worth of frames at a time.
+
+struct ChannelSummary
+{
+	float mean = 0.0f;
+	float p50 = 0.0f;
+	float p95 = 0.0f;
+	float p99 = 0.0f;
+	float max = 0.0f;
+	unsigned int samples = 0;
+};
+
+class FrameStats
+{
+public:
+	// Frames in the ring, the one in progress included; summaries cover up to capacity - 1
+	static const unsigned int capacity = 1024;
+	static const unsigned int maxChannels = 16;
+
+	FrameStats() = default;
+	FrameStats(const FrameStats&) = delete;
+	FrameStats& operator=(const FrameStats&) = delete;
+
+	~FrameStats()
+	{
+		closeDump();
+	}
+
+	// Register a channel before the first frame; the name must outlive the stats. Returns the
+	// index to record it with.
+	unsigned int addChannel(const char* name)
+	{
+		assert(channelCount < maxChannels && frames == 0);
+		names[channelCount] = name;
+		return channelCount++;
+	}
+
+	// Record a value for the frame in progress; channels not set in a frame read as zero
+	void set(unsigned int channel, float value)
+	{
+		values[frames % capacity][channel] = value;
+	}
+
+	void add(unsigned int channel, float value)
+	{
+		values[frames % capacity][channel] += value;
+	}
+
+	// Close the frame in progress and start the next one
+	void endFrame()
+	{
+		frames++;
+		// The row about to be reused is the oldest one not written out yet
+		if (dumpFile && frames - dumped == capacity)
+			writeDumpRows();
+		std::fill(values[frames % capacity], values[frames % capacity] + maxChannels, 0.0f);
+	}
+
+	// Frames closed so far
+	unsigned long long frameCount() const
+	{
+		return frames;
+	}
+
+	// A channel over the last windowFrames closed frames, or as many as the ring holds
+	ChannelSummary summary(unsigned int channel, unsigned int windowFrames = capacity) const
+	{
+		ChannelSummary s;
+		unsigned int count = windowSize(windowFrames);
+		if (count == 0)
+			return s;
+		double sum = 0.0;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			scratch[i] = values[(frames - 1 - i) % capacity][channel];
+			sum += scratch[i];
+		}
+		std::sort(scratch, scratch + count);
+		s.mean = (float)(sum / count);
+		s.p50 = percentile(count, 0.50f);
+		s.p95 = percentile(count, 0.95f);
+		s.p99 = percentile(count, 0.99f);
+		s.max = scratch[count - 1];
+		s.samples = count;
+		return s;
+	}
+
+	// Every channel over the last windowFrames frames
+	void print(unsigned int windowFrames = capacity) const
+	{
+		char line[160];
+		snprintf(line, sizeof(line), "%-24s %10s %10s %10s %10s %10s", "channel", "mean", "p50", "p95", "p99", "max");
+		std::cout << "Frame statistics, last " << windowSize(windowFrames) << " frames:" << std::endl << line << std::endl;
+		for (unsigned int c = 0; c < channelCount; c++)
+		{
+			ChannelSummary s = summary(c, windowFrames);
+			snprintf(line, sizeof(line), "%-24s %10.3f %10.3f %10.3f %10.3f %10.3f", names[c], s.mean, s.p50, s.p95, s.p99, s.max);
+			std::cout << line << std::endl;
+		}
+	}
+
+	// Stream every frame from now on to path: JSON if it ends in .json, CSV otherwise
+	bool openDump(const std::string& path)
+	{
+		closeDump();
+		dumpFile = fopen(path.c_str(), "w");
+		if (dumpFile == nullptr)
+			return false;
+		json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+		dumped = frames;
+		firstDumpRow = true;
+		if (json)
+		{
+			fprintf(dumpFile, "{\n  \"channels\": [");
+			for (unsigned int c = 0; c < channelCount; c++)
+				fprintf(dumpFile, "%s\"%s\"", c > 0 ? ", " : "", names[c]);
+			fprintf(dumpFile, "],\n  \"frames\": [\n");
+		}
+		else
+		{
+			fprintf(dumpFile, "frame");
+			for (unsigned int c = 0; c < channelCount; c++)
+				fprintf(dumpFile, ",%s", names[c]);
+			fprintf(dumpFile, "\n");
+		}
+		return true;
+	}
+
+	// Write the frames still in the ring and finish the file
+	void closeDump()
+	{
+		if (dumpFile == nullptr)
+			return;
+		writeDumpRows();
+		if (json)
+			fprintf(dumpFile, "\n  ]\n}\n");
+		fclose(dumpFile);
+		dumpFile = nullptr;
+	}
+
+private:
+	float values[capacity][maxChannels] = {};
+	const char* names[maxChannels] = {};
+	unsigned int channelCount = 0;
+	unsigned long long frames = 0;
+	// Sorted copy of one channel while a summary is taken
+	mutable float scratch[capacity];
+
+	FILE* dumpFile = nullptr;
+	bool json = false;
+	bool firstDumpRow = true;
+	// Frames written to the dump so far
+	unsigned long long dumped = 0;
+
+	// Closed frames still in the ring, at most windowFrames
+	unsigned int windowSize(unsigned int windowFrames) const
+	{
+		return (unsigned int)std::min<unsigned long long>({ (unsigned long long)windowFrames, frames, (unsigned long long)capacity - 1 });
+	}
+
+	float percentile(unsigned int count, float p) const
+	{
+		unsigned int index = (unsigned int)(p * (count - 1) + 0.5f);
+		return scratch[std::min(index, count - 1)];
+	}
+
+	void writeDumpRows()
+	{
+		for (; dumped < frames; dumped++)
+		{
+			const float* row = values[dumped % capacity];
+			if (json)
+			{
+				fprintf(dumpFile, "%s    [", firstDumpRow ? "" : ",\n");
+				for (unsigned int c = 0; c < channelCount; c++)
+					fprintf(dumpFile, "%s%g", c > 0 ? ", " : "", row[c]);
+				fprintf(dumpFile, "]");
+			}
+			else
+			{
+				fprintf(dumpFile, "%llu", dumped);
+				for (unsigned int c = 0; c < channelCount; c++)
+					fprintf(dumpFile, ",%g", row[c]);
+				fprintf(dumpFile, "\n");
+			}
+			firstDumpRow = false;
+		}
+	}
+};
+
+#endif
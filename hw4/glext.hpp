@@ -0,0 +1,120 @@
+#ifndef GLEXT_HPP
+#define GLEXT_HPP
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// OpenGL 4.x entry points used by the renderer that the bundled glad loader (generated for
+// GL 3.3 core) does not provide. Each block is skipped when glad already declares that
+// version, so a full 4.6 loader can be dropped in without changes here.
+// Call loadGLExtensions right after gladLoadGLLoader.
+
+#ifndef GL_VERSION_4_1
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+inline PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = nullptr;
+inline PFNGLPROGRAMBINARYPROC glad_glProgramBinary = nullptr;
+inline PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = nullptr;
+#define glGetProgramBinary glad_glGetProgramBinary
+#define glProgramBinary glad_glProgramBinary
+#define glProgramParameteri glad_glProgramParameteri
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#ifndef GL_VERSION_4_2
+typedef void (APIENTRYP PFNGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+inline PFNGLTEXSTORAGE2DPROC glad_glTexStorage2D = nullptr;
+#define glTexStorage2D glad_glTexStorage2D
+#endif
+
+#ifndef GL_VERSION_4_2
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+#ifndef GL_VERSION_4_0
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_VERSION_4_3
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLGETPROGRAMINTERFACEIVPROC)(GLuint program, GLenum programInterface, GLenum pname, GLint* params);
+typedef void (APIENTRYP PFNGLGETPROGRAMRESOURCENAMEPROC)(GLuint program, GLenum programInterface, GLuint index, GLsizei bufSize, GLsizei* length, GLchar* name);
+typedef void (APIENTRYP PFNGLGETPROGRAMRESOURCEIVPROC)(GLuint program, GLenum programInterface, GLuint index, GLsizei propCount, const GLenum* props, GLsizei count, GLsizei* length, GLint* params);
+inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect = nullptr;
+inline PFNGLGETPROGRAMINTERFACEIVPROC glad_glGetProgramInterfaceiv = nullptr;
+inline PFNGLGETPROGRAMRESOURCENAMEPROC glad_glGetProgramResourceName = nullptr;
+inline PFNGLGETPROGRAMRESOURCEIVPROC glad_glGetProgramResourceiv = nullptr;
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+#define glGetProgramInterfaceiv glad_glGetProgramInterfaceiv
+#define glGetProgramResourceName glad_glGetProgramResourceName
+#define glGetProgramResourceiv glad_glGetProgramResourceiv
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BLOCK 0x92E6
+#define GL_ACTIVE_RESOURCES 0x92F5
+#define GL_BUFFER_BINDING 0x9302
+#define GL_BUFFER_DATA_SIZE 0x9303
+#endif
+
+// KHR_parallel_shader_compile, or its ARB twin, lets the driver compile and link on threads of
+// its own. The entry point is loaded either way; only call it when hasGLExtension reports one.
+#ifndef GL_KHR_parallel_shader_compile
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+inline PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = nullptr;
+#define glMaxShaderCompilerThreadsKHR glad_glMaxShaderCompilerThreadsKHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#define GLEXT_LOAD_PARALLEL_COMPILE
+#endif
+
+// S3TC is an extension in every GL version, but supported by all desktop drivers
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+inline void loadGLExtensions(GLADloadproc load)
+{
+#ifndef GL_VERSION_4_1
+	glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+	glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+	glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+#endif
+#ifndef GL_VERSION_4_2
+	glad_glTexStorage2D = (PFNGLTEXSTORAGE2DPROC)load("glTexStorage2D");
+#endif
+#ifndef GL_VERSION_4_3
+	glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+	glad_glGetProgramInterfaceiv = (PFNGLGETPROGRAMINTERFACEIVPROC)load("glGetProgramInterfaceiv");
+	glad_glGetProgramResourceName = (PFNGLGETPROGRAMRESOURCENAMEPROC)load("glGetProgramResourceName");
+	glad_glGetProgramResourceiv = (PFNGLGETPROGRAMRESOURCEIVPROC)load("glGetProgramResourceiv");
+#endif
+#ifdef GLEXT_LOAD_PARALLEL_COMPILE
+	glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+	if (glad_glMaxShaderCompilerThreadsKHR == nullptr)
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+#endif
+}
+
+// Whether the current context lists the extension
+inline bool hasGLExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef GPUTIMER_HPP
+#define GPUTIMER_HPP
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "profiler.hpp"
+
+// GPU time of passes and draw groups from GL_TIMESTAMP query pairs. Queries of a frame are read
+// back latency frames later, when the GPU has long finished them, so reading never waits. If a
+// frame is still not done when its slot comes round again, its results are dropped instead.
+//
+// Timestamps are moved onto the profiler's clock with an offset sampled every frame, and recorded
+// on a "GPU" track while profiling, so CPU and GPU slices line up in the same trace.
+
+// Summed time of a frame's outermost scopes; frames are numbered by beginFrame calls
+struct GpuFrameTime
+{
+	unsigned int frame;
+	double milliseconds;
+};
+
+struct GpuTiming
+{
+	const char* name;
+	double lastMilliseconds = 0.0;
+	double totalMilliseconds = 0.0;
+	unsigned int samples = 0;
+
+	double averageMilliseconds() const
+	{
+		return samples > 0 ? totalMilliseconds / samples : 0.0;
+	}
+};
+
+class GpuTimer
+{
+public:
+	// Frames between recording and reading back a frame's queries
+	static const unsigned int latency = 4;
+
+	// Frames whose results were not available in time
+	unsigned int dropped = 0;
+
+	// When set, every collected frame appends its total to frameTimes, oldest first
+	bool recordFrameTimes = false;
+	std::vector<GpuFrameTime> frameTimes;
+
+	GpuTimer() = default;
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	// Call once per frame before the first scope: collects the frame recorded latency frames ago
+	// and starts recording into its slot
+	void beginFrame()
+	{
+		current = (current + 1) % latency;
+		Frame& frame = frames[current];
+		if (frame.pending)
+			collect(frame);
+
+		frame.scopes.clear();
+		frame.usedQueries = 0;
+		frame.number = frameCount++;
+		depth = 0;
+
+		GLint64 gpuNow;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		frame.offset = profiler().now() - gpuNow;
+		frame.pending = true;
+	}
+
+	// Open a scope; name must outlive the timer. Returns the handle to pass to end.
+	unsigned int begin(const char* name)
+	{
+		Frame& frame = frames[current];
+		Scope scope;
+		scope.name = name;
+		scope.depth = depth++;
+		scope.beginQuery = nextQuery(frame);
+		scope.endQuery = ~0u;
+		glQueryCounter(frame.queries[scope.beginQuery], GL_TIMESTAMP);
+		frame.scopes.push_back(scope);
+		return (unsigned int)frame.scopes.size() - 1;
+	}
+
+	void end(unsigned int scope)
+	{
+		Frame& frame = frames[current];
+		Scope& s = frame.scopes[scope];
+		s.endQuery = nextQuery(frame);
+		glQueryCounter(frame.queries[s.endQuery], GL_TIMESTAMP);
+		depth--;
+	}
+
+	// Collect every frame still waiting, oldest first; waits for the GPU to finish them
+	void flush()
+	{
+		glFinish();
+		for (unsigned int i = 1; i <= latency; i++)
+		{
+			Frame& frame = frames[(current + i) % latency];
+			if (frame.pending)
+				collect(frame);
+		}
+	}
+
+	// The timing of a scope name, or null before its first frame was read back
+	const GpuTiming* find(const char* name) const
+	{
+		for (const GpuTiming& t : results)
+		{
+			if (t.name == name || strcmp(t.name, name) == 0)
+				return &t;
+		}
+		return nullptr;
+	}
+
+	// Accumulated times by scope name, in order of first appearance
+	const std::vector<GpuTiming>& timings() const
+	{
+		return results;
+	}
+
+private:
+	struct Scope
+	{
+		const char* name;
+		unsigned int depth;
+		unsigned int beginQuery;
+		unsigned int endQuery;
+	};
+
+	struct Frame
+	{
+		std::vector<Scope> scopes;
+		// Generated on first use; the timer is constructed before the GL context
+		std::vector<GLuint> queries;
+		unsigned int usedQueries = 0;
+		// Profiler time minus GPU time when the frame began, in nanoseconds
+		int64_t offset = 0;
+		unsigned int number = 0;
+		bool pending = false;
+	};
+
+	Frame frames[latency];
+	unsigned int current = 0;
+	unsigned int depth = 0;
+	unsigned int frameCount = 0;
+	std::vector<GpuTiming> results;
+	ProfileRing* track = nullptr;
+	// Timestamps of the frame being collected, kept to reuse its storage
+	std::vector<GLuint64> stamps;
+
+	unsigned int nextQuery(Frame& frame)
+	{
+		if (frame.usedQueries == frame.queries.size())
+		{
+			GLuint query;
+			glGenQueries(1, &query);
+			frame.queries.push_back(query);
+		}
+		return frame.usedQueries++;
+	}
+
+	GpuTiming& timing(const char* name)
+	{
+		for (GpuTiming& t : results)
+		{
+			if (t.name == name || strcmp(t.name, name) == 0)
+				return t;
+		}
+		results.push_back(GpuTiming());
+		results.back().name = name;
+		return results.back();
+	}
+
+	void collect(Frame& frame)
+	{
+		frame.pending = false;
+		if (frame.usedQueries == 0)
+			return;
+
+		// Timestamps complete in order, so the last query being ready means all of them are
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			dropped++;
+			return;
+		}
+
+		stamps.resize(frame.usedQueries);
+		for (unsigned int i = 0; i < frame.usedQueries; i++)
+			glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &stamps[i]);
+
+		bool record = profiling();
+		if (record && track == nullptr)
+			track = &profiler().track("GPU");
+
+		double frameMilliseconds = 0.0;
+		for (const Scope& scope : frame.scopes)
+		{
+			// Left open; nothing to measure
+			if (scope.endQuery == ~0u)
+				continue;
+			GLuint64 start = stamps[scope.beginQuery];
+			GLuint64 end = stamps[scope.endQuery];
+			GpuTiming& t = timing(scope.name);
+			t.lastMilliseconds = (end - start) / 1e6;
+			t.totalMilliseconds += t.lastMilliseconds;
+			t.samples++;
+			if (scope.depth == 0)
+				frameMilliseconds += t.lastMilliseconds;
+
+			if (record)
+			{
+				ProfileEvent event;
+				event.name = scope.name;
+				event.start = (int64_t)start + frame.offset;
+				event.end = (int64_t)end + frame.offset;
+				event.depth = scope.depth;
+				track->push(event);
+			}
+		}
+		if (recordFrameTimes)
+			frameTimes.push_back({ frame.number, frameMilliseconds });
+	}
+};
+
+// Times its lifetime, or until end(), on the GPU; does nothing without a timer
+class GpuScope
+{
+public:
+	GpuScope(GpuTimer* timer, const char* name) : timer(timer)
+	{
+		if (timer)
+			scope = timer->begin(name);
+	}
+
+	~GpuScope()
+	{
+		end();
+	}
+
+	void end()
+	{
+		if (timer)
+			timer->end(scope);
+		timer = nullptr;
+	}
+
+	GpuScope(const GpuScope&) = delete;
+	GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+	GpuTimer* timer;
+	unsigned int scope = 0;
+};
+
+#endif
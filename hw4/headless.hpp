@@ -0,0 +1,296 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#if __has_include(<EGL/egl.h>)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define HEADLESS_EGL
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Rendering without a window, for benchmark runs on machines without a display or GPU. The context
+// comes from EGL where its headers are available: the Mesa surfaceless platform if the driver has
+// it (llvmpipe does), else the default display with a pbuffer surface. Without EGL a hidden GLFW
+// window provides it. Either way the frame is drawn into an OffscreenTarget instead of a window.
+
+struct OffscreenContext
+{
+	// Pass to gladLoadGLLoader and loadGLExtensions
+	GLADloadproc loader = nullptr;
+	// Which of the paths above made the context
+	const char* kind = "";
+	GLFWwindow* hiddenWindow = nullptr;
+#ifdef HEADLESS_EGL
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+#endif
+};
+
+#ifdef HEADLESS_EGL
+inline bool hasExtension(const char* extensions, const char* name)
+{
+	if (extensions == nullptr)
+		return false;
+	size_t length = strlen(name);
+	for (const char* p = strstr(extensions, name); p != nullptr; p = strstr(p + length, name))
+	{
+		if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+			return true;
+	}
+	return false;
+}
+
+inline bool createEglContext(OffscreenContext& offscreen, int width, int height)
+{
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	bool surfacelessPlatform = false;
+	if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+	{
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+		{
+			offscreen.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			surfacelessPlatform = offscreen.display != EGL_NO_DISPLAY;
+		}
+	}
+	if (offscreen.display == EGL_NO_DISPLAY)
+		offscreen.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (offscreen.display == EGL_NO_DISPLAY || !eglInitialize(offscreen.display, &major, &minor))
+		return false;
+	if (!eglBindAPI(EGL_OPENGL_API))
+		return false;
+
+	bool surfaceless = hasExtension(eglQueryString(offscreen.display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE,
+	};
+	EGLConfig config;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(offscreen.display, configAttributes, &config, 1, &configCount) || configCount == 0)
+		return false;
+
+	// 4.6 as in windowed mode; Mesa drivers without 4.6 still run everything the renderer uses on 4.5
+	const EGLint versions[][2] = { { 4, 6 }, { 4, 5 } };
+	for (const EGLint* version : versions)
+	{
+		const EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, version[0],
+			EGL_CONTEXT_MINOR_VERSION, version[1],
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE,
+		};
+		offscreen.context = eglCreateContext(offscreen.display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (offscreen.context != EGL_NO_CONTEXT)
+			break;
+	}
+	if (offscreen.context == EGL_NO_CONTEXT)
+		return false;
+
+	if (!surfaceless)
+	{
+		const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+		offscreen.surface = eglCreatePbufferSurface(offscreen.display, config, surfaceAttributes);
+		if (offscreen.surface == EGL_NO_SURFACE)
+			return false;
+	}
+	if (!eglMakeCurrent(offscreen.display, offscreen.surface, offscreen.surface, offscreen.context))
+		return false;
+
+	offscreen.loader = (GLADloadproc)eglGetProcAddress;
+	offscreen.kind = surfacelessPlatform ? "EGL, surfaceless platform" : surfaceless ? "EGL, surfaceless context" : "EGL, pbuffer";
+	return true;
+}
+#endif
+
+// Makes a current GL context without a visible window. Returns false if no path works.
+inline bool createOffscreenContext(OffscreenContext& offscreen, int width, int height)
+{
+#ifdef HEADLESS_EGL
+	if (createEglContext(offscreen, width, height))
+		return true;
+	std::cout << "EGL offscreen context unavailable, trying a hidden window" << std::endl;
+#endif
+	if (!glfwInit())
+		return false;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	offscreen.hiddenWindow = glfwCreateWindow(width, height, "Project", NULL, NULL);
+	if (offscreen.hiddenWindow == NULL)
+		return false;
+	glfwMakeContextCurrent(offscreen.hiddenWindow);
+	offscreen.loader = (GLADloadproc)glfwGetProcAddress;
+	offscreen.kind = "hidden window";
+	return true;
+}
+
+inline void destroyOffscreenContext(OffscreenContext& offscreen)
+{
+#ifdef HEADLESS_EGL
+	if (offscreen.display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent(offscreen.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (offscreen.surface != EGL_NO_SURFACE)
+			eglDestroySurface(offscreen.display, offscreen.surface);
+		if (offscreen.context != EGL_NO_CONTEXT)
+			eglDestroyContext(offscreen.display, offscreen.context);
+		eglTerminate(offscreen.display);
+		offscreen.display = EGL_NO_DISPLAY;
+	}
+#endif
+	if (offscreen.hiddenWindow)
+	{
+		glfwDestroyWindow(offscreen.hiddenWindow);
+		offscreen.hiddenWindow = nullptr;
+	}
+}
+
+// Stands in for the window's framebuffer: multisampled colour and depth like the window asks for,
+// plus a single-sample copy that frames are resolved into when they are read back
+struct OffscreenTarget
+{
+	int width = 0;
+	int height = 0;
+	unsigned int framebuffer = 0;
+	unsigned int colorBuffer = 0;
+	unsigned int depthBuffer = 0;
+	unsigned int resolveFramebuffer = 0;
+	unsigned int resolveBuffer = 0;
+};
+
+inline bool createOffscreenTarget(OffscreenTarget& target, int width, int height, int samples)
+{
+	target.width = width;
+	target.height = height;
+
+	glGenRenderbuffers(1, &target.colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.colorBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &target.depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depthBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+	glGenFramebuffers(1, &target.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthBuffer);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	glGenRenderbuffers(1, &target.resolveBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.resolveBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenFramebuffers(1, &target.resolveFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.resolveFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.resolveBuffer);
+	complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	return complete;
+}
+
+// Resolve the target and write it as a binary PPM. Waits for the frame to finish.
+inline bool writeFramePPM(const OffscreenTarget& target, const std::string& path)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target.resolveFramebuffer);
+	glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.resolveFramebuffer);
+	std::vector<unsigned char> pixels((size_t)target.width * target.height * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, target.width, target.height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	fprintf(file, "P6\n%d %d\n255\n", target.width, target.height);
+	// GL rows run bottom to top, PPM rows top to bottom
+	size_t rowSize = (size_t)target.width * 3;
+	for (int y = target.height - 1; y >= 0; y--)
+		fwrite(pixels.data() + y * rowSize, 1, rowSize, file);
+	return fclose(file) == 0;
+}
+
+inline void deleteOffscreenTarget(OffscreenTarget& target)
+{
+	glDeleteFramebuffers(1, &target.framebuffer);
+	glDeleteFramebuffers(1, &target.resolveFramebuffer);
+	glDeleteRenderbuffers(1, &target.colorBuffer);
+	glDeleteRenderbuffers(1, &target.depthBuffer);
+	glDeleteRenderbuffers(1, &target.resolveBuffer);
+	target = OffscreenTarget();
+}
+
+// Scripted camera for benchmark runs: one orbit every period seconds around center, moving in and
+// out and up and down so LOD selection and culling see a range of distances
+inline glm::vec3 cameraPathPosition(glm::vec3 center, float seconds)
+{
+	const float period = 12.0f;
+	float angle = glm::two_pi<float>() * seconds / period;
+	float radius = 5.0f + 3.0f * sin(angle * 0.5f);
+	float height = 1.5f + 1.0f * sin(angle * 1.5f);
+	return center + glm::vec3(radius * sin(angle), height, radius * cos(angle));
+}
+
+struct HeadlessFrameTime
+{
+	// Frame start until its commands are submitted
+	double cpuMilliseconds = 0.0;
+	// Shadow and main pass timestamps; negative if the frame was dropped
+	double gpuMilliseconds = -1.0;
+	// Frame start until the next frame starts
+	double frameMilliseconds = 0.0;
+};
+
+inline bool writeFrameTimes(const std::vector<HeadlessFrameTime>& frames, const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	fprintf(file, "frame,cpu_ms,gpu_ms,frame_ms\n");
+	for (size_t i = 0; i < frames.size(); i++)
+		fprintf(file, "%zu,%.4f,%.4f,%.4f\n", i, frames[i].cpuMilliseconds, frames[i].gpuMilliseconds, frames[i].frameMilliseconds);
+	return fclose(file) == 0;
+}
+
+// Mean, median, 95th percentile and worst of one column, skipping negative entries
+inline void printFrameTimeSummary(const char* name, const std::vector<HeadlessFrameTime>& frames, double HeadlessFrameTime::*column)
+{
+	std::vector<double> values;
+	for (const HeadlessFrameTime& frame : frames)
+	{
+		if (frame.*column >= 0.0)
+			values.push_back(frame.*column);
+	}
+	if (values.empty())
+	{
+		std::cout << "  " << name << ": no samples" << std::endl;
+		return;
+	}
+	std::sort(values.begin(), values.end());
+	double sum = 0.0;
+	for (double v : values)
+		sum += v;
+	std::cout << "  " << name << ": mean " << sum / values.size() << " ms, median " << values[values.size() / 2]
+		<< " ms, p95 " << values[std::min(values.size() - 1, values.size() * 95 / 100)] << " ms, max " << values.back()
+		<< " ms (" << values.size() << " frames)" << std::endl;
+}
+
+#endif
@@ -7,8 +7,17 @@
 #include <glm/gtx/transform.hpp>
 #include "Camera.h"
 #include "shader.hpp"
+#include "shadermanager.hpp"
 #include "vaoutils.hpp"
 #include "scene.hpp"
+#include "preskin.hpp"
+#include "renderqueue.hpp"
+#include "profiler.hpp"
+#include "gputimer.hpp"
+#include "headless.hpp"
+#include "framescheduler.hpp"
+#include "framestats.hpp"
+#include "simthread.hpp"
 #include "mesh.hpp"
 #include "model.hpp"
 #include "helper.hpp"
@@ -20,14 +29,55 @@
 
 
 namespace fs = std::filesystem;
+
+// Keys the simulation reads, by their bit in SimulationInput::keys
+enum InputKey {
+	INPUT_W, INPUT_D, INPUT_A, INPUT_S, INPUT_SPACE,
+	INPUT_Z, INPUT_X, INPUT_C, INPUT_V, INPUT_B, INPUT_N, INPUT_M,
+	INPUT_KEY_COUNT,
+};
+const int INPUT_GLFW_KEYS[INPUT_KEY_COUNT] = {
+	GLFW_KEY_W, GLFW_KEY_D, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_SPACE,
+	GLFW_KEY_Z, GLFW_KEY_X, GLFW_KEY_C, GLFW_KEY_V, GLFW_KEY_B, GLFW_KEY_N, GLFW_KEY_M,
+};
+
+// What the simulation needs from the keyboard and mouse, gathered on the main thread, which alone
+// may call GLFW. Events are running totals, so a step that skips over several inputs misses none.
+struct SimulationInput {
+	unsigned int keys = 0; // Held keys, bit InputKey
+	bool stateA = true;
+	float blendFactor = 0.0f;
+	unsigned int blendToggles = 0; // F presses so far, each restarting animationA
+	glm::vec3 cameraShift = glm::vec3(0.0f); // Camera movement by the mouse so far
+
+	bool held(InputKey key) const {
+		return (keys & (1u << key)) != 0;
+	}
+};
+
 // ^ըƪŧi
 void framebuffer_size_callback(GLFWwindow* window, int width, int height); // Bzjpվ
-void processInput(GLFWwindow* window, Animation* animations); // BzLPƹJ
+void sampleInput(GLFWwindow* window); // BzLPƹJ
+void applyInput(const SimulationInput& input, SimulationInput& applied, Animation* animations);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos); // Bzƹ
-void renderNode(Node* node); // V`I
-void updateNodeTransformations(Node* node, glm::mat4 transformationThusFar); // s`Iܴx}
-void setUniformBoneTransforms(std::vector<glm::mat4> transforms, unsigned int shaderId); // ]wfܴۦ⾹
+void collectDrawItems(Node* node, RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition, const Frustum& frustum);
+void collectVisibleDraws(RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition, const Frustum& frustum);
+void indexNodes(Node* node);
+void pickNode(const glm::mat4& viewProjection, double x, double y);
+void queueNodeDraws(Node* node, RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition);
+void updateAnimatedBounds(Node* node, const std::vector<glm::mat4>& transforms);
+void updateNodeTransforms(PoseSnapshot& pose); // s`Iܴx}
+unsigned int applyNodeTransforms(const PoseSnapshot& pose, float alpha, unsigned long long sinceStep);
+void initPose(PoseSnapshot& pose);
+void simulateStep(PoseSnapshot& pose, const SimulationInput& input, SimulationInput& applied, Animation* animations, float step);
+void runSimulation(PoseSnapshot& pose, Animation* animations);
+void setUniformBoneTransforms(const std::vector<glm::mat4>& transforms, Shader& shader); // ]wfܴۦ⾹
+unsigned int uploadMesh(Mesh& mesh, unsigned int& indexType);
+std::vector<LodRange> lodRanges(const Mesh& mesh, unsigned int firstIndex);
+void selectLods(Node* node, glm::vec3 viewPosition, float pixelsPerUnit);
+void preskinNodes(Node* node, Shader& skinProgram, const std::vector<glm::mat4>& transforms, CpuSkinner* cpuSkinner);
 static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+bool parseArguments(int argc, char** argv);
 //oڥؿ
 string getRootPath();
 // ܼƪwq
@@ -36,6 +86,39 @@ bool FULLSCREEN = false; // 
 int WINDOW_WIDTH = 1920; // e
 int WINDOW_HEIGHT = 1080; // 
 int FPS = 999999; // ̤jVv
+bool PACKED_VERTICES = true; // Upload meshes in the interleaved, quantized layout from vertexformat.hpp
+bool PACKED_WEIGHTS_16BIT = false; // unorm16 instead of unorm8 skin weights for the packed layout
+bool INFLUENCE_BUCKETS = true; // Draw each influence-count bucket with a shader specialized for that count; in-shader skinning only, so off while PRESKINNING draws characters whole
+bool COMPRESS_TEXTURES = true; // Cook textures to BC7 / BC5 / BC4 block formats (see compressionFor in model.hpp)
+bool MESH_LODS = true; // Generate simplified meshes at import and draw the coarsest one that fits LOD_PIXEL_ERROR
+float LOD_PIXEL_ERROR = 1.0f; // Largest simplification error allowed on screen, in pixels
+bool PRESKINNING = true; // Skin characters once per frame (skin.vert + transform feedback) and draw every pass from the result
+bool MULTI_DRAW_INDIRECT = true; // Put the character's meshes in shared buffers and submit each pass with glMultiDrawElementsIndirect
+bool CPU_SKINNING = false; // Fill the pre-skinning buffers with the threaded SIMD skinner in cpuskin.hpp instead of skin.vert
+bool FRUSTUM_CULLING = true; // Skip nodes outside the camera frustum (main pass) or the light frustum (shadow pass)
+bool BVH_CULLING = true; // Find the nodes in a frustum through the BVH of the scene index instead of testing each node's box
+int SHADOW_ONLY_ANIMATION_INTERVAL = 2; // Frames between pose updates of a character seen only in the shadow pass
+int CULLED_ANIMATION_INTERVAL = 8; // Frames between pose updates of a character culled from both passes
+bool PROFILING = false; // Record PROFILE_SCOPE markers from startup; P toggles recording and writes PROFILE_TRACE_FILE when it stops
+const char* PROFILE_TRACE_FILE = "profile.json"; // Chrome trace / Perfetto JSON written by the profiler
+bool GPU_TIMING = true; // Time the shadow and main passes with GL timestamp queries, read back a few frames later
+bool GPU_TIMING_DRAW_GROUPS = false; // Also time each program's run of draws within a pass
+bool SHADER_CACHE = true; // Keep linked program binaries in SHADER_CACHE_DIR and load them instead of compiling on later runs
+const char* SHADER_CACHE_DIR = "shadercache/"; // Program binary cache, relative to the project root
+bool PARALLEL_SHADER_COMPILE = true; // Submit every program before loading assets and wait for them after, on driver compile threads where supported
+bool FIXED_TIMESTEP = true; // Advance input, movement and animation in SIMULATION_STEP increments and draw the state interpolated between the last two
+float SIMULATION_STEP = 1.0f / 60.0f; // Length of one simulation step, in seconds
+int MAX_SIMULATION_STEPS = 5; // Steps per frame at most; time beyond that is dropped instead of caught up
+bool SIMULATION_THREAD = true; // Step input, movement and animation on a thread of their own and hand each step to the renderer through a triple buffer; headless runs stay on one thread
+float FRAME_STATS_INTERVAL = 1.0f; // Seconds between rolling frame time summaries on the console, 0 for none; I prints every channel
+const char* FRAME_STATS_DUMP = ""; // Stream every frame's statistics to this CSV file (JSON if it ends in .json), empty for none
+bool HEADLESS = false; // Render offscreen (EGL, else a hidden window) along a scripted camera path for HEADLESS_FRAMES frames, then exit; also --headless
+int HEADLESS_FRAMES = 600; // Frames of a headless run; also --frames N
+float HEADLESS_FRAME_TIME = 1.0f / 60.0f; // Fixed animation and camera step of a headless frame, in seconds
+int HEADLESS_CLIP_FRAMES = 240; // Headless frames between switches to the next animation clip
+int HEADLESS_DUMP_INTERVAL = 0; // Write every Nth headless frame to HEADLESS_DUMP_PREFIX####.ppm, 0 for none; also --dump-every N
+const char* HEADLESS_DUMP_PREFIX = "frame_"; // Path prefix of dumped headless frames
+const char* HEADLESS_FRAME_TIMES_FILE = "headless_frames.csv"; // Per-frame CPU, GPU and wall times of a headless run
 
 // vѼ
 glm::vec3 cameraPos = glm::vec3(2.0f, 2.0f, 5.0f); // vlm
@@ -52,6 +135,9 @@ float yaw = -90.0f; // 
 float pitch = 0.0f; // v Pitch 
 float lastX = 800.0f / 2.0; // ƹ̫ X y
 float lastY = 600.0 / 2.0; // ƹ̫ Y y
+bool rightButtonDown = false; // Right button state at the last sampleInput, to pick once per click
+bool pickRequested = false; // A right click is waiting to be picked at pickX, pickY
+double pickX = 0.0, pickY = 0.0; // Cursor position of the right click, in window coordinates
 float fov = 45.0f; // vd (Field of View)// 
 
 
@@ -72,53 +158,110 @@ float blendFactor = 0.0f;
 Animation* animationA;
 Animation* animationB;
 
-int main()
+PreskinStats preskinStats;
+CullingStats cullingStats[2]; // Indexed by RenderPass
+std::vector<NodeHandle> visibleNodes[2]; // Nodes collectVisibleDraws found last frame, by RenderPass; only their visiblePasses bit needs clearing
+RenderQueue renderQueue;
+GpuTimer gpuTimer;
+FrameStats frameStats;
+SimulationInput sampledInput; // Written on the main thread only
+SimulationInput appliedInput; // Totals of input the serial simulation has acted on
+TripleBuffer<SimulationInput> inputBuffer; // Main thread to simulation thread
+TripleBuffer<PoseSnapshot> poseBuffer; // Simulation thread to main thread
+std::atomic<int> animationInterval{ 1 }; // Set by the renderer from the character's visibility, see Animator::setUpdateInterval
+std::atomic<bool> stopSimulation{ false };
+// Channels of frameStats, registered in this order
+enum FrameStatChannel {
+	STAT_FRAME_MS,
+	STAT_CPU_MS, // Frame start until both passes are submitted
+	STAT_SHADOW_GPU_MS, // GPU pass times arrive GpuTimer::latency frames late
+	STAT_MAIN_GPU_MS,
+	STAT_SIMULATION_STEPS,
+	STAT_NODES_MOVED, // Nodes whose drawn transform was set, out of the live ones
+	STAT_DRAWS,
+	STAT_PROGRAM_CHANGES,
+	STAT_TEXTURE_BINDS,
+	STAT_UNIFORMS_SKIPPED, // Sets of a uniform to the value it already had, over all programs
+	STAT_MAIN_CULLED,
+	STAT_SHADOW_CULLED,
+	STAT_CHANNEL_COUNT,
+};
+const char* const FRAME_STAT_NAMES[STAT_CHANNEL_COUNT] = {
+	"frame_ms", "cpu_ms", "shadow_gpu_ms", "main_gpu_ms", "simulation_steps", "nodes_moved",
+	"draws", "program_changes", "texture_binds", "uniforms_skipped", "main_culled", "shadow_culled",
+};
+// GPU scope names of the draw groups, by pass and program slot
+const char* const DRAW_GROUP_NAMES[2][MAX_BONE_INFLUENCE + 1] = {
+	{ "Shadow draws, program 0", "Shadow draws, program 1", "Shadow draws, program 2", "Shadow draws, program 3", "Shadow draws, program 4" },
+	{ "Main draws, program 0", "Main draws, program 1", "Main draws, program 2", "Main draws, program 3", "Main draws, program 4" },
+};
+
+int main(int argc, char** argv)
 {
+	if (!parseArguments(argc, argv))
+		return -1;
+	setProfiling(PROFILING);
+	setProfilerThreadName("Main");
 
 	std::string projectRoot = getRootPath();
 	std::cout << "Root Directory: " << projectRoot << endl;
-	// l GLFW
-	glfwInit();
-	// wq OpenGL 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // D 4
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6); //  6
-	// wqϥ Core Profile
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// ҥΦhļ˧ܿ (AA)
-	glfwWindowHint(GLFW_SAMPLES, 4);
-
-	// ϥ GLFW Ыص
-	GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Project", FULLSCREEN ? glfwGetPrimaryMonitor() : NULL, NULL);
-	if (window == NULL)
-	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
-		return -1;
+	GLFWwindow* window = NULL;
+	OffscreenContext offscreen;
+	GLADloadproc loadProc = (GLADloadproc)glfwGetProcAddress;
+	if (HEADLESS) {
+		if (!createOffscreenContext(offscreen, WINDOW_WIDTH, WINDOW_HEIGHT))
+		{
+			std::cout << "Failed to create an offscreen OpenGL context" << std::endl;
+			return -1;
+		}
+		std::cout << "Headless rendering through " << offscreen.kind << std::endl;
+		loadProc = offscreen.loader;
 	}
+	else {
+		// l GLFW
+		glfwInit();
+		// wq OpenGL 
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // D 4
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6); //  6
+		// wqϥ Core Profile
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+		// ҥΦhļ˧ܿ (AA)
+		glfwWindowHint(GLFW_SAMPLES, 4);
+
+		// ϥ GLFW Ыص
+		window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Project", FULLSCREEN ? glfwGetPrimaryMonitor() : NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
 
-	//]w L^ը
-	glfwSetKeyCallback(window, KeyCallback);
+		//]w L^ը
+		glfwSetKeyCallback(window, KeyCallback);
 
 
-	// ]m OpenGL WU
-	glfwMakeContextCurrent(window);
+		// ]m OpenGL WU
+		glfwMakeContextCurrent(window);
 
-	// ]wƹ^ը
-	glfwSetCursorPosCallback(window, mouse_callback);
+		// ]wƹ^ը
+		glfwSetCursorPosCallback(window, mouse_callback);
 
-	// ]m OpenGL jpPPB
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+		// ]m OpenGL jpPPB
+		glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-	// Tηƹ
-	//glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		// Tηƹ
+		//glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	}
 
 	//  GLAD O_\[ OpenGLAȦb\~ϥ OpenGL 
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	if (!gladLoadGLLoader(loadProc))
 	{
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	loadGLExtensions(loadProc);
 
 	// LtάH
 	printInfo();
@@ -138,9 +281,50 @@ int main()
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	// pGTΫPB
-	if (!VSYNC)
+	if (!VSYNC && !HEADLESS)
 		glfwSwapInterval(0);
 
+	// The CPU skinner writes the pre-skinning buffers
+	if (CPU_SKINNING)
+		PRESKINNING = true;
+
+	// Programs build while the assets load, from the binary cache where it has them
+	shaderManager().begin(SHADER_CACHE ? projectRoot + SHADER_CACHE_DIR : "", PARALLEL_SHADER_COMPILE);
+
+	// [ۦ⾹
+	std::string shaderDefines = PACKED_VERTICES ? "#define PACKED_VERTEX" : "";
+	if (COMPRESS_TEXTURES)
+		shaderDefines += "\n#define NORMAL_MAP_RG";
+	if (MULTI_DRAW_INDIRECT)
+		shaderDefines += "\n#define MULTI_DRAW";
+
+	// Pre-skinned characters are drawn whole by the PRESKINNED programs; influence buckets only matter for in-shader skinning
+	std::unique_ptr<Shader> preskinShader;
+	if (PRESKINNING) {
+		preskinShader.reset(new Shader(shaderManager().program((projectRoot + "src/shaders/skin.vert").c_str(), SKIN_VARYINGS,
+			PACKED_VERTICES ? "#define PACKED_VERTEX" : "")));
+		shaderDefines += "\n#define PRESKINNED";
+	}
+
+	Shader shader = shaderManager().program((projectRoot + "src/shaders/default.vert").c_str(),
+		(projectRoot + "src/shaders/default.frag").c_str(), shaderDefines);
+
+	Shader depthShader = shaderManager().program((projectRoot + "src/shaders/depth.vert").c_str(),
+		(projectRoot + "src/shaders/depth.frag").c_str(), shaderDefines);
+
+	// One program per influence count; skinShaders[k - 1] handles bucket k
+	std::vector<Shader> skinShaders;
+	std::vector<Shader> depthSkinShaders;
+	if (INFLUENCE_BUCKETS && !PRESKINNING) {
+		for (int k = 1; k <= MAX_BONE_INFLUENCE; k++) {
+			std::string bucketDefines = shaderDefines + "\n#define INFLUENCE_COUNT " + std::to_string(k);
+			skinShaders.push_back(shaderManager().program((projectRoot + "src/shaders/default.vert").c_str(),
+				(projectRoot + "src/shaders/default.frag").c_str(), bucketDefines));
+			depthSkinShaders.push_back(shaderManager().program((projectRoot + "src/shaders/depth.vert").c_str(),
+				(projectRoot + "src/shaders/depth.frag").c_str(), bucketDefines));
+		}
+	}
+
 	// [ҫPʵe귽
 
 	std::string daeFile = projectRoot + "resource/vanguard/vanguard.dae";
@@ -166,9 +350,11 @@ int main()
 		{0, SPECULAR, "textures/vanguard_specular.png"},
 	};
 	// [ҫ
-	Model m = Model(daeFile, overrides);
+	ProfileScope loadScope("Load assets");
+	Model m = Model(daeFile, overrides, false, true, COMPRESS_TEXTURES, MESH_LODS);
 	vector<Mesh> squareMeshes = m.meshes;
 	std::cout << "Loaded meshes: " << m.meshes.size() << std::endl;
+	textureManager().printStats();
 
 	// Ыس`I
 	Node* root = createSceneNode();
@@ -190,47 +376,93 @@ int main()
 	};
 	floorMesh.indices = { 0, 1, 2, 2, 3, 0 };
 
-	unsigned int floorVAO = generateBuffer(floorMesh);
+	unsigned int floorIndexType;
+	unsigned int floorVAO = uploadMesh(floorMesh, floorIndexType);
 
 	//// ]maO`I
 	checkerFloor->type = GEOMETRY;
 	checkerFloor->vertexArrayObjectIDs = { (int)floorVAO };
 	checkerFloor->VAOIndexCounts = { (unsigned int)floorMesh.indices.size() };
+	checkerFloor->VAOIndexTypes = { floorIndexType };
+	checkerFloor->VAOBaseVertices = { 0 };
+	checkerFloor->bounds = meshBoundingBox(floorMesh);
 	addChild(root, checkerFloor);
 
 	// tm`I
 	character->type = CHARACTER;
-	character->scale = glm::vec3(0.01, 0.01, 0.01);
+	sceneTransforms().setScale(character->slot, glm::vec3(0.01, 0.01, 0.01));
+
+	CpuSkinner cpuSkinner(bestSkinningPath(), CPU_SKINNING ? std::max(1u, std::thread::hardware_concurrency()) - 1 : 0);
+	GLenum skinBufferUsage = CPU_SKINNING ? GL_DYNAMIC_DRAW : GL_DYNAMIC_COPY;
+
+	// For multi-draw all meshes of the character share one VAO, element buffer and skin buffer
+	std::vector<BatchRange> batchRanges(m.meshes.size(), BatchRange{ 0, 0 });
+	unsigned int batchVAO = 0, batchIndexType = 0, batchSkinBuffer = 0, batchSkinnedVAO = 0;
+	if (MULTI_DRAW_INDIRECT) {
+		std::vector<Mesh*> batch;
+		for (Mesh& mesh : squareMeshes)
+			batch.push_back(&mesh);
+		Mesh combined = combineMeshes(batch, batchRanges);
+		batchVAO = uploadMesh(combined, batchIndexType);
+		if (PRESKINNING) {
+			batchSkinBuffer = generateSkinBuffer(combined.vertices.size(), skinBufferUsage);
+			batchSkinnedVAO = generateSkinnedVAO(batchVAO, batchSkinBuffer);
+		}
+	}
 
 	for (int i = 0; i < m.meshes.size(); i++)
 	{
-		unsigned int charVAO = generateBuffer(squareMeshes[i]);
+		unsigned int charIndexType = batchIndexType;
+		unsigned int charVAO = MULTI_DRAW_INDIRECT ? batchVAO : uploadMesh(squareMeshes[i], charIndexType);
 		character->vertexArrayObjectIDs.push_back(charVAO);
 		character->VAOIndexCounts.push_back(squareMeshes[i].indices.size());
+		character->VAOIndexTypes.push_back(charIndexType);
+		character->VAOLods.push_back(lodRanges(squareMeshes[i], batchRanges[i].firstIndex));
+		character->VAOCurrentLods.push_back(0);
+		character->VAOBaseVertices.push_back(batchRanges[i].baseVertex);
+		character->VAOVertexCounts.push_back(squareMeshes[i].vertices.size());
+		if (PRESKINNING) {
+			unsigned int skinBuffer = MULTI_DRAW_INDIRECT ? batchSkinBuffer : generateSkinBuffer(squareMeshes[i].vertices.size(), skinBufferUsage);
+			character->skinBufferIDs.push_back(skinBuffer);
+			character->skinnedVAOIDs.push_back(MULTI_DRAW_INDIRECT ? batchSkinnedVAO : generateSkinnedVAO(charVAO, skinBuffer));
+			character->skinSourceMeshes.push_back(&squareMeshes[i]);
+		}
 
 		character->textureIDs.push_back(m.diffuseMaps[i]);
 		character->normalMapIDs.push_back(m.normalMaps[i]);
 		character->specularMapIDs.push_back(m.specularMaps[i]);
 	}
 
+	// Bounding sphere around all of the character's meshes, used to pick LODs
+	glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+	for (const Mesh& mesh : squareMeshes) {
+		for (const glm::vec3& v : mesh.vertices) {
+			boundsMin = glm::min(boundsMin, v);
+			boundsMax = glm::max(boundsMax, v);
+		}
+	}
+	character->boundingCenter = (boundsMin + boundsMax) * 0.5f;
+	character->boundingRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+	character->boneBounds = computeBoneBounds(squareMeshes);
+
 	addChild(root, character);
 
 	// [ʵe
-	//Animation anim0(daeFile, &m);
-	Animation anim1(animFile1, &m);
-	Animation anim2(animFile2, &m);
-	Animation anim3(animFile3, &m);
-	Animation anim4(animFile4, &m);
-	Animation anim5(animFile5, &m);
-	Animation anim6(animFile6, &m);
-	Animation anim7(animFile7, &m);
-	Animation anim8(animFile8, &m);
-	Animation anim9(animFile9, &m);
-	Animation anim10(animFile10, &m);
-	Animation anim11(animFile11, &m);
-	Animation anim12(animFile12, &m);
-	Animation anim13(animFile13, &m);
-	Animation anim14(animFile14, &m);
+	//Animation anim0(daeFile, m.boneProps);
+	Animation anim1(animFile1, m.boneProps);
+	Animation anim2(animFile2, m.boneProps);
+	Animation anim3(animFile3, m.boneProps);
+	Animation anim4(animFile4, m.boneProps);
+	Animation anim5(animFile5, m.boneProps);
+	Animation anim6(animFile6, m.boneProps);
+	Animation anim7(animFile7, m.boneProps);
+	Animation anim8(animFile8, m.boneProps);
+	Animation anim9(animFile9, m.boneProps);
+	Animation anim10(animFile10, m.boneProps);
+	Animation anim11(animFile11, m.boneProps);
+	Animation anim12(animFile12, m.boneProps);
+	Animation anim13(animFile13, m.boneProps);
+	Animation anim14(animFile14, m.boneProps);
 
 	//]whʵe
 	//
@@ -243,17 +475,24 @@ int main()
 							   anim7 , anim8 , anim9 ,
 		                       anim10, anim11, anim12,
 							   anim13, anim14,};
-	
-	// [ۦ⾹
-	Shader shader = Shader((projectRoot + "src/shaders/default.vert").c_str(),
-		(projectRoot + "src/shaders/default.frag").c_str());
-
-	Shader depthShader = Shader((projectRoot + "src/shaders/depth.vert").c_str(),
-		(projectRoot + "src/shaders/depth.frag").c_str());
+	loadScope.end();
+
+	shaderManager().finish();
+	shaderManager().printStats();
+
+	// Every program, reflected now that all have linked, for the per-frame uniform counts
+	std::vector<Shader*> programs = { &shader, &depthShader };
+	if (preskinShader)
+		programs.push_back(preskinShader.get());
+	for (Shader& program : skinShaders)
+		programs.push_back(&program);
+	for (Shader& program : depthSkinShaders)
+		programs.push_back(&program);
+	for (Shader* program : programs)
+		program->reflect();
 
 	// Vj
-	float frameTime = 1.0f / FPS;
-	float lastFrame = 0.0f;
+	double lastFrame = 0.0;
 
 	unsigned int depthMap;
 	unsigned int depthFBO;
@@ -263,34 +502,135 @@ int main()
 	// ͦ`׹
 	generateDepthMap(depthMap, depthFBO, s_width, s_height);
 
+	// Bone palettes of the MULTI_DRAW programs, refilled every frame
+	unsigned int paletteBuffer;
+	glGenBuffers(1, &paletteBuffer);
+
+	// Headless frames are drawn into an offscreen target in place of the window's framebuffer
+	OffscreenTarget offscreenTarget;
+	unsigned int mainFramebuffer = 0;
+	std::vector<HeadlessFrameTime> headlessFrames;
+	int headlessFrame = 0;
+	if (HEADLESS) {
+		if (!createOffscreenTarget(offscreenTarget, WINDOW_WIDTH, WINDOW_HEIGHT, 4)) {
+			std::cout << "Failed to create the offscreen framebuffer" << std::endl;
+			return -1;
+		}
+		mainFramebuffer = offscreenTarget.framebuffer;
+		// Every frame of the run sees the final textures
+		textureManager().waitForUploads();
+		GPU_TIMING = true;
+		gpuTimer.recordFrameTimes = true;
+		headlessFrames.reserve(HEADLESS_FRAMES);
+		animator.playAnimation(&animations[0]);
+	}
+
+	// Without vsync FPS caps the frame rate; headless runs go as fast as they can
+	double targetFps = HEADLESS || VSYNC ? 0.0 : FPS;
+	FrameLimiter frameLimiter(targetFps);
+	FramePacingStats pacingStats;
+	FixedStepClock simulationClock(SIMULATION_STEP, MAX_SIMULATION_STEPS);
+	// Scripted runs stay on one thread so that every run draws the same frames
+	if (HEADLESS)
+		SIMULATION_THREAD = false;
+	PoseSnapshot pose;
+	initPose(pose);
+	// The scene index starts from the first drawn transforms and pose, in a tree built for them whole
+	applyNodeTransforms(pose, 1.0f, 0);
+	updateAnimatedBounds(root, pose.bones);
+	indexNodes(root);
+	sceneIndex().tree.rebuild();
+	unsigned long long lastDrawnStep = 0;
+	unsigned long long nodesApplied = 0;
+	// The bone palette drawn, blended between the two steps of a snapshot
+	std::vector<glm::mat4> transforms(pose.bones.size());
+	std::thread simulationThread;
+	if (SIMULATION_THREAD) {
+		inputBuffer.fill(sampledInput);
+		poseBuffer.fill(pose);
+		simulationThread = std::thread(runSimulation, std::ref(pose), animations);
+	}
+
+	for (const char* name : FRAME_STAT_NAMES)
+		frameStats.addChannel(name);
+	if (FRAME_STATS_DUMP[0] != '\0' && !frameStats.openDump(FRAME_STATS_DUMP))
+		std::cout << "Could not write " << FRAME_STATS_DUMP << std::endl;
+	double lastStatsReport = 0.0;
+	unsigned long long framesAtStatsReport = 0;
+
 	std::cout << "Starting.." << std::endl;
+	pacingStats.start(targetFps);
 
-	while (!glfwWindowShouldClose(window))
+	while (HEADLESS ? headlessFrame < HEADLESS_FRAMES : !glfwWindowShouldClose(window))
 	{
+		frameLimiter.wait();
+		PROFILE_SCOPE("Frame");
+		auto frameStart = std::chrono::steady_clock::now();
 		// pCVɶt
-		float now = glfwGetTime();
-		if (!VSYNC && now - lastFrame <= frameTime)
-		{
-			continue;
-		}
-		deltaTime = now - lastFrame;
-		std::cout << "FPS: " << (1.0f / deltaTime) << "\t\r" << std::flush;
+		double now = HEADLESS ? lastFrame + HEADLESS_FRAME_TIME : glfwGetTime();
+		float frameDelta = HEADLESS ? HEADLESS_FRAME_TIME : (float)(now - lastFrame);
+		frameStats.set(STAT_FRAME_MS, frameDelta * 1000.0f);
+		if (!HEADLESS)
+			pacingStats.addFrame(frameDelta);
 		lastFrame = now;
 
-		// BzJçsʵe
-		processInput(window, animations);
+		// Upload textures finished by the loader threads
+		textureManager().processUploads();
 
-		if (stateA) {
-			animator.updateAnimation(deltaTime);
-		}
-		else {
-			//animator.updateAnimation(deltaTime);
-			animator.blendAnimations(deltaTime, animationA, animationB, blendFactor);
+		if (GPU_TIMING) {
+			gpuTimer.beginFrame();
+			const GpuTiming* shadowTiming = gpuTimer.find("Shadow pass");
+			const GpuTiming* mainTiming = gpuTimer.find("Main pass");
+			frameStats.set(STAT_SHADOW_GPU_MS, shadowTiming ? (float)shadowTiming->lastMilliseconds : 0.0f);
+			frameStats.set(STAT_MAIN_GPU_MS, mainTiming ? (float)mainTiming->lastMilliseconds : 0.0f);
 		}
 
-		updateNodeTransformations(root, glm::mat4(1.0));
+		if (HEADLESS && headlessFrame > 0 && headlessFrame % HEADLESS_CLIP_FRAMES == 0)
+			animator.playAnimation(&animations[headlessFrame / HEADLESS_CLIP_FRAMES % (sizeof(animations) / sizeof(animations[0]))]);
 
-		auto transforms = animator.getFinalBoneMatrices();
+		if (SIMULATION_THREAD) {
+			// The simulation thread steps on its own; hand it this frame's input and take its newest step
+			sampleInput(window);
+			inputBuffer.writeBuffer() = sampledInput;
+			inputBuffer.publish();
+			poseBuffer.acquire();
+		}
+		else {
+			// The simulation advances in whole steps
+			int steps = FIXED_TIMESTEP ? simulationClock.advance(frameDelta) : 1;
+			if (!HEADLESS)
+				sampleInput(window);
+			for (int step = 0; step < steps; step++)
+				simulateStep(pose, sampledInput, appliedInput, animations, FIXED_TIMESTEP ? SIMULATION_STEP : frameDelta);
+		}
+		const PoseSnapshot& drawnPose = SIMULATION_THREAD ? poseBuffer.readBuffer() : pose;
+		frameStats.set(STAT_SIMULATION_STEPS, (float)(drawnPose.step - lastDrawnStep));
+
+		// What is drawn lies alpha of the way from the previous step to the last one
+		float alpha = 1.0f;
+		if (SIMULATION_THREAD)
+			alpha = (float)std::min(1.0, millisecondsSince(drawnPose.published) / (SIMULATION_STEP * 1000.0));
+		else if (FIXED_TIMESTEP)
+			alpha = simulationClock.alpha();
+		glm::vec3 viewPosition = glm::mix(drawnPose.previousCameraPos, drawnPose.cameraPos, alpha);
+		glm::vec3 characterPosition = glm::mix(drawnPose.previousCharacterPos, drawnPose.characterPos, alpha);
+
+		ProfileScope traversalScope("Hierarchy traversal");
+		unsigned int nodesMoved = applyNodeTransforms(drawnPose, alpha, lastDrawnStep);
+		frameStats.set(STAT_NODES_MOVED, (float)nodesMoved);
+		nodesApplied += nodesMoved;
+		lastDrawnStep = drawnPose.step;
+
+		// One LOD per frame, shared by the shadow and main passes
+		selectLods(root, viewPosition, WINDOW_HEIGHT / (2.0f * tan(glm::radians(fov) * 0.5f)));
+
+		interpolateMatrices(drawnPose.previousBones, drawnPose.bones, alpha, transforms);
+		updateAnimatedBounds(root, transforms);
+		traversalScope.end();
+
+		// Skin once for all passes below, skipped while the pose is unchanged
+		if (PRESKINNING)
+			preskinNodes(root, *preskinShader, transforms, CPU_SKINNING ? &cpuSkinner : nullptr);
 
 		// ----------------- vv ---------------
 		glCullFace(GL_FRONT);
@@ -299,143 +639,607 @@ int main()
 		glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
 		glm::mat4 lightSpaceMatrix = lightProjection * lightView;
 
-		depthShader.use();
-
-		setUniformBoneTransforms(transforms, depthShader.ID);
+		glm::mat4 projection = glm::perspective(glm::radians(fov), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+		glm::mat4 view = glm::lookAt(viewPosition, characterPosition + glm::vec3(0.0f, 1.0f, 0.0f), cameraUp);
+		if (pickRequested) {
+			pickRequested = false;
+			pickNode(projection * view, pickX, pickY);
+		}
 
-		glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+		// Both passes are queued up front, each culled against its own frustum; the shadow draws
+		// sort by distance to the light
+		ProfileScope queueScope("Queue draws");
+		renderQueue.clear();
+		unsigned int culledBefore[2] = { cullingStats[SHADOW_PASS].culled, cullingStats[MAIN_PASS].culled };
+		if (FRUSTUM_CULLING && BVH_CULLING) {
+			collectVisibleDraws(renderQueue, SHADOW_PASS, lightPos, frustumFromMatrix(lightSpaceMatrix));
+			collectVisibleDraws(renderQueue, MAIN_PASS, viewPosition, frustumFromMatrix(projection * view));
+		}
+		else {
+			collectDrawItems(root, renderQueue, SHADOW_PASS, lightPos, frustumFromMatrix(lightSpaceMatrix));
+			collectDrawItems(root, renderQueue, MAIN_PASS, viewPosition, frustumFromMatrix(projection * view));
+		}
+		frameStats.set(STAT_SHADOW_CULLED, (float)(cullingStats[SHADOW_PASS].culled - culledBefore[0]));
+		frameStats.set(STAT_MAIN_CULLED, (float)(cullingStats[MAIN_PASS].culled - culledBefore[1]));
+		renderQueue.sort();
+		queueScope.end();
+
+		// Animation rate for the next steps: full while on screen, lower while only the shadow
+		// shows, lowest while culled from both passes
+		if (FRUSTUM_CULLING) {
+			unsigned int passes = character->visiblePasses;
+			if (passes & (1u << MAIN_PASS))
+				animationInterval.store(1, std::memory_order_relaxed);
+			else if (passes & (1u << SHADOW_PASS))
+				animationInterval.store(SHADOW_ONLY_ANIMATION_INTERVAL, std::memory_order_relaxed);
+			else
+				animationInterval.store(CULLED_ANIMATION_INTERVAL, std::memory_order_relaxed);
+		}
+		if (MULTI_DRAW_INDIRECT) {
+			renderQueue.uploadIndirect();
+			// In-shader skinning reads the bones from the palette buffer, at each draw's paletteOffset
+			if (!PRESKINNING) {
+				PROFILE_SCOPE("Palette upload");
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, paletteBuffer);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PALETTE_BINDING, paletteBuffer);
+			}
+		}
 
+		ProfileScope shadowScope("Shadow pass");
+		GpuScope shadowGpuScope(GPU_TIMING ? &gpuTimer : nullptr, "Shadow pass");
 		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glViewport(0, 0, s_width, s_height);
 		glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
 		glClear(GL_DEPTH_BUFFER_BIT);
-		renderNode(root);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		glCullFace(GL_BACK);
+		// With GPU_TIMING_DRAW_GROUPS every program change closes the running draw group and opens the next
+		bool timeDrawGroups = GPU_TIMING && GPU_TIMING_DRAW_GROUPS;
+		unsigned int drawGroup = ~0u;
+		auto beginDrawGroup = [&](RenderPass pass, unsigned int slot) {
+			if (drawGroup != ~0u)
+				gpuTimer.end(drawGroup);
+			drawGroup = gpuTimer.begin(DRAW_GROUP_NAMES[pass][slot]);
+		};
+		auto endDrawGroup = [&]() {
+			if (drawGroup != ~0u)
+				gpuTimer.end(drawGroup);
+			drawGroup = ~0u;
+		};
+
+		// Slot 0 is the base program, slots 1..4 the ones specialized for each influence bucket
+		auto useDepthProgram = [&](unsigned int slot) -> Shader& {
+			if (timeDrawGroups)
+				beginDrawGroup(SHADOW_PASS, slot);
+			Shader& program = slot == 0 ? depthShader : depthSkinShaders[slot - 1];
+			program.use();
+			if (!PRESKINNING && !MULTI_DRAW_INDIRECT)
+				setUniformBoneTransforms(transforms, program);
+			program.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			return program;
+		};
+		if (MULTI_DRAW_INDIRECT)
+			renderQueue.submitIndirect(SHADOW_PASS, useDepthProgram);
+		else
+			renderQueue.submit(SHADOW_PASS, useDepthProgram);
+		endDrawGroup();
+		glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+		shadowGpuScope.end();
+		shadowScope.end();
 
-		shader.use();
+		glCullFace(GL_BACK);
 
 		// ---------------- vBz ------------
 
-		setUniformBoneTransforms(transforms, shader.ID);
-
+		ProfileScope mainScope("Main pass");
+		GpuScope mainGpuScope(GPU_TIMING ? &gpuTimer : nullptr, "Main pass");
 		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-		glm::mat4 projection = glm::perspective(glm::radians(fov), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 view = glm::lookAt(cameraPos, character->position + glm::vec3(0.0f, 1.0f, 0.0f), cameraUp);
-
-		glUniformMatrix4fv(1, 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(2, 1, GL_FALSE, glm::value_ptr(projection));
-		glUniform3fv(3, 1, glm::value_ptr(cameraPos));
-
-		glUniformMatrix4fv(5, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
 		glActiveTexture(GL_TEXTURE3);
 		glBindTexture(GL_TEXTURE_2D, depthMap);
 
-		renderNode(root);
+		auto useProgram = [&](unsigned int slot) -> Shader& {
+			if (timeDrawGroups)
+				beginDrawGroup(MAIN_PASS, slot);
+			Shader& program = slot == 0 ? shader : skinShaders[slot - 1];
+			program.use();
+			if (!PRESKINNING && !MULTI_DRAW_INDIRECT)
+				setUniformBoneTransforms(transforms, program);
+
+			program.setMat4("V", view);
+			program.setMat4("P", projection);
+			program.setVec3("camPos", viewPosition);
+			program.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			return program;
+		};
+		if (MULTI_DRAW_INDIRECT)
+			renderQueue.submitIndirect(MAIN_PASS, useProgram);
+		else
+			renderQueue.submit(MAIN_PASS, useProgram);
+		endDrawGroup();
 
 		glBindVertexArray(0);
 		glBindTexture(GL_TEXTURE_2D, 0);
+		mainGpuScope.end();
+		mainScope.end();
+
+		const RenderStats& renderStats = renderQueue.currentFrame();
+		frameStats.set(STAT_CPU_MS, (float)millisecondsSince(frameStart));
+		frameStats.set(STAT_DRAWS, (float)renderStats.draws);
+		frameStats.set(STAT_PROGRAM_CHANGES, (float)renderStats.programChanges);
+		frameStats.set(STAT_TEXTURE_BINDS, (float)renderStats.textureBinds);
+		unsigned int uniformsSkipped = 0;
+		for (Shader* program : programs) {
+			uniformsSkipped += program->frameUniforms.skipped;
+			program->endFrame();
+		}
+		frameStats.set(STAT_UNIFORMS_SKIPPED, (float)uniformsSkipped);
+		frameStats.endFrame();
+
+		// Rolling summary of the frames since the last one, overwriting the console line
+		if (FRAME_STATS_INTERVAL > 0.0f && now - lastStatsReport >= FRAME_STATS_INTERVAL) {
+			unsigned int recentFrames = (unsigned int)std::min<unsigned long long>(frameStats.frameCount() - framesAtStatsReport, FrameStats::capacity);
+			ChannelSummary frameTimes = frameStats.summary(STAT_FRAME_MS, recentFrames);
+			char line[160];
+			snprintf(line, sizeof(line), "%.0f FPS, frame ms p50 %.2f / p95 %.2f / p99 %.2f / max %.2f",
+				frameTimes.mean > 0.0f ? 1000.0f / frameTimes.mean : 0.0f, frameTimes.p50, frameTimes.p95, frameTimes.p99, frameTimes.max);
+			std::cout << line << "\t\r" << std::flush;
+			lastStatsReport = now;
+			framesAtStatsReport = frameStats.frameCount();
+		}
 
-
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		if (HEADLESS) {
+			// Nothing swaps, so submit the frame here
+			glFlush();
+			HeadlessFrameTime timing;
+			timing.cpuMilliseconds = millisecondsSince(frameStart);
+			if (HEADLESS_DUMP_INTERVAL > 0 && headlessFrame % HEADLESS_DUMP_INTERVAL == 0) {
+				std::string path = HEADLESS_DUMP_PREFIX + std::to_string(1000000 + headlessFrame).substr(3) + ".ppm";
+				if (!writeFramePPM(offscreenTarget, path))
+					std::cout << "Could not write " << path << std::endl;
+			}
+			timing.frameMilliseconds = millisecondsSince(frameStart);
+			headlessFrames.push_back(timing);
+			headlessFrame++;
+		}
+		else {
+			PROFILE_SCOPE("Swap buffers");
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
+	}
+	if (SIMULATION_THREAD) {
+		stopSimulation = true;
+		simulationThread.join();
 	}
 	std::cout << std::endl << "Terminating.." << std::endl;
+	frameStats.print();
+	frameStats.closeDump();
+	if (!HEADLESS)
+		pacingStats.print(frameLimiter);
+	if (SIMULATION_THREAD)
+		std::cout << "Simulation thread: " << pose.step << " steps of " << SIMULATION_STEP * 1000.0f << " ms" << std::endl;
+	else if (FIXED_TIMESTEP)
+		std::cout << "Simulation: " << simulationClock.steps() << " steps of " << SIMULATION_STEP * 1000.0f << " ms, " << simulationClock.dropped() << " s dropped after long frames" << std::endl;
+	const SceneTransforms::Stats& transformStats = sceneTransforms().stats;
+	if (transformStats.updates > 0 && frameStats.frameCount() > 0) {
+		std::cout << "Scene transforms: " << sceneNodes().nodeCount() << " nodes, " << (float)transformStats.worlds / transformStats.updates << " world and "
+			<< (float)transformStats.locals / transformStats.updates << " local transforms recomputed per step, "
+			<< (float)nodesApplied / frameStats.frameCount() << " drawn transforms set per frame" << std::endl;
+	}
+	if (HEADLESS) {
+		// The last frames' timestamps are still in flight
+		gpuTimer.flush();
+		for (const GpuFrameTime& gpuFrame : gpuTimer.frameTimes) {
+			if (gpuFrame.frame < headlessFrames.size())
+				headlessFrames[gpuFrame.frame].gpuMilliseconds = gpuFrame.milliseconds;
+		}
+		std::cout << "Headless run, " << headlessFrames.size() << " frames at " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << ":" << std::endl;
+		printFrameTimeSummary("CPU", headlessFrames, &HeadlessFrameTime::cpuMilliseconds);
+		printFrameTimeSummary("GPU", headlessFrames, &HeadlessFrameTime::gpuMilliseconds);
+		printFrameTimeSummary("Frame", headlessFrames, &HeadlessFrameTime::frameMilliseconds);
+		if (writeFrameTimes(headlessFrames, HEADLESS_FRAME_TIMES_FILE))
+			std::cout << "Frame times written to " << HEADLESS_FRAME_TIMES_FILE << std::endl;
+	}
+	if (profiling() && profiler().writeChromeTrace(PROFILE_TRACE_FILE))
+		std::cout << "Profile trace written to " << PROFILE_TRACE_FILE << std::endl;
+	if (PRESKINNING)
+		std::cout << "Pre-skinning: " << preskinStats.skinned << " skin passes, " << preskinStats.reused << " frames reused the previous pose" << std::endl;
+	if (FRUSTUM_CULLING) {
+		std::cout << "Frustum culling: " << cullingStats[MAIN_PASS].culled << " of " << cullingStats[MAIN_PASS].tested << " node tests culled in the main pass, "
+			<< cullingStats[SHADOW_PASS].culled << " of " << cullingStats[SHADOW_PASS].tested << " in the shadow pass" << std::endl;
+		if (BVH_CULLING && frameStats.frameCount() > 0) {
+			std::cout << "BVH culling: " << sceneIndex().tree.leafCount() << " indexed nodes, " << (float)cullingStats[MAIN_PASS].boxTests / frameStats.frameCount()
+				<< " box tests per frame in the main pass, " << (float)cullingStats[SHADOW_PASS].boxTests / frameStats.frameCount() << " in the shadow pass" << std::endl;
+		}
+	}
+	if (GPU_TIMING) {
+		std::cout << "GPU time per frame, read back " << GpuTimer::latency << " frames late (" << gpuTimer.dropped << " frames dropped):" << std::endl;
+		for (const GpuTiming& timing : gpuTimer.timings())
+			std::cout << "  " << timing.name << ": " << timing.averageMilliseconds() << " ms (last " << timing.lastMilliseconds << " ms)" << std::endl;
+	}
+	if (renderQueue.frames > 0) {
+		const RenderStats& last = renderQueue.lastFrame;
+		std::cout << "Render queue, last frame: " << last.draws << " draws in " << last.multiDraws << " multi-draws, " << last.programChanges << " program changes, "
+			<< last.textureBinds << " texture binds, " << last.vaoBinds << " VAO binds, " << last.uniformUploads << " uniform uploads, "
+			<< last.elided << " redundant binds skipped (" << (float)renderQueue.total.elided / renderQueue.frames << " per frame on average)" << std::endl;
+	}
+	std::cout << "Uniform sets per frame, sent / skipped as unchanged:" << std::endl;
+	for (const Shader* program : programs) {
+		if (program->frames == 0 || program->totalUniforms.uploads + program->totalUniforms.skipped == 0)
+			continue;
+		std::cout << "  " << program->name << ": " << (float)program->totalUniforms.uploads / program->frames << " / "
+			<< (float)program->totalUniforms.skipped / program->frames << std::endl;
+	}
+	if (CPU_SKINNING) {
+		// Check the SIMD path against the scalar reference on the last pose, then time it
+		auto transforms = animator.getFinalBoneMatrices();
+		for (const Mesh& mesh : squareMeshes) {
+			if (!canSkinOnCpu(mesh))
+				continue;
+			SkinningError error = validateCpuSkinning(cpuSkinner, mesh, transforms);
+			std::cout << "CPU skinning (" << skinningPathName(cpuSkinner.path) << ", " << cpuSkinner.threadCount() << " threads): "
+				<< mesh.vertices.size() << " vertices, max error " << error.position << " / " << error.normal << ", "
+				<< benchmarkCpuSkinning(cpuSkinner, mesh, transforms) << " vertices/ms" << std::endl;
+		}
+	}
 
 	// Vפ GLFW
+	if (HEADLESS) {
+		deleteOffscreenTarget(offscreenTarget);
+		destroyOffscreenContext(offscreen);
+	}
 	glfwTerminate();
 	return 0;
 }
 
 
-void setUniformBoneTransforms(std::vector<glm::mat4> transforms, unsigned int shaderId) {
-	// Nfഫx}]wۦ⾹
-	for (int i = 0; i < transforms.size(); ++i) {
-		string boneStr = "boneTransforms[" + std::to_string(i) + "]"; // ͦfW
-		int boneLocation = glGetUniformLocation(shaderId, boneStr.c_str()); //  uniform m
-		glUniformMatrix4fv(boneLocation, 1, GL_FALSE, glm::value_ptr(transforms[i])); // ]wx}
+void setUniformBoneTransforms(const std::vector<glm::mat4>& transforms, Shader& shader) {
+	PROFILE_SCOPE("Palette upload");
+	// Nfഫx}]wۦ⾹APWۦPɲL
+	shader.setMat4Array("boneTransforms", transforms.data(), (int)transforms.size());
+}
+
+unsigned int uploadMesh(Mesh& mesh, unsigned int& indexType) {
+	if (!PACKED_VERTICES) {
+		indexType = GL_UNSIGNED_INT;
+		return generateBuffer(mesh);
 	}
+	if (PACKED_WEIGHTS_16BIT)
+		return generatePackedBuffer<uint16_t>(mesh, indexType);
+	return generatePackedBuffer<uint8_t>(mesh, indexType);
 }
 
-void updateNodeTransformations(Node* node, glm::mat4 transformationThusFar) {
-	// pe`Iܴx}
-	glm::mat4 transformationMatrix =
-		glm::translate(node->position) *
-		glm::translate(node->referencePoint) *
-		glm::rotate(node->rotation.y, glm::vec3(0, 1, 0)) *
-		glm::rotate(node->rotation.x, glm::vec3(1, 0, 0)) *
-		glm::rotate(node->rotation.z, glm::vec3(0, 0, 1)) *
-		glm::scale(node->scale) *
-		glm::translate(-node->referencePoint);
+// Influence-bucket ranges of every LOD in the element buffer built by elementIndices, which starts at
+// firstIndex when the mesh is part of a batch. Levels without buckets are drawn entirely with the
+// 4-influence program.
+std::vector<LodRange> lodRanges(const Mesh& mesh, unsigned int firstIndex) {
+	std::vector<LodRange> lods;
+	unsigned int base = firstIndex;
+	auto addLevel = [&](const unsigned int* offsets, size_t indexCount, float error) {
+		LodRange lod;
+		lod.error = error;
+		bool bucketed = indexCount > 0 && offsets[MAX_BONE_INFLUENCE] == indexCount;
+		for (int b = 0; b <= MAX_BONE_INFLUENCE; b++)
+			lod.influenceOffsets[b] = base + (bucketed ? offsets[b] : 0);
+		if (!bucketed)
+			lod.influenceOffsets[MAX_BONE_INFLUENCE] = base + (unsigned int)indexCount;
+		lods.push_back(lod);
+		base += (unsigned int)indexCount;
+	};
+	addLevel(mesh.influenceOffsets, mesh.indices.size(), 0.0f);
+	for (const MeshLod& lod : mesh.lods)
+		addLevel(lod.influenceOffsets, lod.indices.size(), lod.error);
+	return lods;
+}
 
-	node->currentTransformationMatrix = transformationThusFar * transformationMatrix;
+// Pick, per VAO, the coarsest level whose error projects to at most LOD_PIXEL_ERROR pixels.
+// pixelsPerUnit is the projected size of one world unit at distance 1.
+void selectLods(Node* node, glm::vec3 viewPosition, float pixelsPerUnit) {
+	if (node->type == CHARACTER) {
+		const glm::mat4& model = node->currentTransformationMatrix;
+		glm::vec3 center = glm::vec3(model * glm::vec4(node->boundingCenter, 1.0f));
+		float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		// Distance to the nearest point of the bounding sphere; inside it always draws the full mesh
+		float distance = glm::length(center - viewPosition) - node->boundingRadius * scale;
+		for (unsigned int i = 0; i < node->VAOLods.size(); i++) {
+			unsigned int level = 0;
+			if (MESH_LODS && distance > 0.0f) {
+				for (unsigned int l = 1; l < node->VAOLods[i].size(); l++) {
+					if (node->VAOLods[i][l].error * scale * pixelsPerUnit / distance <= LOD_PIXEL_ERROR)
+						level = l;
+				}
+			}
+			node->VAOCurrentLods[i] = level;
+		}
+	}
 
-	// jBzl`Iܴ
-	for (Node* child : node->children) {
-		updateNodeTransformations(child, node->currentTransformationMatrix);
+	for (Node* child : childrenOf(node)) {
+		selectLods(child, viewPosition, pixelsPerUnit);
 	}
 }
 
-void renderNode(Node* node) {
-	// ]w`Iۦ⾹
-	glUniform1ui(4, node->type);
+// Run the skin pass for every character whose pose differs from the one in its skin buffers, on the
+// CPU when a skinner is given
+void preskinNodes(Node* node, Shader& skinProgram, const std::vector<glm::mat4>& transforms, CpuSkinner* cpuSkinner) {
+	if (node->type == CHARACTER && !node->skinBufferIDs.empty()) {
+		if (poseChanged(node, transforms)) {
+			PROFILE_SCOPE("Pre-skinning");
+			// Meshes the CPU skinner cannot read go through skin.vert
+			if (!cpuSkinner || !cpuSkinNode(node, transforms, *cpuSkinner)) {
+				skinProgram.use();
+				setUniformBoneTransforms(transforms, skinProgram);
+				skinNode(node, transforms);
+			}
+			preskinStats.skinned++;
+		}
+		else {
+			preskinStats.reused++;
+		}
+	}
 
-	// ھڸ`Iiøs
-	switch (node->type) {
-	case CHARACTER:
-		// øs
-		for (unsigned int i = 0; i < node->VAOIndexCounts.size(); i++) {
-			if (node->vertexArrayObjectIDs[i] != -1) {
-				// jwK
-				if (node->textureIDs[i] >= 0) {
-					glActiveTexture(GL_TEXTURE0);
-					glBindTexture(GL_TEXTURE_2D, node->textureIDs[i]);
-				}
+	for (Node* child : childrenOf(node)) {
+		preskinNodes(child, skinProgram, transforms, cpuSkinner);
+	}
+}
 
-				if (node->normalMapIDs[i] >= 0) {
-					glActiveTexture(GL_TEXTURE1);
-					glBindTexture(GL_TEXTURE_2D, node->normalMapIDs[i]);
-				}
+// Bring the world transforms of the nodes that moved into pose, stamped with its step. Nodes that
+// moved in the step before hold still from here unless they move again, so their previous
+// transform catches up first.
+void updateNodeTransforms(PoseSnapshot& pose) {
+	SceneTransforms& scene = sceneTransforms();
+	for (unsigned int i : scene.changed())
+		pose.previousNodeTransforms[i] = pose.nodeTransforms[i];
+	// Slots added to the pool since the last step
+	if (pose.nodeTransforms.size() < scene.size()) {
+		pose.previousNodeTransforms.resize(scene.size(), glm::mat4(1.0f));
+		pose.nodeTransforms.resize(scene.size(), glm::mat4(1.0f));
+		pose.nodeSteps.resize(scene.size(), pose.step);
+	}
 
-				if (node->specularMapIDs[i] >= 0) {
-					glActiveTexture(GL_TEXTURE2);
-					glBindTexture(GL_TEXTURE_2D, node->specularMapIDs[i]);
-				}
+	// uspⲾʹLlܴx}
+	scene.update();
+	for (unsigned int i : scene.changed()) {
+		pose.nodeTransforms[i] = scene.world(i);
+		pose.nodeSteps[i] = pose.step;
+	}
+}
+
+// Give the live nodes that moved since the step drawn last frame the transform they are drawn with.
+// Nodes that moved in the pose's last step are blended alpha of the way from the step before and
+// are set again every frame; the others take their final transform once. Returns the nodes set.
+// Only the renderer writes currentTransformationMatrix; the simulation works on its own copies.
+unsigned int applyNodeTransforms(const PoseSnapshot& pose, float alpha, unsigned long long sinceStep) {
+	unsigned int applied = 0;
+	for (unsigned int i = 0; i < pose.nodeSteps.size(); i++) {
+		unsigned long long moved = pose.nodeSteps[i];
+		Node* node = moved < sinceStep ? nullptr : sceneNodes().node(i);
+		if (!node)
+			continue;
+		if (moved == pose.step && alpha < 1.0f)
+			node->currentTransformationMatrix = pose.previousNodeTransforms[i] * (1.0f - alpha) + pose.nodeTransforms[i] * alpha;
+		else
+			node->currentTransformationMatrix = pose.nodeTransforms[i];
+		updateSceneIndex(node);
+		applied++;
+	}
+	return applied;
+}
+
+// Both steps of pose at the starting state of the scene
+void initPose(PoseSnapshot& pose) {
+	pose.previousCameraPos = pose.cameraPos = cameraPos;
+	pose.previousCharacterPos = pose.characterPos = sceneTransforms().position(character->slot);
+	sceneTransforms().update();
+	pose.nodeTransforms = sceneTransforms().worldTransforms();
+	pose.previousNodeTransforms = pose.nodeTransforms;
+	pose.nodeSteps.assign(pose.nodeTransforms.size(), 0);
+	pose.previousBones = pose.bones = animator.boneMatrices();
+	pose.published = std::chrono::steady_clock::now();
+}
+
+// One step of input, movement and animation. The last step in pose becomes the previous one and
+// the new step is recorded in its place, reusing pose's storage.
+void simulateStep(PoseSnapshot& pose, const SimulationInput& input, SimulationInput& applied, Animation* animations, float step) {
+	PROFILE_SCOPE("Simulation step");
+	pose.previousCameraPos = pose.cameraPos;
+	pose.previousCharacterPos = pose.characterPos;
+	pose.previousBones.swap(pose.bones);
+	pose.step++;
+	pose.time += step;
+	deltaTime = step;
+
+	// BzJçsʵe
+	if (HEADLESS) {
+		// Scripted run: the camera follows a fixed path and the clips change on a fixed schedule
+		cameraPos = cameraPathPosition(sceneTransforms().position(character->slot), (float)pose.time);
+	}
+	else
+		applyInput(input, applied, animations);
+
+	// Off-screen characters are posed less often; the skipped time is carried into the next update
+	animator.setUpdateInterval(animationInterval.load(std::memory_order_relaxed));
+	float animationTime = step;
+	if (animator.consumeUpdate(animationTime)) {
+		if (input.stateA) {
+			animator.updateAnimation(animationTime);
+		}
+		else {
+			//animator.updateAnimation(deltaTime);
+			animator.blendAnimations(animationTime, animationA, animationB, input.blendFactor);
+		}
+	}
+
+	pose.cameraPos = cameraPos;
+	pose.characterPos = sceneTransforms().position(character->slot);
+	updateNodeTransforms(pose);
+	pose.bones = animator.boneMatrices();
+	pose.published = std::chrono::steady_clock::now();
+}
+
+// The simulation thread: a step every SIMULATION_STEP, each published whole to the renderer, until
+// stopSimulation. It alone touches the animator, the camera position, sceneTransforms() and pose.
+void runSimulation(PoseSnapshot& pose, Animation* animations) {
+	setProfilerThreadName("Simulation");
+	SimulationInput applied = inputBuffer.readBuffer();
+	FrameLimiter stepLimiter(1.0 / SIMULATION_STEP);
+	while (!stopSimulation.load(std::memory_order_relaxed)) {
+		stepLimiter.wait();
+		inputBuffer.acquire();
+		simulateStep(pose, inputBuffer.readBuffer(), applied, animations, SIMULATION_STEP);
+		copyPose(poseBuffer.writeBuffer(), pose);
+		poseBuffer.publish();
+	}
+}
+
+// Queue the draws of every node whose bounds intersect the pass's frustum. Nodes without bounds
+// are always drawn; children are visited either way, since they have bounds of their own.
+void collectDrawItems(Node* node, RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition, const Frustum& frustum) {
+	bool visible = true;
+	if (FRUSTUM_CULLING && !node->bounds.empty()) {
+		visible = boxInFrustum(frustum, transformBox(node->currentTransformationMatrix, node->bounds));
+		cullingStats[pass].tested++;
+		if (!visible)
+			cullingStats[pass].culled++;
+	}
 
-				// ]we`Iܴx}
-				glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(node->currentTransformationMatrix));
-				glBindVertexArray(node->vertexArrayObjectIDs[i]); // jw VAO
-				glDrawElements(GL_TRIANGLES, node->VAOIndexCounts[i], GL_UNSIGNED_INT, nullptr); // øsT
+	if (visible) {
+		node->visiblePasses |= 1u << pass;
+		queueNodeDraws(node, queue, pass, viewPosition);
+	}
+	else {
+		node->visiblePasses &= ~(1u << pass);
+	}
+
+	for (Node* child : childrenOf(node)) {
+		collectDrawItems(child, queue, pass, viewPosition, frustum);
+	}
+}
+
+// Queue the draws of the indexed nodes whose boxes intersect the pass's frustum, found through the
+// scene index's tree instead of testing every node. Nodes without bounds are always drawn.
+void collectVisibleDraws(RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition, const Frustum& frustum) {
+	for (NodeHandle handle : visibleNodes[pass]) {
+		if (Node* node = sceneNodes().get(handle))
+			node->visiblePasses &= ~(1u << pass);
+	}
+	visibleNodes[pass].clear();
+
+	Bvh& tree = sceneIndex().tree;
+	tree.queryFrustum(frustum, [&](unsigned int slot) {
+		Node* node = sceneNodes().node(slot);
+		node->visiblePasses |= 1u << pass;
+		visibleNodes[pass].push_back(sceneNodes().handle(node));
+		queueNodeDraws(node, queue, pass, viewPosition);
+	});
+	cullingStats[pass].tested += tree.leafCount();
+	cullingStats[pass].culled += tree.leafCount() - tree.lastQuery.hits;
+	cullingStats[pass].boxTests += tree.lastQuery.boxTests;
+
+	for (unsigned int slot : sceneIndex().unbounded)
+		queueNodeDraws(sceneNodes().node(slot), queue, pass, viewPosition);
+}
+
+// Add node and everything below it to the scene index
+void indexNodes(Node* node) {
+	indexSceneNode(node);
+	for (Node* child : childrenOf(node)) {
+		indexNodes(child);
+	}
+}
+
+// Queue the node's draws for one pass. Characters skinned in the shader with INFLUENCE_BUCKETS are
+// queued range by range, each bucket k with program slot k; everything else uses slot 0. Shadow
+// draws need no material.
+void queueNodeDraws(Node* node, RenderQueue& queue, RenderPass pass, glm::vec3 viewPosition) {
+	glm::vec3 center = glm::vec3(node->currentTransformationMatrix * glm::vec4(node->boundingCenter, 1.0f));
+	float depth = glm::length(center - viewPosition);
+
+	DrawItem item;
+	item.pass = pass;
+	item.nodeType = node->type;
+	item.model = &node->currentTransformationMatrix;
+	// Every character is posed by the one animator, whose palette starts at 0
+	item.paletteOffset = 0;
+
+	switch (node->type) {
+	case CHARACTER:
+		for (unsigned int i = 0; i < node->VAOIndexCounts.size(); i++) {
+			if (node->vertexArrayObjectIDs[i] == -1)
+				continue;
+			const LodRange& lod = node->VAOLods[i][node->VAOCurrentLods[i]];
+			item.material = pass == MAIN_PASS ? queue.materialID(node->textureIDs[i], node->normalMapIDs[i], node->specularMapIDs[i]) : NO_MATERIAL;
+			item.vao = PRESKINNING ? node->skinnedVAOIDs[i] : node->vertexArrayObjectIDs[i];
+			item.indexType = node->VAOIndexTypes[i];
+			item.baseVertex = node->VAOBaseVertices[i];
+			int firstBucket = INFLUENCE_BUCKETS && !PRESKINNING ? 1 : 0;
+			int lastBucket = INFLUENCE_BUCKETS && !PRESKINNING ? MAX_BONE_INFLUENCE : 0;
+			for (int bucket = firstBucket; bucket <= lastBucket; bucket++) {
+				item.program = bucket;
+				item.first = bucket > 0 ? lod.influenceOffsets[bucket - 1] : lod.influenceOffsets[0];
+				item.count = lod.influenceOffsets[bucket > 0 ? bucket : MAX_BONE_INFLUENCE] - item.first;
+				if (item.count > 0)
+					queue.add(item, depth);
 			}
 		}
 		break;
 	case GEOMETRY:
-		// øsX
+		item.program = 0;
+		item.material = NO_MATERIAL;
+		item.first = 0;
 		for (unsigned int i = 0; i < node->VAOIndexCounts.size(); i++) {
-			glUniformMatrix4fv(0, 1, GL_FALSE, glm::value_ptr(node->currentTransformationMatrix));
-			glBindVertexArray(node->vertexArrayObjectIDs[i]);
-			glDrawElements(GL_TRIANGLES, node->VAOIndexCounts[i], GL_UNSIGNED_INT, nullptr);
+			item.vao = node->vertexArrayObjectIDs[i];
+			item.indexType = node->VAOIndexTypes[i];
+			item.baseVertex = node->VAOBaseVertices[i];
+			item.count = node->VAOIndexCounts[i];
+			queue.add(item, depth);
 		}
 		break;
 	}
+}
+
+// Bound every character by its bone boxes in the current pose
+void updateAnimatedBounds(Node* node, const std::vector<glm::mat4>& transforms) {
+	if (node->type == CHARACTER && !node->boneBounds.empty()) {
+		node->bounds = animatedBounds(node->boneBounds, transforms);
+		updateSceneIndex(node);
+	}
 
-	// jøsl`I
-	for (Node* child : node->children) {
-		renderNode(child);
+	for (Node* child : childrenOf(node)) {
+		updateAnimatedBounds(child, transforms);
 	}
 }
 
+// Print the node whose box the ray through window point x, y enters first
+void pickNode(const glm::mat4& viewProjection, double x, double y) {
+	glm::mat4 inverse = glm::inverse(viewProjection);
+	glm::vec2 ndc((float)(2.0 * x / WINDOW_WIDTH - 1.0), (float)(1.0 - 2.0 * y / WINDOW_HEIGHT));
+	glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+	// The ray runs from the near plane (0) to the far plane (1)
+	float distance = 0.0f;
+	unsigned int slot = sceneIndex().tree.raycast(origin, direction, 1.0f, &distance);
+	Node* node = slot == Bvh::none ? nullptr : sceneNodes().node(slot);
+	if (node)
+		std::cout << "Picked node " << slot << " (type " << node->type << ") at " << distance * glm::length(direction) << " units" << std::endl;
+	else
+		std::cout << "Picked nothing" << std::endl;
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 	// sjpɡAs]wf
 	glViewport(0, 0, width, height);
 }
 
-void processInput(GLFWwindow* window, Animation* animations) {
+// Read the keys for the simulation's next steps. Keys that only concern the window or the mouse
+// camera controls are handled here, on the main thread.
+void sampleInput(GLFWwindow* window) {
 	// BzϥΪ̿J
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true); // U ESC 
@@ -446,114 +1250,138 @@ void processInput(GLFWwindow* window, Animation* animations) {
 		canAdjustCameraPos = true;
 	
 	}
-	
+
+	// A right click picks the node under the cursor in the next frame drawn
+	bool rightDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+	if (rightDown && !rightButtonDown) {
+		glfwGetCursorPos(window, &pickX, &pickY);
+		pickRequested = true;
+	}
+	rightButtonDown = rightDown;
+
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); // Uô
+		canAdjustCameraPos = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+		moveAxisZ = true;
+		moveAxisX = false;
+	}
+	else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
+		moveAxisZ = false;
+		moveAxisX = true;
+	}
+
+	sampledInput.keys = 0;
+	for (int key = 0; key < INPUT_KEY_COUNT; key++) {
+		if (glfwGetKey(window, INPUT_GLFW_KEYS[key]) == GLFW_PRESS)
+			sampledInput.keys |= 1u << key;
+	}
+	sampledInput.stateA = stateA;
+	sampledInput.blendFactor = blendFactor;
+}
+
+// Act on input for one simulation step. applied holds the event totals acted on so far.
+void applyInput(const SimulationInput& input, SimulationInput& applied, Animation* animations) {
+	if (input.blendToggles != applied.blendToggles)
+		animator.playAnimation(animationA);
+	cameraPos += input.cameraShift - applied.cameraShift;
+	applied = input;
+
 	float speed = 4.0f * deltaTime; // ھڮɶpⲾʳt
-	bool isIdle = stateA; // A 
-	bool isIdle2 = StateB; // B
+	bool isIdle = input.stateA; // A 
 
 
 	// BzLJ
 	if (isIdle) {
 		//idle0 ~| , _hcallbackfuncBz
-		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-			character->position.z += 1.2f * speed;
+		if (input.held(INPUT_W)) {
+			sceneTransforms().translate(character->slot, glm::vec3(0, 0, 1.2f * speed));
 			cameraPos.z += 1.0f * speed;
 			animator.playAnimation(&animations[1]); // eiʵe
 			isIdle = false;
 		}
-		else if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-			character->position.x += 0.75f * speed;
+		else if (input.held(INPUT_D)) {
+			sceneTransforms().translate(character->slot, glm::vec3(0.75f * speed, 0, 0));
 			cameraPos.x += 0.75f * speed;
 			animator.playAnimation(&animations[2]); // 񥪥ʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-			character->position.x -= 0.75f * speed;
+		else if (input.held(INPUT_A)) {
+			sceneTransforms().translate(character->slot, glm::vec3(-0.75f * speed, 0, 0));
 			cameraPos.x -= 0.75f * speed;
 			animator.playAnimation(&animations[3]); // kʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-			character->position.z -= 0.5f * speed;
+		else if (input.held(INPUT_S)) {
+			sceneTransforms().translate(character->slot, glm::vec3(0, 0, -0.5f * speed));
 			cameraPos.z -= 0.5f * speed;
 			animator.playAnimation(&animations[4]); // hʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
+		else if (input.held(INPUT_SPACE)) {
 
-			character->position.z -= 0.2f * speed;
+			sceneTransforms().translate(character->slot, glm::vec3(0, 0, -0.2f * speed));
 			cameraPos.z -= 0.2f * speed;
 			animator.playAnimation(&animations[5]); // Dʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
+		else if (input.held(INPUT_Z)) {
 
 			animator.playAnimation(&animations[6]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
+		else if (input.held(INPUT_X)) {
 
 			animator.playAnimation(&animations[7]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+		else if (input.held(INPUT_C)) {
 
 			animator.playAnimation(&animations[8]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) {
+		else if (input.held(INPUT_V)) {
 
 			animator.playAnimation(&animations[9]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+		else if (input.held(INPUT_B)) {
 
 			animator.playAnimation(&animations[10]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS) {
+		else if (input.held(INPUT_N)) {
 
 			animator.playAnimation(&animations[11]); // Lʵe
 			isIdle = false;
 
 		}
-		else if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS) {
+		else if (input.held(INPUT_M)) {
 			animator.playAnimation(&animations[12]); // Lʵe
 			isIdle = false;
 
 		}
 	}
 
-	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); // Uô
-		canAdjustCameraPos = false;
-	}
-
-	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-		moveAxisZ = true;
-		moveAxisX = false;
-	}
-	else if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-		moveAxisZ = false;
-		moveAxisX = true;
-	}
-
-
 	// pGRAݾʵe
 	if (isIdle) {
 		animator.playAnimation(&animations[0]);
 	}
 
 }
+
+
 void updateCameraPos(float CameraPosXOffset, float CameraPosZOffset ) {
 	//// svV
 	//// ھڷƹʧsvV
@@ -566,8 +1394,9 @@ void updateCameraPos(float CameraPosXOffset, float CameraPosZOffset ) {
 	// TwvmAȧsV
 	
 	// ˬdqO_WLHȡAȦbWLHȮɧsvm
-	if (moveAxisX) cameraPos.x += 0.2f * CameraPosXOffset; // s X bm
-	if (moveAxisZ) cameraPos.z -= 0.2f * CameraPosZOffset; // s Z bm
+	// The simulation moves the camera by the shift on its next step
+	if (moveAxisX) sampledInput.cameraShift.x += 0.2f * CameraPosXOffset; // s X bm
+	if (moveAxisZ) sampledInput.cameraShift.z -= 0.2f * CameraPosZOffset; // s Z bm
 
 }
 
@@ -627,14 +1456,53 @@ std::string getRootPath() {
 	throw std::runtime_error("䤣M׮ڥؿAнT{|]mC");
 }
 
+// Command-line overrides of the toggles above; false on an unknown argument
+bool parseArguments(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless")
+			HEADLESS = true;
+		else if (arg == "--frames" && hasValue)
+			HEADLESS_FRAMES = std::max(1, atoi(argv[++i]));
+		else if (arg == "--dump-every" && hasValue)
+			HEADLESS_DUMP_INTERVAL = std::max(0, atoi(argv[++i]));
+		else {
+			std::cout << "Unknown argument " << arg << "; usage: hw4 [--headless] [--frames N] [--dump-every N]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 //榸ե
 static void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	// Summarize every frame statistics channel now, not only at exit
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		std::cout << std::endl;
+		frameStats.print();
+		return;
+	}
+
+	// Start recording, or stop and write everything recorded so far
+	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		setProfiling(!profiling());
+		if (!profiling()) {
+			if (profiler().writeChromeTrace(PROFILE_TRACE_FILE))
+				std::cout << std::endl << "Profile trace written to " << PROFILE_TRACE_FILE << std::endl;
+			else
+				std::cout << std::endl << "Could not write " << PROFILE_TRACE_FILE << std::endl;
+		}
+		return;
+	}
+
 	if (key == GLFW_KEY_F && action == GLFW_PRESS) {
 		stateA = !stateA;
 		StateB = !StateB;
 		
-		animator.playAnimation(animationA);
+		// The simulation restarts animationA on its next step
+		sampledInput.blendToggles++;
 		return;
 	}
 
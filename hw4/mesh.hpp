@@ -4,6 +4,18 @@
 #include <vector>
 #include <glm/glm.hpp>
 
+const int MAX_BONE_INFLUENCE = 4;
+
+// A simplified level of detail: a new index list over the same vertices as the full mesh
+struct MeshLod
+{
+	std::vector<unsigned int> indices;
+	// Influence buckets of this level, see Mesh::influenceOffsets
+	unsigned int influenceOffsets[MAX_BONE_INFLUENCE + 1] = { 0 };
+	// Largest simplification error of the level, in mesh units
+	float error = 0.0f;
+};
+
 struct Mesh
 {
 	std::vector<glm::vec3> vertices;
@@ -15,6 +27,59 @@ struct Mesh
 	std::vector<glm::vec4> weights;
 
 	std::vector<unsigned int> indices;
+
+	// Triangles are sorted by the number of bone influences their vertices need. Bucket k
+	// (1..MAX_BONE_INFLUENCE) spans indices [influenceOffsets[k - 1], influenceOffsets[k]).
+	unsigned int influenceOffsets[MAX_BONE_INFLUENCE + 1] = { 0 };
+
+	// Coarser levels of detail, finest first; the full mesh above is level 0
+	std::vector<MeshLod> lods;
 };
 
+// Per-triangle tangent frame from the UV layout of non-indexed triangles
+inline void computeTangentBasis(
+	std::vector<glm::vec3>& vertices,
+	std::vector<glm::vec2>& uvs,
+	std::vector<glm::vec3>& normals,
+	std::vector<glm::vec3>& tangents,
+	std::vector<glm::vec3>& bitangents)
+{
+	for (size_t i = 0; i < vertices.size() - 2; i += 3)
+	{
+
+		// Shortcuts for vertices
+		glm::vec3& v0 = vertices[i + 0];
+		glm::vec3& v1 = vertices[i + 1];
+		glm::vec3& v2 = vertices[i + 2];
+
+		// Shortcuts for UVs
+		glm::vec2& uv0 = uvs[i + 0];
+		glm::vec2& uv1 = uvs[i + 1];
+		glm::vec2& uv2 = uvs[i + 2];
+
+		// Edges of the triangle : position delta
+		glm::vec3 deltaPos1 = v1 - v0;
+		glm::vec3 deltaPos2 = v2 - v0;
+
+		// UV delta
+		glm::vec2 deltaUV1 = uv1 - uv0;
+		glm::vec2 deltaUV2 = uv2 - uv0;
+
+		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+		glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
+		glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
+
+		// Set the same tangent for all three vertices of the triangle.
+		// They will be merged later, in vboindexer.cpp
+		tangents.push_back(tangent);
+		tangents.push_back(tangent);
+		tangents.push_back(tangent);
+
+		// Same thing for bitangents
+		bitangents.push_back(bitangent);
+		bitangents.push_back(bitangent);
+		bitangents.push_back(bitangent);
+	}
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+﻿#ifndef MESHIMPORT_HPP
+#define MESHIMPORT_HPP
+
+#include <glm/glm.hpp>
+#include <assimp/scene.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mesh.hpp"
+#include "meshoptimize.hpp"
+#include "profiler.hpp"
+#include "skeleton.hpp"
+
+// The GL-free half of Model::processMesh: turning an assimp mesh into a Mesh with its skin. Model
+// adds materials and LODs on top.
+
+// Influences below this weight are dropped before the remaining ones are renormalized
+const float MIN_BONE_WEIGHT = 0.01f;
+
+// Positions, normals, texture coordinates, tangents and indices, with every bone slot empty
+inline Mesh importMeshGeometry(const aiMesh* mesh)
+{
+	// Mesh to fill with data
+	Mesh m;
+
+	// Loop all vertices in loaded mesh
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		glm::ivec4 boneIDs;
+		glm::vec4 weights;
+
+		// Set default values
+		for (int i = 0; i < 4; i++)
+		{
+			boneIDs[i] = -1;
+			weights[i] = 0.0f;
+		}
+
+		m.boneIDs.push_back(boneIDs);
+		m.weights.push_back(weights);
+
+		glm::vec3 vector;
+		// Set positions
+		vector.x = mesh->mVertices[i].x;
+		vector.y = mesh->mVertices[i].y;
+		vector.z = mesh->mVertices[i].z;
+		m.vertices.push_back(vector);
+
+		if (mesh->HasNormals())
+		{
+			// Set normals
+			vector.x = mesh->mNormals[i].x;
+			vector.y = mesh->mNormals[i].y;
+			vector.z = mesh->mNormals[i].z;
+			m.normals.push_back(vector);
+		}
+
+		if (mesh->mTextureCoords[0])
+		{
+			// Set texture coords
+			glm::vec2 vec;
+			vec.x = mesh->mTextureCoords[0][i].x;
+			vec.y = mesh->mTextureCoords[0][i].y;
+			m.textureCoordinates.push_back(vec);
+			if (mesh->HasTangentsAndBitangents()) {
+				// Set tangent
+				vector.x = mesh->mTangents[i].x;
+				vector.y = mesh->mTangents[i].y;
+				vector.z = mesh->mTangents[i].z;
+				m.tangents.push_back(vector);
+				// Set bitangent
+				vector.x = mesh->mBitangents[i].x;
+				vector.y = mesh->mBitangents[i].y;
+				vector.z = mesh->mBitangents[i].z;
+				m.bitangents.push_back(vector);
+			}
+		}
+	}
+	// Set indices
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+			m.indices.push_back(face.mIndices[j]);
+	}
+
+	return m;
+}
+
+// Bones of the mesh missing from boneProps are appended to it
+inline void extractBoneWeightForVertices(std::vector<glm::ivec4>& boneIDs_all, std::vector<glm::vec4>& weights_all, const aiMesh* mesh, std::vector<BoneProps>& boneProps)
+{
+	std::map<std::string, int> boneNameToID; // 快速查找骨骼名稱到索引的映射
+	// Every (boneID, weight) pair per vertex; only the largest ones are kept below
+	std::vector<std::vector<std::pair<int, float>>> influences(boneIDs_all.size());
+
+	// 初始化 boneNameToID
+	for (unsigned int i = 0; i < boneProps.size(); ++i) {
+		boneNameToID[boneProps[i].name] = i;
+	}
+
+	//std::cout << "Bone names in the model: " << std::endl;
+	for (unsigned int i = 0; i < mesh->mNumBones; ++i) {
+		std::string boneName = mesh->mBones[i]->mName.C_Str();
+		//std::cout << "Bone " << i << ": " << boneName << std::endl;
+
+		int boneID = -1;
+
+		// 使用骨骼名稱查找索引
+		if (boneNameToID.find(boneName) != boneNameToID.end()) {
+			boneID = boneNameToID[boneName];
+		}
+		else {
+			// 如果名稱不存在，添加新骨骼並更新映射
+			boneProps.push_back({ boneName, aiMatrix4x4ToGlm(&mesh->mBones[i]->mOffsetMatrix) });
+			boneID = boneProps.size() - 1;
+			boneNameToID[boneName] = boneID; // 更新映射
+		}
+
+		// 驗證 boneID
+		if (boneID == -1) {
+			std::cerr << "Warning: Bone " << boneName << " not found or invalid!" << std::endl;
+			continue;
+		}
+
+
+		// 處理頂點權重
+		aiVertexWeight* weights = mesh->mBones[i]->mWeights;
+		unsigned int numWeights = mesh->mBones[i]->mNumWeights;
+
+		for (unsigned int weightIndex = 0; weightIndex < numWeights; ++weightIndex) {
+			unsigned int vertexId = weights[weightIndex].mVertexId;
+			float weight = weights[weightIndex].mWeight;
+
+			if (vertexId >= boneIDs_all.size()) {
+				std::cerr << "Error: Vertex ID " << vertexId << " out of range!" << std::endl;
+				continue;
+			}
+
+			influences[vertexId].push_back({ boneID, weight });
+		}
+	}
+
+	// Keep the top MAX_BONE_INFLUENCE weights, prune tiny ones and renormalize.
+	// Slots are filled largest first, so a vertex with k influences uses slots 0..k-1.
+	for (size_t vertexId = 0; vertexId < influences.size(); ++vertexId) {
+		auto& list = influences[vertexId];
+		size_t keep = std::min(list.size(), (size_t)MAX_BONE_INFLUENCE);
+		std::partial_sort(list.begin(), list.begin() + keep, list.end(),
+			[](const std::pair<int, float>& a, const std::pair<int, float>& b) { return a.second > b.second; });
+
+		float total = 0.0f;
+		size_t used = 0;
+		for (size_t j = 0; j < keep; ++j) {
+			if (list[j].second < MIN_BONE_WEIGHT && j > 0)
+				break;
+			total += list[j].second;
+			used++;
+		}
+
+		for (size_t j = 0; j < used; ++j) {
+			boneIDs_all[vertexId][j] = list[j].first;
+			weights_all[vertexId][j] = total > 0.0f ? list[j].second / total : 0.0f;
+		}
+	}
+}
+
+// Everything Model::processMesh does to a mesh short of materials and LODs: geometry, skin weights,
+// influence buckets and, with optimize, welding and cache ordering. stats is only filled when
+// optimizing.
+inline Mesh importMesh(const aiMesh* mesh, std::vector<BoneProps>& boneProps, bool optimize, MeshOptimizationStats& stats)
+{
+	Mesh m = importMeshGeometry(mesh);
+
+	// Load boneIDs and weights for each vertex
+	extractBoneWeightForVertices(m.boneIDs, m.weights, mesh, boneProps);
+
+	// Group triangles by influence count so each group is drawn with a specialized shader
+	bucketByInfluenceCount(m);
+
+	// Weld and reorder only after the skin data is in place, it is part of the vertex identity
+	if (optimize)
+	{
+		PROFILE_SCOPE("Optimize mesh");
+		stats = optimizeMesh(m);
+	}
+	return m;
+}
+
+#endif
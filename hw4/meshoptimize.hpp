@@ -0,0 +1,371 @@
+#ifndef MESHOPTIMIZE_HPP
+#define MESHOPTIMIZE_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Import-time mesh optimization: vertex welding, Forsyth post-transform cache ordering and
+// fetch-order vertex reordering.
+
+struct MeshOptimizationStats
+{
+	size_t verticesBefore;
+	size_t verticesAfter;
+	float acmrBefore;
+	float acmrAfter;
+};
+
+// Average cache miss ratio (transformed vertices per triangle) for a FIFO cache of the given size
+float computeACMR(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = 16)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+
+	std::vector<unsigned int> cacheTimestamp(vertexCount, 0);
+	unsigned int timestamp = cacheSize + 1;
+	unsigned int misses = 0;
+
+	for (unsigned int index : indices)
+	{
+		// A vertex is resident if it was pushed less than cacheSize misses ago
+		if (timestamp - cacheTimestamp[index] > cacheSize)
+		{
+			cacheTimestamp[index] = timestamp++;
+			misses++;
+		}
+	}
+	return (float)misses / (float)(indices.size() / 3);
+}
+
+// Move every per-vertex stream to its new slot. remap[old] is the new index, or ~0u for dropped vertices.
+template <class T>
+void remapStream(std::vector<T>& stream, const std::vector<unsigned int>& remap, size_t newCount)
+{
+	if (stream.empty())
+		return;
+	std::vector<T> result(newCount);
+	for (size_t i = 0; i < remap.size(); i++)
+	{
+		if (remap[i] != ~0u)
+			result[remap[i]] = stream[i];
+	}
+	stream.swap(result);
+}
+
+void remapMesh(Mesh& mesh, const std::vector<unsigned int>& remap, size_t newCount)
+{
+	remapStream(mesh.vertices, remap, newCount);
+	remapStream(mesh.normals, remap, newCount);
+	remapStream(mesh.textureCoordinates, remap, newCount);
+	remapStream(mesh.tangents, remap, newCount);
+	remapStream(mesh.bitangents, remap, newCount);
+	remapStream(mesh.boneIDs, remap, newCount);
+	remapStream(mesh.weights, remap, newCount);
+
+	for (unsigned int& index : mesh.indices)
+		index = remap[index];
+}
+
+// Every attribute a vertex carries, compared bit for bit. Tangents are part of the key so
+// welding never changes shading.
+struct WeldKey
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+	glm::ivec4 boneIDs;
+	glm::vec4 weights;
+
+	bool operator==(const WeldKey& other) const
+	{
+		return memcmp(this, &other, sizeof(WeldKey)) == 0;
+	}
+};
+
+struct WeldKeyHash
+{
+	size_t operator()(const WeldKey& key) const
+	{
+		// FNV-1a over the raw bytes
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(WeldKey); i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return (size_t)hash;
+	}
+};
+
+// Merge vertices that are identical in position, normal, UV, tangent frame and skin data
+void weldVertices(Mesh& mesh)
+{
+	const size_t vertexCount = mesh.vertices.size();
+	std::unordered_map<WeldKey, unsigned int, WeldKeyHash> unique;
+	unique.reserve(vertexCount);
+	std::vector<unsigned int> remap(vertexCount);
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		WeldKey key;
+		memset(&key, 0, sizeof(WeldKey));
+		key.position = mesh.vertices[i];
+		if (i < mesh.normals.size()) key.normal = mesh.normals[i];
+		if (i < mesh.textureCoordinates.size()) key.uv = mesh.textureCoordinates[i];
+		if (i < mesh.tangents.size()) key.tangent = mesh.tangents[i];
+		if (i < mesh.bitangents.size()) key.bitangent = mesh.bitangents[i];
+		if (i < mesh.boneIDs.size()) key.boneIDs = mesh.boneIDs[i];
+		if (i < mesh.weights.size()) key.weights = mesh.weights[i];
+
+		auto inserted = unique.insert({ key, (unsigned int)unique.size() });
+		remap[i] = inserted.first->second;
+	}
+
+	// Several old vertices share a new slot; remapStream keeps the last copy, which is identical
+	remapMesh(mesh, remap, unique.size());
+}
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+const int FORSYTH_CACHE_SIZE = 32;
+
+float forsythVertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// The last triangle's vertices score the same regardless of order
+			score = 0.75f;
+		}
+		else
+		{
+			const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = powf(1.0f - (cachePosition - 3) * scaler, 1.5f);
+		}
+	}
+
+	// Boost vertices with few triangles left so they get finished and leave the working set
+	score += 2.0f * powf((float)remainingTriangles, -0.5f);
+	return score;
+}
+
+// Reorder the triangles in indices[0, indexCount) for post-transform cache locality
+void optimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Vertex -> triangle adjacency; the first remaining[v] entries of a vertex's range are still unemitted
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; i++)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(indexCount);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<char> emitted(triangleCount, 0);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> nextCache;
+	cache.reserve(FORSYTH_CACHE_SIZE + 3);
+	nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+	std::vector<unsigned int> result;
+	result.reserve(indexCount);
+
+	size_t scanCursor = 0;
+	long long best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+
+	while (best >= 0)
+	{
+		const unsigned int* tri = &indices[best * 3];
+		emitted[best] = 1;
+		result.insert(result.end(), tri, tri + 3);
+
+		// Drop the triangle from the adjacency of its vertices
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = tri[k];
+			unsigned int* begin = &adjacency[offsets[v]];
+			unsigned int* end = begin + remaining[v];
+			unsigned int* found = std::find(begin, end, (unsigned int)best);
+			std::swap(*found, *(end - 1));
+			remaining[v]--;
+		}
+
+		// LRU update: the emitted triangle's vertices move to the front
+		nextCache.assign(tri, tri + 3);
+		for (unsigned int v : cache)
+		{
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				nextCache.push_back(v);
+		}
+		for (size_t i = 0; i < nextCache.size(); i++)
+		{
+			unsigned int v = nextCache[i];
+			cachePosition[v] = i < (size_t)FORSYTH_CACHE_SIZE ? (int)i : -1;
+			vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// Rescore triangles touching the cache and pick the best of them
+		best = -1;
+		float bestScore = -1.0f;
+		for (unsigned int v : nextCache)
+		{
+			for (unsigned int a = 0; a < remaining[v]; a++)
+			{
+				unsigned int t = adjacency[offsets[v] + a];
+				const unsigned int* other = &indices[t * 3];
+				float score = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+				triangleScore[t] = score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+
+		if (nextCache.size() > (size_t)FORSYTH_CACHE_SIZE)
+			nextCache.resize(FORSYTH_CACHE_SIZE);
+		cache.swap(nextCache);
+
+		// Nothing adjacent to the cache: continue with the first triangle not yet emitted
+		if (best < 0)
+		{
+			while (scanCursor < triangleCount && emitted[scanCursor])
+				scanCursor++;
+			if (scanCursor < triangleCount)
+				best = (long long)scanCursor;
+		}
+	}
+
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+	optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+}
+
+inline int influenceCount(const Mesh& mesh, unsigned int vertex)
+{
+	if (vertex >= mesh.boneIDs.size())
+		return 0;
+	int count = 0;
+	for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+	{
+		if (mesh.boneIDs[vertex][i] >= 0)
+			count++;
+	}
+	return count;
+}
+
+// Stable-sort triangles by the largest influence count among their vertices and record the
+// bucket boundaries in offsets. Unweighted triangles go to bucket 1.
+void bucketIndicesByInfluenceCount(const Mesh& mesh, std::vector<unsigned int>& indices, unsigned int offsets[MAX_BONE_INFLUENCE + 1])
+{
+	const size_t triangleCount = indices.size() / 3;
+	std::vector<unsigned int> buckets[MAX_BONE_INFLUENCE];
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int count = 1;
+		for (int k = 0; k < 3; k++)
+			count = std::max(count, influenceCount(mesh, indices[t * 3 + k]));
+		buckets[count - 1].insert(buckets[count - 1].end(), &indices[t * 3], &indices[t * 3] + 3);
+	}
+
+	indices.clear();
+	offsets[0] = 0;
+	for (int b = 0; b < MAX_BONE_INFLUENCE; b++)
+	{
+		indices.insert(indices.end(), buckets[b].begin(), buckets[b].end());
+		offsets[b + 1] = (unsigned int)indices.size();
+	}
+}
+
+void bucketByInfluenceCount(Mesh& mesh)
+{
+	bucketIndicesByInfluenceCount(mesh, mesh.indices, mesh.influenceOffsets);
+}
+
+// Each bucket is a separate draw, so optimize them independently and keep the boundaries
+void optimizeBucketedVertexCache(std::vector<unsigned int>& indices, const unsigned int offsets[MAX_BONE_INFLUENCE + 1], size_t vertexCount)
+{
+	for (int b = 0; b < MAX_BONE_INFLUENCE; b++)
+		optimizeVertexCache(indices.data() + offsets[b], offsets[b + 1] - offsets[b], vertexCount);
+}
+
+inline bool hasInfluenceBuckets(const Mesh& mesh)
+{
+	return !mesh.indices.empty() && mesh.influenceOffsets[MAX_BONE_INFLUENCE] == mesh.indices.size();
+}
+
+// Renumber vertices in first-use order so fetches walk the vertex buffer linearly
+void optimizeVertexFetch(Mesh& mesh)
+{
+	std::vector<unsigned int> remap(mesh.vertices.size(), ~0u);
+	unsigned int next = 0;
+	for (unsigned int index : mesh.indices)
+	{
+		if (remap[index] == ~0u)
+			remap[index] = next++;
+	}
+	remapMesh(mesh, remap, next);
+}
+
+MeshOptimizationStats optimizeMesh(Mesh& mesh)
+{
+	MeshOptimizationStats stats;
+	stats.verticesBefore = mesh.vertices.size();
+	stats.acmrBefore = computeACMR(mesh.indices, mesh.vertices.size());
+
+	weldVertices(mesh);
+	if (hasInfluenceBuckets(mesh))
+		optimizeBucketedVertexCache(mesh.indices, mesh.influenceOffsets, mesh.vertices.size());
+	else
+	{
+		optimizeVertexCache(mesh.indices, mesh.vertices.size());
+	}
+	optimizeVertexFetch(mesh);
+
+	stats.verticesAfter = mesh.vertices.size();
+	stats.acmrAfter = computeACMR(mesh.indices, mesh.vertices.size());
+	return stats;
+}
+
+#endif
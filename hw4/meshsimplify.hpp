@@ -0,0 +1,455 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.hpp"
+#include "meshoptimize.hpp"
+
+// Import-time LOD generation by quadric error edge collapse (Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics").
+//
+// Vertices are only ever collapsed onto one of their neighbours, never moved or created, so every
+// level indexes the vertex buffer of the full mesh and keeps its UVs, normals and skin data.
+// Vertices on UV or normal seams (several vertices at one position) and on open borders are never
+// removed. Collapses are ranked by the position quadric plus penalties for the normal, UV and
+// bone weight difference between the two vertices.
+
+// Levels generated after the full mesh; each targets half the triangles of the previous one
+const int MAX_MESH_LODS = 3;
+const float LOD_TRIANGLE_RATIO = 0.5f;
+// Simplification stops at this error, relative to the mesh's bounding radius
+const float LOD_MAX_ERROR = 0.05f;
+
+// Attribute differences are converted to distances by these factors times the bounding radius
+const float LOD_NORMAL_WEIGHT = 0.01f;
+const float LOD_UV_WEIGHT = 0.1f;
+const float LOD_SKIN_WEIGHT = 0.05f;
+
+struct LodStats
+{
+	size_t triangles;
+	float error;
+	// error divided by the bounding radius
+	float relativeError;
+};
+
+// Symmetric 4x4 error quadric, accumulated from area-weighted planes
+struct Quadric
+{
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0;
+	double c = 0;
+	double weight = 0;
+
+	void addPlane(const glm::dvec3& n, double d, double w)
+	{
+		a00 += w * n.x * n.x;
+		a01 += w * n.x * n.y;
+		a02 += w * n.x * n.z;
+		a11 += w * n.y * n.y;
+		a12 += w * n.y * n.z;
+		a22 += w * n.z * n.z;
+		b0 += w * n.x * d;
+		b1 += w * n.y * d;
+		b2 += w * n.z * d;
+		c += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02;
+		a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		weight += q.weight;
+	}
+
+	// Mean squared distance from p to the accumulated planes
+	double evaluate(const glm::vec3& p) const
+	{
+		if (weight <= 0.0)
+			return 0.0;
+		double x = p.x, y = p.y, z = p.z;
+		double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return std::max(e, 0.0) / weight;
+	}
+};
+
+inline void meshBounds(const Mesh& mesh, glm::vec3& minimum, glm::vec3& maximum)
+{
+	minimum = glm::vec3(1e30f);
+	maximum = glm::vec3(-1e30f);
+	for (const glm::vec3& v : mesh.vertices)
+	{
+		minimum = glm::min(minimum, v);
+		maximum = glm::max(maximum, v);
+	}
+}
+
+inline float meshBoundingRadius(const Mesh& mesh)
+{
+	if (mesh.vertices.empty())
+		return 0.0f;
+	glm::vec3 minimum, maximum;
+	meshBounds(mesh, minimum, maximum);
+	glm::vec3 center = (minimum + maximum) * 0.5f;
+	float radius = 0.0f;
+	for (const glm::vec3& v : mesh.vertices)
+		radius = std::max(radius, glm::length(v - center));
+	return radius;
+}
+
+// Squared distance between the skin weights of two vertices, comparing weights of the same bone
+inline float skinDistance2(const Mesh& mesh, unsigned int a, unsigned int b)
+{
+	if (a >= mesh.boneIDs.size() || b >= mesh.boneIDs.size())
+		return 0.0f;
+	float distance = 0.0f;
+	for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+	{
+		int bone = mesh.boneIDs[a][i];
+		if (bone < 0)
+			continue;
+		float other = 0.0f;
+		for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+		{
+			if (mesh.boneIDs[b][j] == bone)
+				other = mesh.weights[b][j];
+		}
+		distance += (mesh.weights[a][i] - other) * (mesh.weights[a][i] - other);
+	}
+	for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+	{
+		int bone = mesh.boneIDs[b][j];
+		if (bone < 0)
+			continue;
+		bool shared = false;
+		for (int i = 0; i < MAX_BONE_INFLUENCE; i++)
+			shared = shared || mesh.boneIDs[a][i] == bone;
+		if (!shared)
+			distance += mesh.weights[b][j] * mesh.weights[b][j];
+	}
+	return distance;
+}
+
+// Progressive simplifier over one mesh. Each call to simplify continues from the previous result,
+// so successive levels nest and their errors only grow.
+class MeshSimplifier
+{
+public:
+	explicit MeshSimplifier(const Mesh& source) : mesh(source), indices(source.indices)
+	{
+		radius = meshBoundingRadius(mesh);
+		classifyVertices();
+		buildQuadrics();
+	}
+
+	const std::vector<unsigned int>& getIndices() const { return indices; }
+
+	// Largest accepted collapse error so far, in mesh units
+	float getError() const { return (float)sqrt(maxError2); }
+
+	float getRadius() const { return radius; }
+
+	// Collapse edges until at most targetTriangles remain or every collapse would exceed maxError
+	void simplify(size_t targetTriangles, float maxError)
+	{
+		const double limit2 = (double)maxError * maxError;
+		size_t triangles = indices.size() / 3;
+
+		while (triangles > targetTriangles)
+		{
+			buildAdjacency();
+
+			// Cheapest valid collapse for every removable vertex
+			std::vector<Collapse> collapses;
+			for (unsigned int u = 0; u < (unsigned int)mesh.vertices.size(); u++)
+			{
+				if (locked[u] || triangleStart[u] == triangleStart[u + 1])
+					continue;
+				Collapse best = { u, 0, 1e30, 1e30 };
+				for (unsigned int k = triangleStart[u]; k < triangleStart[u + 1]; k++)
+				{
+					unsigned int t = vertexTriangles[k];
+					for (int e = 0; e < 3; e++)
+					{
+						unsigned int v = indices[t * 3 + e];
+						if (v == u)
+							continue;
+						double error2 = collapseError2(u, v);
+						double cost = error2 * quadrics[positionIDs[u]].weight;
+						if (cost < best.cost && error2 <= limit2 && !flipsTriangles(u, v))
+							best = { u, v, cost, error2 };
+					}
+				}
+				if (best.cost < 1e30)
+					collapses.push_back(best);
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end(),
+				[](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			// Apply independent collapses only: nothing around u may change twice within a pass
+			std::vector<unsigned int> remap(mesh.vertices.size());
+			for (unsigned int i = 0; i < remap.size(); i++)
+				remap[i] = i;
+			std::vector<bool> touched(mesh.vertices.size(), false);
+			size_t applied = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (triangles <= targetTriangles)
+					break;
+				if (touched[collapse.u] || touched[collapse.v])
+					continue;
+				for (unsigned int k = triangleStart[collapse.u]; k < triangleStart[collapse.u + 1]; k++)
+				{
+					unsigned int t = vertexTriangles[k];
+					for (int e = 0; e < 3; e++)
+						touched[indices[t * 3 + e]] = true;
+				}
+				remap[collapse.u] = collapse.v;
+				quadrics[positionIDs[collapse.v]].add(quadrics[positionIDs[collapse.u]]);
+				maxError2 = std::max(maxError2, collapse.error2);
+				triangles -= sharedTriangles(collapse.u, collapse.v);
+				applied++;
+			}
+			if (applied == 0)
+				break;
+
+			// Rewrite the index list, dropping triangles that became degenerate
+			size_t write = 0;
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+				if (a == b || b == c || a == c)
+					continue;
+				indices[write++] = a;
+				indices[write++] = b;
+				indices[write++] = c;
+			}
+			indices.resize(write);
+			triangles = indices.size() / 3;
+		}
+	}
+
+private:
+	struct Collapse
+	{
+		unsigned int u;
+		unsigned int v;
+		double cost;
+		double error2;
+	};
+
+	const Mesh& mesh;
+	std::vector<unsigned int> indices;
+	float radius = 0.0f;
+	double maxError2 = 0.0;
+
+	// Vertices sharing a position share an ID and a quadric
+	std::vector<unsigned int> positionIDs;
+	std::vector<Quadric> quadrics;
+	std::vector<bool> locked;
+
+	// Triangles around each vertex of the current index list (CSR)
+	std::vector<unsigned int> triangleStart;
+	std::vector<unsigned int> vertexTriangles;
+
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+		}
+	};
+
+	void classifyVertices()
+	{
+		const size_t vertexCount = mesh.vertices.size();
+		positionIDs.resize(vertexCount);
+		std::unordered_map<glm::vec3, unsigned int, PositionHash> firstAtPosition;
+		std::vector<unsigned int> verticesAtPosition(vertexCount, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			auto inserted = firstAtPosition.emplace(mesh.vertices[v], v);
+			positionIDs[v] = inserted.first->second;
+			verticesAtPosition[positionIDs[v]]++;
+		}
+
+		// Seams: the position carries more than one vertex
+		locked.assign(vertexCount, false);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			locked[v] = verticesAtPosition[positionIDs[v]] > 1;
+
+		// Borders and non-manifold edges: a position edge not used by exactly two triangles
+		std::unordered_map<uint64_t, unsigned int> edgeUses;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+				edgeUses[edgeKey(indices[i + e], indices[i + (e + 1) % 3])]++;
+		}
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				unsigned int a = indices[i + e], b = indices[i + (e + 1) % 3];
+				if (edgeUses[edgeKey(a, b)] != 2)
+				{
+					locked[a] = true;
+					locked[b] = true;
+				}
+			}
+		}
+		// Seam vertices are locked above, so locking by vertex is the same as by position
+	}
+
+	uint64_t edgeKey(unsigned int a, unsigned int b) const
+	{
+		uint64_t pa = positionIDs[a], pb = positionIDs[b];
+		return pa < pb ? (pa << 32) | pb : (pb << 32) | pa;
+	}
+
+	void buildQuadrics()
+	{
+		quadrics.assign(mesh.vertices.size(), Quadric());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			glm::dvec3 p0 = mesh.vertices[indices[i]];
+			glm::dvec3 p1 = mesh.vertices[indices[i + 1]];
+			glm::dvec3 p2 = mesh.vertices[indices[i + 2]];
+			glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			double length = glm::length(normal);
+			if (length <= 0.0)
+				continue;
+			normal /= length;
+			double area = length * 0.5;
+			double d = -glm::dot(normal, p0);
+			for (int k = 0; k < 3; k++)
+				quadrics[positionIDs[indices[i + k]]].addPlane(normal, d, area);
+		}
+	}
+
+	void buildAdjacency()
+	{
+		const size_t vertexCount = mesh.vertices.size();
+		triangleStart.assign(vertexCount + 1, 0);
+		for (unsigned int index : indices)
+			triangleStart[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			triangleStart[v + 1] += triangleStart[v];
+
+		vertexTriangles.resize(indices.size());
+		std::vector<unsigned int> fill(triangleStart.begin(), triangleStart.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			vertexTriangles[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	// Squared error of moving u onto v: plane distance plus attribute differences as distances
+	double collapseError2(unsigned int u, unsigned int v) const
+	{
+		double error2 = quadrics[positionIDs[u]].evaluate(mesh.vertices[v]);
+		double scale2 = (double)radius * radius;
+		if (u < mesh.normals.size() && v < mesh.normals.size())
+		{
+			glm::vec3 d = mesh.normals[u] - mesh.normals[v];
+			error2 += glm::dot(d, d) * LOD_NORMAL_WEIGHT * LOD_NORMAL_WEIGHT * scale2;
+		}
+		if (u < mesh.textureCoordinates.size() && v < mesh.textureCoordinates.size())
+		{
+			glm::vec2 d = mesh.textureCoordinates[u] - mesh.textureCoordinates[v];
+			error2 += glm::dot(d, d) * LOD_UV_WEIGHT * LOD_UV_WEIGHT * scale2;
+		}
+		error2 += skinDistance2(mesh, u, v) * LOD_SKIN_WEIGHT * LOD_SKIN_WEIGHT * scale2;
+		return error2;
+	}
+
+	// Would moving u onto v fold over or collapse any triangle that keeps both of its other corners?
+	bool flipsTriangles(unsigned int u, unsigned int v) const
+	{
+		for (unsigned int k = triangleStart[u]; k < triangleStart[u + 1]; k++)
+		{
+			const unsigned int* triangle = &indices[vertexTriangles[k] * 3];
+			if (triangle[0] == v || triangle[1] == v || triangle[2] == v)
+				continue;
+			glm::vec3 before[3], after[3];
+			for (int e = 0; e < 3; e++)
+			{
+				before[e] = mesh.vertices[triangle[e]];
+				after[e] = triangle[e] == u ? mesh.vertices[v] : before[e];
+			}
+			glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+			float l0 = glm::length(n0), l1 = glm::length(n1);
+			if (l1 <= 1e-12f || glm::dot(n0, n1) < 0.2f * l0 * l1)
+				return true;
+		}
+		return false;
+	}
+
+	size_t sharedTriangles(unsigned int u, unsigned int v) const
+	{
+		size_t shared = 0;
+		for (unsigned int k = triangleStart[u]; k < triangleStart[u + 1]; k++)
+		{
+			const unsigned int* triangle = &indices[vertexTriangles[k] * 3];
+			if (triangle[0] == v || triangle[1] == v || triangle[2] == v)
+				shared++;
+		}
+		return shared;
+	}
+};
+
+// Fill mesh.lods with up to MAX_MESH_LODS simplified levels. Each level is bucketed by influence
+// count and cache-optimized like the full mesh. Call after optimizeMesh so the vertex order is final.
+std::vector<LodStats> generateMeshLods(Mesh& mesh)
+{
+	std::vector<LodStats> stats;
+	mesh.lods.clear();
+	if (mesh.indices.size() < 3 * 64)
+		return stats;
+
+	MeshSimplifier simplifier(mesh);
+	const float maxError = LOD_MAX_ERROR * simplifier.getRadius();
+	size_t previousTriangles = mesh.indices.size() / 3;
+	for (int level = 0; level < MAX_MESH_LODS; level++)
+	{
+		simplifier.simplify((size_t)(previousTriangles * LOD_TRIANGLE_RATIO), maxError);
+		size_t triangles = simplifier.getIndices().size() / 3;
+		// Not worth a level of its own
+		if (triangles == 0 || triangles > previousTriangles * 0.9)
+			break;
+
+		MeshLod lod;
+		lod.indices = simplifier.getIndices();
+		lod.error = simplifier.getError();
+		if (hasInfluenceBuckets(mesh))
+		{
+			bucketIndicesByInfluenceCount(mesh, lod.indices, lod.influenceOffsets);
+			optimizeBucketedVertexCache(lod.indices, lod.influenceOffsets, mesh.vertices.size());
+		}
+		else
+		{
+			optimizeVertexCache(lod.indices, mesh.vertices.size());
+		}
+		mesh.lods.push_back(lod);
+
+		float radius = simplifier.getRadius();
+		stats.push_back({ triangles, lod.error, radius > 0.0f ? lod.error / radius : 0.0f });
+		previousTriangles = triangles;
+	}
+	return stats;
+}
+
+#endif
@@ -5,28 +5,27 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "mesh.hpp"
+#include "meshimport.hpp"
+#include "meshoptimize.hpp"
+#include "meshsimplify.hpp"
+#include "profiler.hpp"
+#include "skeleton.hpp"
+#include "texturemanager.hpp"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <algorithm>
 #include <vector>
 using namespace std;
 
-struct BoneProps
-{
-	string name;
-	glm::mat4 offset;
-};
-
 enum TextureType { DIFFUSE, NORMAL, SPECULAR, HEIGHT };
 
 struct TextureOverride
@@ -36,8 +35,20 @@ struct TextureOverride
 	string path;
 };
 
-unsigned int textureFromFile(const char* path, const string& directory, bool gamma);
-static glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from);
+// Block format the cook uses for each kind of map: normals keep two channels (z is rebuilt in the
+// shader), specular and height keep one
+inline TextureCompression compressionFor(TextureType type)
+{
+	switch (type)
+	{
+	case NORMAL: return COMPRESS_BC5;
+	case SPECULAR: return COMPRESS_BC4;
+	case HEIGHT: return COMPRESS_BC4;
+	default: return COMPRESS_BC7;
+	}
+}
+
+unsigned int textureFromFile(const char* path, const string& directory, bool gamma, TextureCompression compression = COMPRESS_NONE);
 
 class Model
 {
@@ -45,6 +56,12 @@ public:
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	// Weld duplicate vertices and reorder triangles/vertices for the GPU caches at import
+	bool optimizeMeshes;
+	// Cook textures to GPU block formats, see compressionFor
+	bool compressTextures;
+	// Build simplified levels of detail for every mesh, see meshsimplify.hpp
+	bool generateLods;
 	vector<TextureOverride> overrides;
 
 	vector<unsigned int> diffuseMaps;
@@ -56,10 +73,14 @@ public:
 
 	int boneCounter = 0;
 
-	Model(string path, vector<TextureOverride> texOver, bool gamma = false) : overrides(texOver), gammaCorrection(gamma)
+	Model(string path, vector<TextureOverride> texOver, bool gamma = false, bool optimize = true, bool compress = true, bool lods = true)
+		: overrides(texOver), gammaCorrection(gamma), optimizeMeshes(optimize), compressTextures(compress), generateLods(lods)
 	{
+		PROFILE_SCOPE("Load model");
 		Assimp::Importer importer;
+		ProfileScope importScope("Import scene");
 		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		importScope.end();
 
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 		{
@@ -72,68 +93,18 @@ public:
 		processNode(scene->mRootNode, scene);
 	}
 
-private:
-
-	void extractBoneWeightForVertices(vector<glm::ivec4>& boneIDs_all, vector<glm::vec4>& weights_all, aiMesh* mesh, const aiScene* scene)
+	// Drop this model's references to its textures; shared ones stay alive for other users
+	void releaseTextures()
 	{
-		std::map<std::string, int> boneNameToID; // 快速查找骨骼名稱到索引的映射
-
-		// 初始化 boneNameToID
-		for (unsigned int i = 0; i < boneProps.size(); ++i) {
-			boneNameToID[boneProps[i].name] = i;
-		}
-
-		//std::cout << "Bone names in the model: " << std::endl;
-		for (unsigned int i = 0; i < mesh->mNumBones; ++i) {
-			std::string boneName = mesh->mBones[i]->mName.C_Str();
-			//std::cout << "Bone " << i << ": " << boneName << std::endl;
-
-			int boneID = -1;
-
-			// 使用骨骼名稱查找索引
-			if (boneNameToID.find(boneName) != boneNameToID.end()) {
-				boneID = boneNameToID[boneName];
-			}
-			else {
-				// 如果名稱不存在，添加新骨骼並更新映射
-				boneProps.push_back({ boneName, aiMatrix4x4ToGlm(&mesh->mBones[i]->mOffsetMatrix) });
-				boneID = boneProps.size() - 1;
-				boneNameToID[boneName] = boneID; // 更新映射
-				boneCounter++;
-			}
-
-			// 驗證 boneID
-			if (boneID == -1) {
-				std::cerr << "Warning: Bone " << boneName << " not found or invalid!" << std::endl;
-				continue;
-			}
-	
-
-			// 處理頂點權重
-			aiVertexWeight* weights = mesh->mBones[i]->mWeights;
-			unsigned int numWeights = mesh->mBones[i]->mNumWeights;
-
-			for (unsigned int weightIndex = 0; weightIndex < numWeights; ++weightIndex) {
-				unsigned int vertexId = weights[weightIndex].mVertexId;
-				float weight = weights[weightIndex].mWeight;
-
-				if (vertexId >= boneIDs_all.size()) {
-					std::cerr << "Error: Vertex ID " << vertexId << " out of range!" << std::endl;
-					continue;
-				}
-
-				// 更新四個骨骼權重
-				for (int j = 0; j < 4; ++j) {
-					if (boneIDs_all[vertexId][j] < 0) { // 空槽位
-						boneIDs_all[vertexId][j] = boneID;
-						weights_all[vertexId][j] = weight;
-						break;
-					}
-				}
-			}
+		for (vector<unsigned int>* maps : { &diffuseMaps, &specularMaps, &normalMaps, &heightMaps })
+		{
+			for (unsigned int id : *maps)
+				textureManager().release(id);
+			maps->clear();
 		}
 	}
 
+private:
 
 	void processNode(aiNode* node, const aiScene* scene)
 	{
@@ -150,70 +121,7 @@ private:
 
 	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
 	{
-		// Mesh to fill with data
-		Mesh m;
-
-		// Loop all vertices in loaded mesh
-		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-		{
-			glm::ivec4 boneIDs;
-			glm::vec4 weights;
-
-			// Set default values
-			for (int i = 0; i < 4; i++)
-			{
-				boneIDs[i] = -1;
-				weights[i] = 0.0f;
-			}
-
-			m.boneIDs.push_back(boneIDs);
-			m.weights.push_back(weights);
-
-			glm::vec3 vector;
-			// Set positions
-			vector.x = mesh->mVertices[i].x;
-			vector.y = mesh->mVertices[i].y;
-			vector.z = mesh->mVertices[i].z;
-			m.vertices.push_back(vector);
-
-			if (mesh->HasNormals())
-			{
-				// Set normals
-				vector.x = mesh->mNormals[i].x;
-				vector.y = mesh->mNormals[i].y;
-				vector.z = mesh->mNormals[i].z;
-				m.normals.push_back(vector);
-			}
-
-			if (mesh->mTextureCoords[0])
-			{
-				// Set texture coords
-				glm::vec2 vec;
-				vec.x = mesh->mTextureCoords[0][i].x;
-				vec.y = mesh->mTextureCoords[0][i].y;
-				m.textureCoordinates.push_back(vec);
-				if (mesh->HasTangentsAndBitangents()) {
-					// Set tangent
-					vector.x = mesh->mTangents[i].x;
-					vector.y = mesh->mTangents[i].y;
-					vector.z = mesh->mTangents[i].z;
-					m.tangents.push_back(vector);
-					// Set bitangent
-					vector.x = mesh->mBitangents[i].x;
-					vector.y = mesh->mBitangents[i].y;
-					vector.z = mesh->mBitangents[i].z;
-					m.bitangents.push_back(vector);
-				}
-			}
-		}
-		// Set indices
-		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-		{
-			aiFace face = mesh->mFaces[i];
-			for (unsigned int j = 0; j < face.mNumIndices; j++)
-				m.indices.push_back(face.mIndices[j]);
-		}
-
+		PROFILE_SCOPE("Process mesh");
 		// Load mesh materials
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
@@ -225,15 +133,15 @@ private:
 		for (unsigned int i = 0; i < overrides.size(); i++) {
 			if (overrides[i].meshIndex == meshes.size()) {
 				if (overrides[i].type == DIFFUSE) {
-					diffuseMaps.push_back(loadCustomTexture(overrides[i].path));
+					diffuseMaps.push_back(loadCustomTexture(overrides[i].path, overrides[i].type));
 					overrideDiffuse = true;
 				}
 				else if (overrides[i].type == NORMAL) {
-					normalMaps.push_back(loadCustomTexture(overrides[i].path));
+					normalMaps.push_back(loadCustomTexture(overrides[i].path, overrides[i].type));
 					overrideNormal = true;
 				}
 				else if (overrides[i].type == SPECULAR) {
-					specularMaps.push_back(loadCustomTexture(overrides[i].path));
+					specularMaps.push_back(loadCustomTexture(overrides[i].path, overrides[i].type));
 					overrideSpecular = true;
 				}
 			}
@@ -241,25 +149,44 @@ private:
 
 		// 1. diffuse maps
 		if (!overrideDiffuse)
-			diffuseMaps.push_back(loadMaterialTextures(material, aiTextureType_DIFFUSE));
+			diffuseMaps.push_back(loadMaterialTextures(material, aiTextureType_DIFFUSE, DIFFUSE));
 		// 2. specular maps
 		if (!overrideSpecular)
-			specularMaps.push_back(loadMaterialTextures(material, aiTextureType_SPECULAR));
+			specularMaps.push_back(loadMaterialTextures(material, aiTextureType_SPECULAR, SPECULAR));
 		// 3. normal maps
 		if (!overrideNormal)
-			normalMaps.push_back(loadMaterialTextures(material, aiTextureType_HEIGHT));
+			normalMaps.push_back(loadMaterialTextures(material, aiTextureType_HEIGHT, NORMAL));
 		// 4. height maps
-		heightMaps.push_back(loadMaterialTextures(material, aiTextureType_AMBIENT));
+		heightMaps.push_back(loadMaterialTextures(material, aiTextureType_AMBIENT, HEIGHT));
+
+		// Geometry, skin weights, influence buckets and cache optimization, see meshimport.hpp
+		MeshOptimizationStats stats;
+		Mesh m = importMesh(mesh, boneProps, optimizeMeshes, stats);
+		boneCounter = (int)boneProps.size();
+
+		cout << "Processed " << mesh->mNumBones << " bones, triangle count: " << mesh->mNumVertices << endl;
 
-		// Load boneIDs and weights for each vertex
-		extractBoneWeightForVertices(m.boneIDs, m.weights, mesh, scene);
+		if (optimizeMeshes)
+		{
+			cout << "Optimized mesh " << meshes.size() << ": vertices " << stats.verticesBefore << " -> " << stats.verticesAfter
+				<< ", ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter << endl;
+		}
 
-		cout << "Processed " << mesh->mNumBones << " bones, triangle count: " << m.boneIDs.size() << endl;
+		// Levels index the final vertex buffer, so they are built last
+		if (generateLods)
+		{
+			PROFILE_SCOPE("Generate LODs");
+			vector<LodStats> lodStats = generateMeshLods(m);
+			cout << "LODs for mesh " << meshes.size() << ": 0: " << m.indices.size() / 3 << " triangles" << endl;
+			for (size_t i = 0; i < lodStats.size(); i++)
+				cout << "  " << i + 1 << ": " << lodStats[i].triangles << " triangles, error " << lodStats[i].error
+					<< " (" << lodStats[i].relativeError * 100.0f << "% of radius)" << endl;
+		}
 
 		return m;
 	}
 
-	unsigned int loadMaterialTextures(aiMaterial* mat, aiTextureType type)
+	unsigned int loadMaterialTextures(aiMaterial* mat, aiTextureType type, TextureType usage)
 	{
 		unsigned int id = -1;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
@@ -268,7 +195,7 @@ private:
 			mat->GetTexture(type, i, &str);
 			std::string texturePath = str.C_Str();
 			cout << "Loaded texture: " << str.C_Str() << endl;
-			id = textureFromFile(str.C_Str(), this->directory, false);
+			id = textureFromFile(str.C_Str(), this->directory, false, compressTextures ? compressionFor(usage) : COMPRESS_NONE);
 
 			if (id == 0) { 
 				std::cerr << "Warning: Texture failed to load at path: " << texturePath << std::endl;
@@ -282,62 +209,19 @@ private:
 		return id;
 	}
 
-	unsigned int loadCustomTexture(string path)
+	unsigned int loadCustomTexture(string path, TextureType usage)
 	{
 		cout << "Loaded custom texture: " << path.c_str() << endl;
-		return textureFromFile(path.c_str(), this->directory, false);
+		return textureFromFile(path.c_str(), this->directory, false, compressTextures ? compressionFor(usage) : COMPRESS_NONE);
 	}
 };
 
-unsigned int textureFromFile(const char* path, const string& directory, bool gamma)
-{
-	string filename = string(path);
-	filename = directory + '/' + filename;
-
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format = GL_RGB;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-		return 0; // 返回 0 表示失敗
-	}
-
-	return textureID;
-}
-
-static glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from)
+// Textures go through the shared cache, so every mesh and model instance using the same file gets the same GL texture
+unsigned int textureFromFile(const char* path, const string& directory, bool gamma, TextureCompression compression)
 {
-	glm::mat4 to;
-	to[0][0] = from->a1; to[1][0] = from->a2; to[2][0] = from->a3; to[3][0] = from->a4;
-	to[0][1] = from->b1; to[1][1] = from->b2; to[2][1] = from->b3; to[3][1] = from->b4;
-	to[0][2] = from->c1; to[1][2] = from->c2; to[2][2] = from->c3; to[3][2] = from->c4;
-	to[0][3] = from->d1; to[1][3] = from->d2; to[2][3] = from->d3; to[3][3] = from->d4;
-	return to;
+	SamplerSettings sampler;
+	sampler.gamma = gamma;
+	return textureManager().acquire(path, directory, sampler, compression);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef PRESKIN_HPP
+#define PRESKIN_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "cpuskin.hpp"
+#include "scene.hpp"
+
+// Pre-skinning: skin.vert skins every vertex of a character once per frame and transform feedback
+// writes the result to a buffer. The shadow and main passes then draw that buffer through a second
+// VAO with the PRESKINNED shader variants, which do no skinning of their own. cpuSkinNode fills the
+// same buffers on the CPU instead.
+
+const std::vector<const char*> SKIN_VARYINGS = { "skinnedPosition", "skinnedNormal" };
+const unsigned int SKINNED_NORMAL_LOCATION = 7;
+
+struct PreskinStats
+{
+	unsigned int skinned = 0;
+	unsigned int reused = 0;
+};
+
+// GL_DYNAMIC_COPY for transform feedback, GL_DYNAMIC_DRAW when the CPU skinner writes the buffer
+unsigned int generateSkinBuffer(size_t vertexCount, GLenum usage = GL_DYNAMIC_COPY)
+{
+	unsigned int bufferID;
+	glGenBuffers(1, &bufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+	glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(SkinnedVertex), nullptr, usage);
+	return bufferID;
+}
+
+// A copy of sourceVAO's attributes and element buffer, except that the position (location 0) and
+// the skinned normal (SKINNED_NORMAL_LOCATION) come from skinBuffer. Works for both vertex layouts.
+unsigned int generateSkinnedVAO(unsigned int sourceVAO, unsigned int skinBuffer)
+{
+	struct Attribute
+	{
+		GLint enabled, buffer, size, type, normalized, integer, stride;
+		void* pointer;
+	};
+
+	GLint attributeCount;
+	glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &attributeCount);
+	std::vector<Attribute> attributes(attributeCount);
+
+	glBindVertexArray(sourceVAO);
+	GLint elementBuffer;
+	glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elementBuffer);
+	for (GLint i = 0; i < attributeCount; i++)
+	{
+		Attribute& a = attributes[i];
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &a.enabled);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &a.buffer);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &a.size);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &a.type);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &a.normalized);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &a.integer);
+		glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &a.stride);
+		glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER, &a.pointer);
+	}
+
+	unsigned int vaoID;
+	glGenVertexArrays(1, &vaoID);
+	glBindVertexArray(vaoID);
+	for (GLint i = 1; i < attributeCount; i++)
+	{
+		const Attribute& a = attributes[i];
+		if (!a.enabled || i == (GLint)SKINNED_NORMAL_LOCATION)
+			continue;
+		glBindBuffer(GL_ARRAY_BUFFER, a.buffer);
+		if (a.integer)
+			glVertexAttribIPointer(i, a.size, a.type, a.stride, a.pointer);
+		else
+			glVertexAttribPointer(i, a.size, a.type, a.normalized ? GL_TRUE : GL_FALSE, a.stride, a.pointer);
+		glEnableVertexAttribArray(i);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, skinBuffer);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (void*)offsetof(SkinnedVertex, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(SKINNED_NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (void*)offsetof(SkinnedVertex, normal));
+	glEnableVertexAttribArray(SKINNED_NORMAL_LOCATION);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+	glBindVertexArray(0);
+	return vaoID;
+}
+
+// True when the node's skin buffers were written with a different pose, or never
+inline bool poseChanged(const Node* node, const std::vector<glm::mat4>& transforms)
+{
+	return node->skinnedPose.size() != transforms.size() ||
+		memcmp(node->skinnedPose.data(), transforms.data(), transforms.size() * sizeof(glm::mat4)) != 0;
+}
+
+// Run skin.vert over every vertex of the node's meshes. The skin program must be in use with its
+// bone transforms set.
+void skinNode(Node* node, const std::vector<glm::mat4>& transforms)
+{
+	glEnable(GL_RASTERIZER_DISCARD);
+	for (unsigned int i = 0; i < node->skinBufferIDs.size(); i++)
+	{
+		// Each mesh writes its own range, so batched meshes can share one skin buffer
+		unsigned int baseVertex = node->VAOBaseVertices[i];
+		unsigned int vertexCount = node->VAOVertexCounts[i];
+		glBindVertexArray(node->vertexArrayObjectIDs[i]);
+		glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, node->skinBufferIDs[i],
+			baseVertex * sizeof(SkinnedVertex), vertexCount * sizeof(SkinnedVertex));
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, baseVertex, vertexCount);
+		glEndTransformFeedback();
+	}
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable(GL_RASTERIZER_DISCARD);
+	node->skinnedPose = transforms;
+}
+
+// Skin the node's meshes on the CPU, straight into the mapped skin buffers. Returns false, having
+// written nothing, when a mesh lacks the per-vertex data the CPU skinner reads.
+bool cpuSkinNode(Node* node, const std::vector<glm::mat4>& transforms, CpuSkinner& skinner)
+{
+	for (const Mesh* mesh : node->skinSourceMeshes)
+	{
+		if (mesh == nullptr || !canSkinOnCpu(*mesh))
+			return false;
+	}
+	for (unsigned int i = 0; i < node->skinBufferIDs.size(); i++)
+	{
+		const Mesh* mesh = node->skinSourceMeshes[i];
+		glBindBuffer(GL_ARRAY_BUFFER, node->skinBufferIDs[i]);
+		void* out = glMapBufferRange(GL_ARRAY_BUFFER, node->VAOBaseVertices[i] * sizeof(SkinnedVertex),
+			mesh->vertices.size() * sizeof(SkinnedVertex), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (out == nullptr)
+			continue;
+		skinner.skin(*mesh, transforms, (SkinnedVertex*)out);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	node->skinnedPose = transforms;
+	return true;
+}
+
+#endif
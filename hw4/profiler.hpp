@@ -0,0 +1,267 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped CPU markers. PROFILE_SCOPE("name") records the start and end of the enclosing scope into a
+// ring owned by the calling thread; nested scopes become nested slices in the trace. Recording is
+// off until setProfiling(true), and a disabled marker costs one relaxed atomic load. Defining
+// NO_PROFILER removes the markers altogether.
+//
+// Each ring has a single writer, its thread, which publishes an event by advancing the ring's head
+// with a release store. writeChromeTrace copies the rings without stopping the writers and drops
+// the events that were overwritten while it read, then writes the Chrome trace event format, which
+// chrome://tracing and ui.perfetto.dev both open.
+
+// Wall time since start, for the load and frame timings that are reported whether or not the
+// profiler records
+inline double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct ProfileEvent
+{
+	const char* name;
+	// Nanoseconds since the profiler started
+	int64_t start;
+	int64_t end;
+	unsigned int depth;
+};
+
+class ProfileRing
+{
+public:
+	// Power of two; the oldest events are overwritten once a thread records more
+	static const uint64_t capacity = 1 << 16;
+
+	unsigned int threadID;
+	// Guarded by the profiler's mutex
+	std::string threadName;
+	// Nesting depth of the open scopes, touched only by the owning thread
+	unsigned int depth = 0;
+
+	explicit ProfileRing(unsigned int id) : threadID(id), threadName("Thread " + std::to_string(id)), events(capacity)
+	{
+	}
+
+	void push(const ProfileEvent& event)
+	{
+		uint64_t h = head.load(std::memory_order_relaxed);
+		events[h & (capacity - 1)] = event;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// The events still in the ring, oldest first
+	void copyEvents(std::vector<ProfileEvent>& out) const
+	{
+		uint64_t end = head.load(std::memory_order_acquire);
+		uint64_t begin = end > capacity ? end - capacity : 0;
+		size_t first = out.size();
+		for (uint64_t i = begin; i < end; i++)
+			out.push_back(events[i & (capacity - 1)]);
+
+		// Slots the writer reached during the copy, and the one it may be writing now, can hold
+		// newer or torn events
+		uint64_t after = head.load(std::memory_order_acquire) + 1;
+		uint64_t overwritten = after > capacity + begin ? after - capacity - begin : 0;
+		if (overwritten > 0)
+			out.erase(out.begin() + first, out.begin() + first + (size_t)std::min<uint64_t>(overwritten, end - begin));
+	}
+
+private:
+	std::atomic<uint64_t> head{ 0 };
+	std::vector<ProfileEvent> events;
+};
+
+class Profiler
+{
+public:
+	std::atomic<bool> enabled{ false };
+
+	Profiler() : origin(std::chrono::steady_clock::now())
+	{
+	}
+
+	int64_t now() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+	}
+
+	// The calling thread's ring, created on its first event. Rings outlive their threads so that
+	// events of finished workers can still be exported.
+	ProfileRing& threadRing()
+	{
+		ProfileRing*& ring = currentRing();
+		if (ring == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			rings.emplace_back(new ProfileRing((unsigned int)rings.size()));
+			ring = rings.back().get();
+			if (!currentThreadName().empty())
+				ring->threadName = currentThreadName();
+		}
+		return *ring;
+	}
+
+	// A ring for events recorded on behalf of something other than a thread, such as the GPU. It is
+	// exported like a thread; only one thread may push to it.
+	ProfileRing& track(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		rings.emplace_back(new ProfileRing((unsigned int)rings.size()));
+		rings.back()->threadName = name;
+		return *rings.back();
+	}
+
+	// Applied to the thread's ring now or when it is created, so naming a thread costs no ring
+	void setThreadName(const std::string& name)
+	{
+		currentThreadName() = name;
+		if (currentRing() != nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			currentRing()->threadName = name;
+		}
+	}
+
+	// Write every recorded event to path in the Chrome trace event format
+	bool writeChromeTrace(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (file == nullptr)
+			return false;
+
+		struct ThreadEvents
+		{
+			unsigned int id;
+			std::string name;
+			std::vector<ProfileEvent> events;
+		};
+		std::vector<ThreadEvents> snapshot;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const std::unique_ptr<ProfileRing>& ring : rings)
+			{
+				snapshot.push_back({ ring->threadID, ring->threadName, std::vector<ProfileEvent>() });
+				ring->copyEvents(snapshot.back().events);
+			}
+		}
+
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool first = true;
+		for (const ThreadEvents& thread : snapshot)
+		{
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", thread.id, thread.name.c_str());
+			first = false;
+			for (const ProfileEvent& event : thread.events)
+			{
+				// Timestamps and durations are in microseconds
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%u}}",
+					event.name, thread.id, event.start / 1000.0, (event.end - event.start) / 1000.0, event.depth);
+			}
+		}
+		fprintf(file, "\n]}\n");
+		return fclose(file) == 0;
+	}
+
+private:
+	std::chrono::steady_clock::time_point origin;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ProfileRing>> rings;
+
+	static ProfileRing*& currentRing()
+	{
+		thread_local ProfileRing* ring = nullptr;
+		return ring;
+	}
+
+	static std::string& currentThreadName()
+	{
+		thread_local std::string name;
+		return name;
+	}
+};
+
+inline Profiler& profiler()
+{
+	static Profiler instance;
+	return instance;
+}
+
+inline void setProfiling(bool enabled)
+{
+	profiler().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+inline bool profiling()
+{
+	return profiler().enabled.load(std::memory_order_relaxed);
+}
+
+// Name the calling thread in exported traces
+inline void setProfilerThreadName(const std::string& name)
+{
+#ifndef NO_PROFILER
+	profiler().setThreadName(name);
+#endif
+}
+
+// Records the time between construction and end(), or destruction. name must outlive the
+// profiler, which string literals do.
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name)
+	{
+#ifndef NO_PROFILER
+		if (!profiling())
+			return;
+		ring = &profiler().threadRing();
+		event.name = name;
+		event.depth = ring->depth++;
+		event.start = profiler().now();
+#endif
+	}
+
+	~ProfileScope()
+	{
+		end();
+	}
+
+	void end()
+	{
+		if (ring == nullptr)
+			return;
+		event.end = profiler().now();
+		ring->depth--;
+		ring->push(event);
+		ring = nullptr;
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	ProfileRing* ring = nullptr;
+	ProfileEvent event;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#ifdef NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#endif
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "glext.hpp"
+#include "shader.hpp"
+
+// Scene traversal queues compact draw items instead of drawing. The queue is sorted by a key of
+// pass, program, material, VAO and depth, then submitted with binds of state that is already
+// current skipped.
+//
+// With multi-draw, uploadIndirect writes one indirect command and one DrawData record per item, and
+// submitIndirect issues a glMultiDrawElementsIndirect for every run of items that share program,
+// VAO, index type and material. The MULTI_DRAW shader variants read the model matrix, node type and
+// palette offset of a draw from its record.
+
+enum RenderPass
+{
+	SHADOW_PASS,
+	MAIN_PASS,
+};
+
+// Diffuse, normal and specular maps on texture units 0, 1 and 2
+const unsigned int MATERIAL_TEXTURE_COUNT = 3;
+// Material 0 binds nothing and leaves the units as they are
+const unsigned int NO_MATERIAL = 0;
+
+// Shader storage bindings of the MULTI_DRAW shader variants
+const unsigned int DRAW_DATA_BINDING = 0;
+const unsigned int PALETTE_BINDING = 1;
+
+struct DrawItem
+{
+	uint64_t key;
+	RenderPass pass;
+	// Slot of the program in the pass, given to the submit callback
+	unsigned int program;
+	unsigned int material;
+	unsigned int vao;
+	unsigned int indexType;
+	// Range of the element buffer, in indices
+	unsigned int first;
+	unsigned int count;
+	// Added to every index, for meshes that share a batch VAO
+	unsigned int baseVertex;
+	unsigned int nodeType;
+	const glm::mat4* model;
+	// First bone of the draw's palette in the palette buffer, MULTI_DRAW only
+	unsigned int paletteOffset;
+};
+
+// Layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+// std430 layout of DrawData in default.vert and depth.vert
+struct DrawData
+{
+	glm::mat4 model;
+	unsigned int type;
+	unsigned int paletteOffset;
+	unsigned int padding[2];
+};
+
+struct RenderStats
+{
+	unsigned int draws = 0;
+	// glMultiDrawElementsIndirect calls, each submitting several of the draws
+	unsigned int multiDraws = 0;
+	unsigned int programChanges = 0;
+	unsigned int textureBinds = 0;
+	unsigned int vaoBinds = 0;
+	unsigned int uniformUploads = 0;
+	// Binds and uploads skipped because the state was already current
+	unsigned int elided = 0;
+
+	RenderStats& operator+=(const RenderStats& other)
+	{
+		draws += other.draws;
+		multiDraws += other.multiDraws;
+		programChanges += other.programChanges;
+		textureBinds += other.textureBinds;
+		vaoBinds += other.vaoBinds;
+		uniformUploads += other.uniformUploads;
+		elided += other.elided;
+		return *this;
+	}
+};
+
+class RenderQueue
+{
+public:
+	// Depths are quantized over [0, farPlane)
+	float farPlane = 100.0f;
+
+	// Counters of the last finished frame and of all frames so far
+	RenderStats lastFrame;
+	RenderStats total;
+	unsigned int frames = 0;
+
+	RenderQueue()
+	{
+		materials.push_back({ 0, 0, 0 });
+	}
+
+	// A stable ID for a texture set, shared by every draw that uses the same three maps
+	unsigned int materialID(unsigned int diffuse, unsigned int normal, unsigned int specular)
+	{
+		std::array<unsigned int, MATERIAL_TEXTURE_COUNT> textures = { diffuse, normal, specular };
+		for (unsigned int i = 1; i < materials.size(); i++)
+		{
+			if (materials[i] == textures)
+				return i;
+		}
+		materials.push_back(textures);
+		return (unsigned int)materials.size() - 1;
+	}
+
+	// Counters of the frame being recorded
+	const RenderStats& currentFrame() const
+	{
+		return current;
+	}
+
+	// Start a new frame
+	void clear()
+	{
+		if (current.draws > 0)
+		{
+			lastFrame = current;
+			total += current;
+			frames++;
+		}
+		current = RenderStats();
+		items.clear();
+	}
+
+	// Key, high to low bits: pass (4), program (4), material (12), VAO (16), depth (16)
+	void add(DrawItem item, float depth)
+	{
+		uint64_t depthBits = (uint64_t)(glm::clamp(depth / farPlane, 0.0f, 1.0f) * 65535.0f);
+		item.key = ((uint64_t)(item.pass & 0xF) << 60) |
+			((uint64_t)(item.program & 0xF) << 56) |
+			((uint64_t)(item.material & 0xFFF) << 44) |
+			((uint64_t)(item.vao & 0xFFFF) << 28) |
+			(depthBits << 12);
+		items.push_back(item);
+	}
+
+	void sort()
+	{
+		std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+	}
+
+	// Draw the items of one pass in key order. useProgram makes the program of a slot current,
+	// sets its per-pass uniforms and returns it; it is called only when the slot changes.
+	void submit(RenderPass pass, const std::function<Shader&(unsigned int program)>& useProgram)
+	{
+		// Nothing is assumed about state set outside the queue
+		unsigned int program = ~0u;
+		unsigned int vao = ~0u;
+		unsigned int textures[MATERIAL_TEXTURE_COUNT] = { ~0u, ~0u, ~0u };
+		Shader* shader = nullptr;
+		int modelUniform = -1;
+		int typeUniform = -1;
+		const glm::mat4* model = nullptr;
+
+		for (const DrawItem& item : items)
+		{
+			if (item.pass != pass)
+				continue;
+
+			if (item.program != program)
+			{
+				shader = &useProgram(item.program);
+				modelUniform = shader->uniform("M");
+				typeUniform = shader->uniform("type");
+				program = item.program;
+				current.programChanges++;
+				// Uniforms belong to the program
+				model = nullptr;
+			}
+
+			if (item.material != NO_MATERIAL)
+			{
+				const std::array<unsigned int, MATERIAL_TEXTURE_COUNT>& material = materials[item.material];
+				for (unsigned int unit = 0; unit < MATERIAL_TEXTURE_COUNT; unit++)
+				{
+					if (textures[unit] == material[unit])
+					{
+						current.elided++;
+						continue;
+					}
+					glActiveTexture(GL_TEXTURE0 + unit);
+					glBindTexture(GL_TEXTURE_2D, material[unit]);
+					textures[unit] = material[unit];
+					current.textureBinds++;
+				}
+			}
+
+			// The program drops values it already holds; a model matrix seen last is not even compared
+			if (shader->setUint(typeUniform, item.nodeType))
+				current.uniformUploads++;
+			else
+				current.elided++;
+
+			if (item.model != model && shader->setMat4(modelUniform, *item.model))
+				current.uniformUploads++;
+			else
+				current.elided++;
+			model = item.model;
+
+			if (item.vao != vao)
+			{
+				glBindVertexArray(item.vao);
+				vao = item.vao;
+				current.vaoBinds++;
+			}
+			else
+			{
+				current.elided++;
+			}
+
+			unsigned int indexSize = item.indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+			glDrawElementsBaseVertex(GL_TRIANGLES, item.count, item.indexType, (void*)(size_t)(item.first * indexSize), item.baseVertex);
+			current.draws++;
+		}
+	}
+
+	// Write the indirect commands and DrawData records of every queued item, after sort. Item i
+	// is command i and reads record i through its baseInstance.
+	void uploadIndirect()
+	{
+		if (indirectBuffer == 0)
+		{
+			glGenBuffers(1, &indirectBuffer);
+			glGenBuffers(1, &drawDataBuffer);
+		}
+
+		commands.clear();
+		records.clear();
+		for (const DrawItem& item : items)
+		{
+			commands.push_back({ item.count, 1, item.first, (int)item.baseVertex, (unsigned int)records.size() });
+			DrawData record;
+			record.model = *item.model;
+			record.type = item.nodeType;
+			record.paletteOffset = item.paletteOffset;
+			record.padding[0] = record.padding[1] = 0;
+			records.push_back(record);
+		}
+
+		// Orphan last frame's storage instead of waiting for the GPU to finish with it
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawData), records.data(), GL_STREAM_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+	}
+
+	// Like submit, with one multi-draw per run of compatible items. Runs break on a change of
+	// program, VAO, index type or material; items without a material join any run.
+	void submitIndirect(RenderPass pass, const std::function<Shader&(unsigned int program)>& useProgram)
+	{
+		unsigned int program = ~0u;
+		unsigned int vao = ~0u;
+		unsigned int textures[MATERIAL_TEXTURE_COUNT] = { ~0u, ~0u, ~0u };
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		size_t i = 0;
+		while (i < items.size())
+		{
+			const DrawItem& first = items[i];
+			if (first.pass != pass)
+			{
+				i++;
+				continue;
+			}
+
+			unsigned int material = first.material;
+			size_t end = i + 1;
+			while (end < items.size())
+			{
+				const DrawItem& next = items[end];
+				if (next.pass != pass || next.program != first.program || next.vao != first.vao || next.indexType != first.indexType)
+					break;
+				if (next.material != NO_MATERIAL && material != NO_MATERIAL && next.material != material)
+					break;
+				if (material == NO_MATERIAL)
+					material = next.material;
+				end++;
+			}
+
+			if (first.program != program)
+			{
+				useProgram(first.program);
+				program = first.program;
+				current.programChanges++;
+			}
+
+			if (material != NO_MATERIAL)
+			{
+				for (unsigned int unit = 0; unit < MATERIAL_TEXTURE_COUNT; unit++)
+				{
+					if (textures[unit] == materials[material][unit])
+					{
+						current.elided++;
+						continue;
+					}
+					glActiveTexture(GL_TEXTURE0 + unit);
+					glBindTexture(GL_TEXTURE_2D, materials[material][unit]);
+					textures[unit] = materials[material][unit];
+					current.textureBinds++;
+				}
+			}
+
+			if (first.vao != vao)
+			{
+				glBindVertexArray(first.vao);
+				vao = first.vao;
+				current.vaoBinds++;
+			}
+			else
+			{
+				current.elided++;
+			}
+
+			glMultiDrawElementsIndirect(GL_TRIANGLES, first.indexType, (void*)(i * sizeof(DrawElementsIndirectCommand)), (GLsizei)(end - i), 0);
+			current.draws += (unsigned int)(end - i);
+			current.multiDraws++;
+			i = end;
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+private:
+	std::vector<DrawItem> items;
+	std::vector<std::array<unsigned int, MATERIAL_TEXTURE_COUNT>> materials;
+	RenderStats current;
+
+	// Multi-draw buffers, created on first use; the queue is constructed before the GL context
+	unsigned int indirectBuffer = 0;
+	unsigned int drawDataBuffer = 0;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<DrawData> records;
+};
+
+#endif
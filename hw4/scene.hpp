@@ -4,8 +4,25 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <array>
+#include <memory>
 #include <vector>
 
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "mesh.hpp"
+#include "scenetransforms.hpp"
+
+// Where one level of detail of a VAO lives in its element buffer. Influence bucket k spans
+// [influenceOffsets[k - 1], influenceOffsets[k]); offsets are absolute.
+struct LodRange
+{
+	std::array<unsigned int, MAX_BONE_INFLUENCE + 1> influenceOffsets;
+	// Simplification error in mesh units, 0 for the full mesh
+	float error;
+};
+
 enum NodeType
 {
 	ROOT,
@@ -16,24 +33,60 @@ enum NodeType
 	CHARACTER,
 };
 
+// The render data of a scene node. Nodes live in sceneNodes(); their transforms and place in the
+// hierarchy are kept by slot in sceneTransforms().
+//
+// Only the transforms are walked for every node each step, so only they are split into arrays by
+// slot. The render data stays together per node: it is read whole, one node at a time, for the nodes
+// the scene index's queries return, and its per-VAO lists differ in length from node to node and
+// change with batching and LOD. Shared arrays would need a range per node that moves whenever a
+// list grows. Node lists keep their storage across reset, so a reused slot allocates nothing.
 struct Node
 {
-	std::vector<Node*> children;
-
-	// The node's position and rotation relative to its parent
-	glm::vec3 position;
-	glm::vec3 rotation;
-	glm::vec3 scale;
+	// The node's slot in the pool and in sceneTransforms(), which holds its position, rotation,
+	// scale and reference point relative to its parent, its parent and its children
+	unsigned int slot;
 
-	// A transformation matrix representing the transformation of the node's location relative to its parent. This matrix is updated every frame.
+	// The world transform the node is drawn with, set by the renderer from the simulation's
+	// transforms when the node moved
 	glm::mat4 currentTransformationMatrix;
 
-	// The location of the node's reference point
-	glm::vec3 referencePoint;
-
 	// The ID of the VAO containing the "appearance" of this SceneNode.
 	std::vector<int> vertexArrayObjectIDs;
 	std::vector<unsigned int> VAOIndexCounts;
+	// GL_UNSIGNED_INT or GL_UNSIGNED_SHORT, one entry per VAO
+	std::vector<unsigned int> VAOIndexTypes;
+	// Levels of detail per VAO, full mesh first
+	std::vector<std::vector<LodRange>> VAOLods;
+	// Level drawn this frame per VAO, picked by selectLods
+	std::vector<unsigned int> VAOCurrentLods;
+	// First vertex of each mesh in its VAO; non-zero when meshes share a batch VAO
+	std::vector<unsigned int> VAOBaseVertices;
+
+	// Pre-skinning, one entry per VAO: vertex count, skin.vert output buffer and the VAO that draws it.
+	// Meshes of a batch share the buffer and VAO, each at its base vertex.
+	std::vector<unsigned int> VAOVertexCounts;
+	std::vector<unsigned int> skinBufferIDs;
+	std::vector<int> skinnedVAOIDs;
+	// Source data of each skin buffer when it is filled by the CPU skinner
+	std::vector<const Mesh*> skinSourceMeshes;
+	// Bone transforms the skin buffers were last written with
+	std::vector<glm::mat4> skinnedPose;
+
+	// Bounding sphere of the node's meshes in its own space
+	glm::vec3 boundingCenter;
+	float boundingRadius;
+
+	// Culling box in the node's own space; nodes with an empty box are never culled. Characters
+	// recompute it every frame from boneBounds and the current pose.
+	BoundingBox bounds;
+	// Bind-space box of the vertices each bone influences, indexed by bone ID
+	std::vector<BoundingBox> boneBounds;
+	// Bit (1 << RenderPass) for each pass the node passed culling in, set by collectDrawItems or
+	// collectVisibleDraws
+	unsigned int visiblePasses;
+	// The node's leaf in sceneIndex(), Bvh::none while it is not in the index's tree
+	unsigned int bvhLeaf;
 
 	// Node type is used to determine how to handle the contents of a node
 	NodeType type;
@@ -45,24 +98,265 @@ struct Node
 	std::vector<unsigned int> specularMapIDs;
 
 	Node()
+	{
+		slot = 0;
+		reset();
+	}
+
+	// Back to a new node's state. The lists are emptied but keep their storage for the next node
+	// in the slot.
+	void reset()
 	{
 		type = GEOMETRY;
-		position = glm::vec3(0, 0, 0);
-		rotation = glm::vec3(0, 0, 0);
-		scale = glm::vec3(1, 1, 1);
-		referencePoint = glm::vec3(0, 0, 0);
+		lightID = 0;
+		currentTransformationMatrix = glm::mat4(1.0f);
+		vertexArrayObjectIDs.clear();
+		VAOIndexCounts.clear();
+		VAOIndexTypes.clear();
+		VAOLods.clear();
+		VAOCurrentLods.clear();
+		VAOBaseVertices.clear();
+		VAOVertexCounts.clear();
+		skinBufferIDs.clear();
+		skinnedVAOIDs.clear();
+		skinSourceMeshes.clear();
+		skinnedPose.clear();
+		boundingCenter = glm::vec3(0, 0, 0);
+		boundingRadius = 0.0f;
+		bounds = BoundingBox();
+		boneBounds.clear();
+		visiblePasses = ~0u;
+		bvhLeaf = Bvh::none;
+		textureIDs.clear();
+		normalMapIDs.clear();
+		specularMapIDs.clear();
 	}
 };
 
+// The world-space boxes of the nodes that have bounds, in a BVH whose leaves hold node slots, for
+// culling and picking. Nodes with draws but no bounds are listed apart, to be drawn in every pass.
+struct SceneIndex
+{
+	Bvh tree{ 0.1f };
+	std::vector<unsigned int> unbounded;
+};
+
+SceneIndex& sceneIndex()
+{
+	static SceneIndex index;
+	return index;
+}
+
+// Add a node to the scene index, at its box under its current transform. Nodes found by a query
+// are marked visible, so until the first query the node counts as visible in no pass.
+void indexSceneNode(Node* node)
+{
+	SceneIndex& index = sceneIndex();
+	if (!node->bounds.empty())
+		node->bvhLeaf = index.tree.insert(transformBox(node->currentTransformationMatrix, node->bounds), node->slot);
+	else if (!node->vertexArrayObjectIDs.empty())
+		index.unbounded.push_back(node->slot);
+	node->visiblePasses = 0;
+}
+
+// Bring an indexed node's box up to date after its transform or bounds changed
+void updateSceneIndex(Node* node)
+{
+	if (node->bvhLeaf != Bvh::none && !node->bounds.empty())
+		sceneIndex().tree.move(node->bvhLeaf, transformBox(node->currentTransformationMatrix, node->bounds));
+}
+
+void unindexSceneNode(Node* node)
+{
+	SceneIndex& index = sceneIndex();
+	if (node->bvhLeaf != Bvh::none)
+		index.tree.remove(node->bvhLeaf);
+	else
+		index.unbounded.erase(std::remove(index.unbounded.begin(), index.unbounded.end(), node->slot), index.unbounded.end());
+}
+
+// A reference to a node that can outlive it: get returns null once the node is destroyed, even
+// when its slot holds a new node
+struct NodeHandle
+{
+	unsigned int slot = SceneTransforms::none;
+	unsigned int generation = 0;
+};
+
+// Storage of every scene node. Nodes sit in fixed-size chunks that never move, so pointers stay
+// valid for a node's lifetime, and destroyed nodes' slots are reused before new chunks are added:
+// creating and destroying a node is constant time and, once the pool has grown to the peak node
+// count, allocates nothing. GL objects referenced by a node belong to whoever created them.
+// Create and destroy nodes only while the simulation thread is not running.
+class NodePool
+{
+public:
+	static const unsigned int chunkSize = 256;
+
+	Node* create()
+	{
+		unsigned int slot;
+		if (!freeSlots.empty())
+		{
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			slot = (unsigned int)generations.size();
+			if (slot % chunkSize == 0)
+				chunks.emplace_back(new Node[chunkSize]);
+			generations.push_back(0);
+			alive.push_back(0);
+			sceneTransforms().grow(slot + 1);
+		}
+		alive[slot] = 1;
+		liveCount++;
+		sceneTransforms().reset(slot);
+		Node* node = at(slot);
+		node->slot = slot;
+		return node;
+	}
+
+	// Destroy node and everything below it
+	void destroy(Node* node)
+	{
+		SceneTransforms& transforms = sceneTransforms();
+		unsigned int child = transforms.firstChild(node->slot);
+		while (child != SceneTransforms::none)
+		{
+			unsigned int next = transforms.nextSibling(child);
+			destroy(at(child));
+			child = next;
+		}
+		transforms.release(node->slot);
+		unindexSceneNode(node);
+		node->reset();
+		generations[node->slot]++;
+		alive[node->slot] = 0;
+		liveCount--;
+		freeSlots.push_back(node->slot);
+	}
+
+	NodeHandle handle(const Node* node) const
+	{
+		return NodeHandle{ node->slot, generations[node->slot] };
+	}
+
+	// The node a handle refers to, null once it is destroyed
+	Node* get(NodeHandle handle)
+	{
+		if (handle.slot >= generations.size() || !alive[handle.slot] || generations[handle.slot] != handle.generation)
+			return nullptr;
+		return at(handle.slot);
+	}
+
+	// The node in a slot, null for free slots
+	Node* node(unsigned int slot)
+	{
+		return slot < alive.size() && alive[slot] ? at(slot) : nullptr;
+	}
+
+	// Slots ever used, live or free
+	unsigned int slotCount() const
+	{
+		return (unsigned int)generations.size();
+	}
+
+	unsigned int nodeCount() const
+	{
+		return liveCount;
+	}
+
+private:
+	Node* at(unsigned int slot)
+	{
+		return &chunks[slot / chunkSize][slot % chunkSize];
+	}
+
+	std::vector<std::unique_ptr<Node[]>> chunks;
+	// Bumped when the node in a slot is destroyed, to tell old handles from new ones
+	std::vector<unsigned int> generations;
+	std::vector<unsigned char> alive;
+	std::vector<unsigned int> freeSlots;
+	unsigned int liveCount = 0;
+};
+
+NodePool& sceneNodes()
+{
+	static NodePool pool;
+	return pool;
+}
+
 Node* createSceneNode()
 {
-	return new Node();
+	return sceneNodes().create();
+}
+
+// Destroy a node and its descendants
+void destroySceneNode(Node* node)
+{
+	sceneNodes().destroy(node);
 }
 
 // Add a child node to its parent's list of children
 void addChild(Node* parent, Node* child)
 {
-	parent->children.push_back(child);
+	sceneTransforms().setParent(child->slot, parent->slot);
+}
+
+// The children of a node in the order they were added, for range-based for
+class NodeChildren
+{
+public:
+	class iterator
+	{
+	public:
+		explicit iterator(unsigned int slot) : slot(slot)
+		{
+		}
+
+		Node* operator*() const
+		{
+			return sceneNodes().node(slot);
+		}
+
+		iterator& operator++()
+		{
+			slot = sceneTransforms().nextSibling(slot);
+			return *this;
+		}
+
+		bool operator!=(const iterator& other) const
+		{
+			return slot != other.slot;
+		}
+
+	private:
+		unsigned int slot;
+	};
+
+	explicit NodeChildren(const Node* node) : first(sceneTransforms().firstChild(node->slot))
+	{
+	}
+
+	iterator begin() const
+	{
+		return iterator(first);
+	}
+
+	iterator end() const
+	{
+		return iterator(SceneTransforms::none);
+	}
+
+private:
+	unsigned int first;
+};
+
+NodeChildren childrenOf(const Node* node)
+{
+	return NodeChildren(node);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,265 @@
+#ifndef SCENETRANSFORMS_HPP
+#define SCENETRANSFORMS_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <vector>
+
+// Local and world transforms and the hierarchy of the scene nodes, in flat arrays indexed by the
+// node's pool slot (see NodePool). Children are linked through first/next sibling slots, so a node
+// can be added or removed anywhere without moving the others. Setting a local value marks the node
+// dirty; update recomputes the dirty nodes' locals and the world transforms of their subtrees and
+// leaves everything else alone, so a scene that holds still costs nothing per step.
+class SceneTransforms
+{
+public:
+	static constexpr unsigned int none = ~0u;
+
+	// Updates and the recomputes they did
+	struct Stats
+	{
+		unsigned int updates = 0;
+		unsigned long long locals = 0;
+		unsigned long long worlds = 0;
+	};
+
+	// Make room for slots below count
+	void grow(unsigned int count)
+	{
+		if (count <= size())
+			return;
+		positions.resize(count, glm::vec3(0.0f));
+		rotations.resize(count, glm::vec3(0.0f));
+		scales.resize(count, glm::vec3(1.0f));
+		referencePoints.resize(count, glm::vec3(0.0f));
+		parents.resize(count, none);
+		firstChildren.resize(count, none);
+		lastChildren.resize(count, none);
+		nextSiblings.resize(count, none);
+		previousSiblings.resize(count, none);
+		locals.resize(count, glm::mat4(1.0f));
+		worlds.resize(count, glm::mat4(1.0f));
+		localDirty.resize(count, 0);
+	}
+
+	// Give a slot an identity transform and no parent, ready for a new node
+	void reset(unsigned int slot)
+	{
+		positions[slot] = glm::vec3(0.0f);
+		rotations[slot] = glm::vec3(0.0f);
+		scales[slot] = glm::vec3(1.0f);
+		referencePoints[slot] = glm::vec3(0.0f);
+		parents[slot] = firstChildren[slot] = lastChildren[slot] = none;
+		nextSiblings[slot] = previousSiblings[slot] = none;
+		markDirty(slot);
+	}
+
+	// Append slot to parent's children, taking it from its old parent first
+	void setParent(unsigned int slot, unsigned int parent)
+	{
+		detach(slot);
+		parents[slot] = parent;
+		if (parent != none)
+		{
+			previousSiblings[slot] = lastChildren[parent];
+			if (lastChildren[parent] != none)
+				nextSiblings[lastChildren[parent]] = slot;
+			else
+				firstChildren[parent] = slot;
+			lastChildren[parent] = slot;
+		}
+		markDirty(slot);
+	}
+
+	// Take slot from its parent's children; its own children stay with it
+	void detach(unsigned int slot)
+	{
+		unsigned int parent = parents[slot];
+		if (parent == none)
+			return;
+		unsigned int previous = previousSiblings[slot], next = nextSiblings[slot];
+		if (previous != none)
+			nextSiblings[previous] = next;
+		else
+			firstChildren[parent] = next;
+		if (next != none)
+			previousSiblings[next] = previous;
+		else
+			lastChildren[parent] = previous;
+		parents[slot] = nextSiblings[slot] = previousSiblings[slot] = none;
+	}
+
+	// Drop a slot whose node was destroyed: out of its parent's children and out of the next update.
+	// The node's children must be released as well.
+	void release(unsigned int slot)
+	{
+		detach(slot);
+		firstChildren[slot] = lastChildren[slot] = none;
+		localDirty[slot] = 0;
+	}
+
+	unsigned int parent(unsigned int slot) const { return parents[slot]; }
+	unsigned int firstChild(unsigned int slot) const { return firstChildren[slot]; }
+	unsigned int nextSibling(unsigned int slot) const { return nextSiblings[slot]; }
+
+	unsigned int size() const
+	{
+		return (unsigned int)positions.size();
+	}
+
+	// The node's position, rotation (Euler angles, applied Y, X, Z) and scale relative to its
+	// parent; rotation and scale are about the reference point
+	const glm::vec3& position(unsigned int index) const { return positions[index]; }
+	const glm::vec3& rotation(unsigned int index) const { return rotations[index]; }
+	const glm::vec3& scale(unsigned int index) const { return scales[index]; }
+	const glm::vec3& referencePoint(unsigned int index) const { return referencePoints[index]; }
+
+	void setPosition(unsigned int index, const glm::vec3& value)
+	{
+		positions[index] = value;
+		markDirty(index);
+	}
+
+	void setRotation(unsigned int index, const glm::vec3& value)
+	{
+		rotations[index] = value;
+		markDirty(index);
+	}
+
+	void setScale(unsigned int index, const glm::vec3& value)
+	{
+		scales[index] = value;
+		markDirty(index);
+	}
+
+	void setReferencePoint(unsigned int index, const glm::vec3& value)
+	{
+		referencePoints[index] = value;
+		markDirty(index);
+	}
+
+	void translate(unsigned int index, const glm::vec3& offset)
+	{
+		setPosition(index, positions[index] + offset);
+	}
+
+	// Bring the world transforms up to date. Returns the number of world transforms recomputed;
+	// changed() lists them.
+	unsigned int update()
+	{
+		changedNodes.clear();
+		stats.updates++;
+		if (dirtyNodes.empty())
+			return 0;
+
+		unsigned int localCount = 0;
+		for (unsigned int dirty : dirtyNodes)
+		{
+			// Already recomputed with a dirty ancestor's subtree, or about to be
+			if (!localDirty[dirty] || hasDirtyAncestor(dirty))
+				continue;
+			// Depth-first over the subtree, parents before their children
+			subtree.push_back(dirty);
+			while (!subtree.empty())
+			{
+				unsigned int i = subtree.back();
+				subtree.pop_back();
+				if (localDirty[i])
+				{
+					locals[i] = computeLocal(i);
+					localDirty[i] = 0;
+					localCount++;
+				}
+				worlds[i] = parents[i] == none ? locals[i] : worlds[parents[i]] * locals[i];
+				changedNodes.push_back(i);
+				for (unsigned int child = lastChildren[i]; child != none; child = previousSiblings[child])
+					subtree.push_back(child);
+			}
+		}
+		dirtyNodes.clear();
+
+		stats.locals += localCount;
+		stats.worlds += changedNodes.size();
+		return (unsigned int)changedNodes.size();
+	}
+
+	// Slots whose world transform the last update recomputed
+	const std::vector<unsigned int>& changed() const
+	{
+		return changedNodes;
+	}
+
+	const glm::mat4& world(unsigned int index) const
+	{
+		return worlds[index];
+	}
+
+	const std::vector<glm::mat4>& worldTransforms() const
+	{
+		return worlds;
+	}
+
+	Stats stats;
+
+private:
+	void markDirty(unsigned int index)
+	{
+		if (localDirty[index])
+			return;
+		localDirty[index] = 1;
+		dirtyNodes.push_back(index);
+	}
+
+	bool hasDirtyAncestor(unsigned int slot) const
+	{
+		for (unsigned int i = parents[slot]; i != none; i = parents[i])
+		{
+			if (localDirty[i])
+				return true;
+		}
+		return false;
+	}
+
+	glm::mat4 computeLocal(unsigned int i) const
+	{
+		return glm::translate(positions[i]) *
+			glm::translate(referencePoints[i]) *
+			glm::rotate(rotations[i].y, glm::vec3(0, 1, 0)) *
+			glm::rotate(rotations[i].x, glm::vec3(1, 0, 0)) *
+			glm::rotate(rotations[i].z, glm::vec3(0, 0, 1)) *
+			glm::scale(scales[i]) *
+			glm::translate(-referencePoints[i]);
+	}
+
+	// Local values
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::vec3> referencePoints;
+	// Hierarchy links, none where there is no such slot
+	std::vector<unsigned int> parents;
+	std::vector<unsigned int> firstChildren;
+	std::vector<unsigned int> lastChildren;
+	std::vector<unsigned int> nextSiblings;
+	std::vector<unsigned int> previousSiblings;
+
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	// Set while a slot's local values changed since its local matrix was computed; such slots are
+	// listed once in dirtyNodes
+	std::vector<unsigned char> localDirty;
+	std::vector<unsigned int> dirtyNodes;
+	std::vector<unsigned int> changedNodes;
+	// Traversal stack of update, kept to reuse its storage
+	std::vector<unsigned int> subtree;
+};
+
+SceneTransforms& sceneTransforms()
+{
+	static SceneTransforms transforms;
+	return transforms;
+}
+
+#endif
@@ -3,19 +3,47 @@
 
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
 
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include "glext.hpp"
+
+// Uniform sets on a program; skipped ones carried the value the program already had
+struct UniformStats
+{
+	unsigned int uploads = 0;
+	unsigned int skipped = 0;
+};
+
+// A program with its active uniforms and blocks reflected into tables sorted by name hash. The
+// setters keep a copy of every value sent and skip the GL call when a uniform is set to the value
+// it already holds.
 class Shader
 {
 public:
 	// the program ID
 	unsigned int ID;
+	// Source files and defines, for reports
+	std::string name;
+
+	// Uniform sets since the last endFrame, in the frame before, and over every closed frame
+	UniformStats frameUniforms;
+	UniformStats lastFrameUniforms;
+	UniformStats totalUniforms;
+	unsigned int frames = 0;
 
-	// constructor reads and builds the shader
-	Shader(const char* vertexPath, const char* fragmentPath)
+	// constructor reads and builds the shader; defines are inserted right after the #version line of both stages
+	Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -45,6 +73,8 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		vertexCode = injectDefines(vertexCode, defines);
+		fragmentCode = injectDefines(fragmentCode, defines);
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
 
@@ -95,12 +125,354 @@ public:
 		// delete the shaders as they're linked into our program now and no longer necessary
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+		name = describeSources(vertexPath, fragmentPath, defines);
+		reflect();
+	}
+
+	// Vertex-only program whose outputs are captured with transform feedback, interleaved in the
+	// order given. Draw it with GL_RASTERIZER_DISCARD enabled.
+	Shader(const char* vertexPath, const std::vector<const char*>& feedbackVaryings, const std::string& defines = "")
+	{
+		std::string vertexCode = injectDefines(readSource(vertexPath), defines);
+		unsigned int vertex = compileStage(GL_VERTEX_SHADER, vertexCode, "VERTEX");
+
+		ID = glCreateProgram();
+		glAttachShader(ID, vertex);
+		glTransformFeedbackVaryings(ID, (GLsizei)feedbackVaryings.size(), feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+		glLinkProgram(ID);
+		int success;
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetProgramInfoLog(ID, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+				<< infoLog << std::endl;
+		}
+		glDeleteShader(vertex);
+		name = describeSources(vertexPath, nullptr, defines);
+		reflect();
 	}
 
 	void use()
 	{
 		glUseProgram(ID);
 	}
+
+	// Read the active uniforms and blocks of the linked program. Lookups do it on first use when
+	// it has not been done, e.g. for a program that was still linking when it was handed out.
+	void reflect()
+	{
+		reflected = true;
+		uniforms.clear();
+		blocks.clear();
+		shadow.clear();
+
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> nameBuffer(std::max(maxLength, 256));
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint size = 0;
+			GLenum type = 0;
+			GLsizei length = 0;
+			glGetActiveUniform(ID, i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+			std::string uniformName(nameBuffer.data(), length);
+			// Members of blocks have no location; they are set through the block's buffer
+			GLint location = glGetUniformLocation(ID, uniformName.c_str());
+			if (location < 0)
+				continue;
+			// Arrays are reported as name[0], and their elements sit at consecutive locations
+			if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+				uniformName.resize(uniformName.size() - 3);
+
+			UniformInfo info;
+			info.name = uniformName;
+			info.hash = hashName(uniformName.c_str());
+			info.location = location;
+			info.type = type;
+			info.size = size;
+			info.offset = (unsigned int)shadow.size();
+			info.bytes = uniformTypeBytes(type) * size;
+			shadow.resize(shadow.size() + info.bytes);
+			uniforms.push_back(info);
+		}
+		std::sort(uniforms.begin(), uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.hash < b.hash; });
+
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			glGetActiveUniformBlockName(ID, i, (GLsizei)nameBuffer.size(), &length, nameBuffer.data());
+			BlockInfo info;
+			info.name.assign(nameBuffer.data(), length);
+			info.hash = hashName(info.name.c_str());
+			info.storage = false;
+			glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_BINDING, &info.binding);
+			glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &info.dataSize);
+			blocks.push_back(info);
+		}
+		if (glGetProgramInterfaceiv != nullptr)
+		{
+			glGetProgramInterfaceiv(ID, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &count);
+			for (GLint i = 0; i < count; i++)
+			{
+				GLsizei length = 0;
+				glGetProgramResourceName(ID, GL_SHADER_STORAGE_BLOCK, i, (GLsizei)nameBuffer.size(), &length, nameBuffer.data());
+				const GLenum properties[2] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+				GLint values[2] = { 0, 0 };
+				glGetProgramResourceiv(ID, GL_SHADER_STORAGE_BLOCK, i, 2, properties, 2, NULL, values);
+				BlockInfo info;
+				info.name.assign(nameBuffer.data(), length);
+				info.hash = hashName(info.name.c_str());
+				info.storage = true;
+				info.binding = values[0];
+				info.dataSize = values[1];
+				blocks.push_back(info);
+			}
+		}
+		std::sort(blocks.begin(), blocks.end(), [](const BlockInfo& a, const BlockInfo& b) { return a.hash < b.hash; });
+	}
+
+	// Index of an active uniform, -1 when the program has none of that name. Arrays go by their
+	// name without [0].
+	int uniform(const char* uniformName)
+	{
+		if (!reflected)
+			reflect();
+		return find(uniforms, uniformName);
+	}
+
+	// Index of an active uniform or shader storage block, -1 when the program has none
+	int block(const char* blockName)
+	{
+		if (!reflected)
+			reflect();
+		return find(blocks, blockName);
+	}
+
+	// Binding point of a block from block(), -1 for none
+	int blockBinding(int index) const
+	{
+		return index < 0 ? -1 : blocks[index].binding;
+	}
+
+	// Set a uniform of the program, which must be current. Returns whether the value was sent;
+	// uniforms the program does not have (index -1) are ignored.
+	bool setInt(int index, int value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniform1i(location, value); });
+	}
+
+	bool setUint(int index, unsigned int value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniform1ui(location, value); });
+	}
+
+	bool setFloat(int index, float value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniform1f(location, value); });
+	}
+
+	bool setVec3(int index, const glm::vec3& value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniform3fv(location, 1, glm::value_ptr(value)); });
+	}
+
+	bool setVec4(int index, const glm::vec4& value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniform4fv(location, 1, glm::value_ptr(value)); });
+	}
+
+	bool setMat4(int index, const glm::mat4& value)
+	{
+		return update(index, &value, sizeof(value), [&](GLint location) { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); });
+	}
+
+	// The first count elements of a mat4 array, at most as many as it has
+	bool setMat4Array(int index, const glm::mat4* values, int count)
+	{
+		if (index >= 0)
+			count = std::min(count, uniforms[index].size);
+		return update(index, values, count * sizeof(glm::mat4), [&](GLint location) { glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0])); });
+	}
+
+	bool setInt(const char* uniformName, int value) { return setInt(uniform(uniformName), value); }
+	bool setUint(const char* uniformName, unsigned int value) { return setUint(uniform(uniformName), value); }
+	bool setFloat(const char* uniformName, float value) { return setFloat(uniform(uniformName), value); }
+	bool setVec3(const char* uniformName, const glm::vec3& value) { return setVec3(uniform(uniformName), value); }
+	bool setVec4(const char* uniformName, const glm::vec4& value) { return setVec4(uniform(uniformName), value); }
+	bool setMat4(const char* uniformName, const glm::mat4& value) { return setMat4(uniform(uniformName), value); }
+	bool setMat4Array(const char* uniformName, const glm::mat4* values, int count) { return setMat4Array(uniform(uniformName), values, count); }
+
+	// Close the frame's uniform counts
+	void endFrame()
+	{
+		lastFrameUniforms = frameUniforms;
+		totalUniforms.uploads += frameUniforms.uploads;
+		totalUniforms.skipped += frameUniforms.skipped;
+		frameUniforms = UniformStats();
+		frames++;
+	}
+
+	// FNV-1a, the key of the lookup tables
+	static uint32_t hashName(const char* text)
+	{
+		uint32_t hash = 2166136261u;
+		for (; *text; text++)
+			hash = (hash ^ (uint8_t)*text) * 16777619u;
+		return hash;
+	}
+
+private:
+	struct UniformInfo
+	{
+		std::string name;
+		uint32_t hash;
+		GLint location;
+		GLenum type;
+		// Elements, 1 unless an array
+		GLint size;
+		// Last value sent, at offset in shadow; knownBytes of it are valid
+		unsigned int offset;
+		unsigned int bytes;
+		unsigned int knownBytes = 0;
+	};
+
+	struct BlockInfo
+	{
+		std::string name;
+		uint32_t hash;
+		// Shader storage block rather than uniform block
+		bool storage;
+		GLint binding;
+		GLint dataSize;
+	};
+
+	bool reflected = false;
+	std::vector<UniformInfo> uniforms;
+	std::vector<BlockInfo> blocks;
+	std::vector<unsigned char> shadow;
+
+	// ShaderManager fills in ID once it has started building the program
+	friend class ShaderManager;
+	Shader() : ID(0)
+	{
+	}
+
+	template <typename Entry>
+	static int find(const std::vector<Entry>& entries, const char* entryName)
+	{
+		uint32_t hash = hashName(entryName);
+		auto entry = std::lower_bound(entries.begin(), entries.end(), hash, [](const Entry& e, uint32_t h) { return e.hash < h; });
+		for (; entry != entries.end() && entry->hash == hash; ++entry)
+		{
+			if (entry->name == entryName)
+				return (int)(entry - entries.begin());
+		}
+		return -1;
+	}
+
+	// Send the value through upload unless it matches the copy of the last one sent
+	template <typename Upload>
+	bool update(int index, const void* value, size_t bytes, Upload upload)
+	{
+		if (index < 0)
+			return false;
+		UniformInfo& info = uniforms[index];
+		bytes = std::min(bytes, (size_t)info.bytes);
+		unsigned char* last = shadow.data() + info.offset;
+		if (bytes <= info.knownBytes && memcmp(last, value, bytes) == 0)
+		{
+			frameUniforms.skipped++;
+			return false;
+		}
+		memcpy(last, value, bytes);
+		info.knownBytes = std::max(info.knownBytes, (unsigned int)bytes);
+		upload(info.location);
+		frameUniforms.uploads++;
+		return true;
+	}
+
+	static unsigned int uniformTypeBytes(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_FLOAT_MAT2: return 16;
+		case GL_FLOAT_MAT3: return 36;
+		case GL_FLOAT_MAT4: return 64;
+		// Scalars, booleans and samplers
+		default: return 4;
+		}
+	}
+
+	// "default.vert + default.frag [PACKED_VERTEX MULTI_DRAW]"
+	static std::string describeSources(const char* vertexPath, const char* fragmentPath, const std::string& defines)
+	{
+		std::string description = std::filesystem::path(vertexPath).filename().string();
+		if (fragmentPath)
+			description += " + " + std::filesystem::path(fragmentPath).filename().string();
+		std::string flags;
+		size_t position = 0;
+		while ((position = defines.find("#define ", position)) != std::string::npos)
+		{
+			position += 8;
+			size_t end = defines.find('\n', position);
+			flags += (flags.empty() ? "" : " ") + defines.substr(position, end == std::string::npos ? std::string::npos : end - position);
+		}
+		return flags.empty() ? description : description + " [" + flags + "]";
+	}
+
+	static std::string readSource(const char* path)
+	{
+		std::ifstream file;
+		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			file.open(path);
+			std::stringstream stream;
+			stream << file.rdbuf();
+			return stream.str();
+		}
+		catch (const std::ifstream::failure&)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		return "";
+	}
+
+	static unsigned int compileStage(GLenum type, const std::string& code, const char* label)
+	{
+		unsigned int shader = glCreateShader(type);
+		const char* source = code.c_str();
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		int success;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			char infoLog[512];
+			glGetShaderInfoLog(shader, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::" << label << "::COMPILATION_FAILED\n"
+				<< infoLog << std::endl;
+		}
+		return shader;
+	}
+
+	static std::string injectDefines(const std::string& code, const std::string& defines)
+	{
+		if (defines.empty())
+			return code;
+		size_t version = code.find("#version");
+		size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return defines + "\n" + code;
+		// #line keeps compiler messages pointing at the lines of the file on disk
+		return code.substr(0, lineEnd + 1) + defines + "\n#line 2\n" + code.substr(lineEnd + 1);
+	}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,355 @@
+#ifndef SHADERMANAGER_HPP
+#define SHADERMANAGER_HPP
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glext.hpp"
+#include "profiler.hpp"
+#include "shader.hpp"
+
+// Builds the renderer's programs. Compiles and links are submitted without asking for their
+// status, so a driver with parallel shader compile works on them while the caller goes on loading
+// assets, and finish() then waits for all of them at once. Linked programs are kept as driver
+// binaries in a cache directory, keyed by their sources and the driver, and later runs load those
+// instead of compiling.
+//
+// Cache file (<cache directory>/<key as 16 hex digits>.bin):
+//   ProgramCacheHeader
+//   driver binary (binarySize bytes)
+
+const uint32_t PROGRAM_CACHE_MAGIC = 0x4D475250; // "PRGM"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t binaryFormat;
+	uint32_t binarySize;
+	// Hash of the sources and the driver, the file name as well
+	uint64_t key;
+	// Main thread time that building the program from source took on the run that cached it
+	double buildMilliseconds;
+};
+
+struct ProgramStats
+{
+	// Source files and defines
+	std::string name;
+	bool cached = false;
+	bool failed = false;
+	// Main thread time spent on the program this run: submitting it and waiting for the link, or
+	// loading its binary
+	double milliseconds = 0.0;
+	// For a cached program, what building it from source took
+	double buildMilliseconds = 0.0;
+};
+
+class ShaderManager
+{
+public:
+	// Call once the context is current and loadGLExtensions has run. An empty cacheDirectory
+	// turns the cache off. Without parallel every program is waited for as it is requested.
+	void begin(const std::string& cacheDirectory, bool parallel)
+	{
+		driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+		// Drivers may support no binary formats at all
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		directory = formats > 0 ? cacheDirectory : "";
+		if (!directory.empty())
+		{
+			std::error_code error;
+			std::filesystem::create_directories(directory, error);
+		}
+		deferred = parallel;
+		parallelCompile = parallel && glMaxShaderCompilerThreadsKHR != nullptr &&
+			(hasGLExtension("GL_KHR_parallel_shader_compile") || hasGLExtension("GL_ARB_parallel_shader_compile"));
+		// As many compiler threads as the driver sees fit
+		if (parallelCompile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+
+	// Start building a program; defines are inserted right after the #version line of both
+	// stages. The ID is valid at once, but the program may only be used after finish().
+	Shader program(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
+	{
+		ProgramBuild build;
+		build.stats.name = Shader::describeSources(vertexPath, fragmentPath, defines);
+		build.sources.push_back({ GL_VERTEX_SHADER, Shader::injectDefines(Shader::readSource(vertexPath), defines) });
+		build.sources.push_back({ GL_FRAGMENT_SHADER, Shader::injectDefines(Shader::readSource(fragmentPath), defines) });
+		return submit(build);
+	}
+
+	// Vertex-only program whose outputs are captured with transform feedback, as for the Shader
+	// constructor of the same form
+	Shader program(const char* vertexPath, const std::vector<const char*>& feedbackVaryings, const std::string& defines = "")
+	{
+		ProgramBuild build;
+		build.stats.name = Shader::describeSources(vertexPath, nullptr, defines);
+		build.sources.push_back({ GL_VERTEX_SHADER, Shader::injectDefines(Shader::readSource(vertexPath), defines) });
+		build.feedbackVaryings = feedbackVaryings;
+		return submit(build);
+	}
+
+	// Wait for every program still building, report build errors and cache the new binaries
+	void finish()
+	{
+		PROFILE_SCOPE("Wait for programs");
+		auto start = std::chrono::steady_clock::now();
+		for (ProgramBuild& build : builds)
+		{
+			if (!build.done)
+				complete(build);
+		}
+		finishMilliseconds += millisecondsSince(start);
+	}
+
+	std::vector<ProgramStats> getStats() const
+	{
+		std::vector<ProgramStats> stats;
+		for (const ProgramBuild& build : builds)
+			stats.push_back(build.stats);
+		return stats;
+	}
+
+	// Per program, the main thread time it took and, for cached ones, what that saved over
+	// building from source
+	void printStats() const
+	{
+		unsigned int cached = 0;
+		double saved = 0.0;
+		for (const ProgramBuild& build : builds)
+		{
+			if (build.stats.cached)
+			{
+				cached++;
+				saved += build.stats.buildMilliseconds - build.stats.milliseconds;
+			}
+		}
+		std::cout << "Programs: " << builds.size() << ", " << cached << " from the binary cache"
+			<< (directory.empty() ? " (off)" : "") << ", parallel compile "
+			<< (parallelCompile ? "on" : deferred ? "not supported" : "off") << ", "
+			<< finishMilliseconds << " ms waiting for builds after loading" << std::endl;
+		char line[320];
+		for (const ProgramBuild& build : builds)
+		{
+			const ProgramStats& stats = build.stats;
+			if (stats.failed)
+				snprintf(line, sizeof(line), "  %s: failed to build", stats.name.c_str());
+			else if (stats.cached)
+				snprintf(line, sizeof(line), "  %s: %.2f ms from the cache, %.2f ms to build (saves %.2f ms)",
+					stats.name.c_str(), stats.milliseconds, stats.buildMilliseconds, stats.buildMilliseconds - stats.milliseconds);
+			else
+				snprintf(line, sizeof(line), "  %s: %.2f ms to build%s", stats.name.c_str(), stats.milliseconds, directory.empty() ? "" : ", cached for the next run");
+			std::cout << line << std::endl;
+		}
+		if (cached > 0)
+			std::cout << "  saved " << saved << " ms of startup in total" << std::endl;
+	}
+
+private:
+	struct StageSource
+	{
+		GLenum type;
+		std::string code;
+	};
+
+	struct ProgramBuild
+	{
+		ProgramStats stats;
+		std::vector<StageSource> sources;
+		std::vector<const char*> feedbackVaryings;
+		unsigned int program = 0;
+		std::vector<unsigned int> stages;
+		uint64_t key = 0;
+		bool done = false;
+	};
+
+	std::vector<ProgramBuild> builds;
+	std::string driver;
+	std::string directory;
+	bool deferred = true;
+	bool parallelCompile = false;
+	double finishMilliseconds = 0.0;
+
+	static std::string glString(GLenum name)
+	{
+		const char* value = (const char*)glGetString(name);
+		return value ? value : "";
+	}
+
+	// FNV-1a over the driver, the stage sources and the captured varyings
+	uint64_t cacheKey(const ProgramBuild& build) const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash](const char* data, size_t size)
+		{
+			for (size_t i = 0; i < size; i++)
+				hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+			// A separator, so that moving text from one part to the next changes the key
+			hash = (hash ^ 0xFF) * 1099511628211ull;
+		};
+		add(driver.data(), driver.size());
+		for (const StageSource& source : build.sources)
+		{
+			add((const char*)&source.type, sizeof(source.type));
+			add(source.code.data(), source.code.size());
+		}
+		for (const char* varying : build.feedbackVaryings)
+			add(varying, strlen(varying));
+		return hash;
+	}
+
+	std::string cachePath(uint64_t key) const
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return (std::filesystem::path(directory) / name).string();
+	}
+
+	Shader submit(ProgramBuild& build)
+	{
+		PROFILE_SCOPE("Submit program");
+		auto start = std::chrono::steady_clock::now();
+		Shader shader;
+		shader.ID = build.program = glCreateProgram();
+		shader.name = build.stats.name;
+		if (!directory.empty())
+		{
+			build.key = cacheKey(build);
+			if (loadBinary(build))
+			{
+				build.stats.cached = true;
+				build.stats.milliseconds = millisecondsSince(start);
+				build.sources.clear();
+				build.done = true;
+				builds.push_back(std::move(build));
+				return shader;
+			}
+		}
+
+		// No status queries here: they would wait for the driver to finish
+		for (const StageSource& source : build.sources)
+		{
+			unsigned int stage = glCreateShader(source.type);
+			const char* code = source.code.c_str();
+			glShaderSource(stage, 1, &code, NULL);
+			glCompileShader(stage);
+			glAttachShader(build.program, stage);
+			build.stages.push_back(stage);
+		}
+		if (!build.feedbackVaryings.empty())
+			glTransformFeedbackVaryings(build.program, (GLsizei)build.feedbackVaryings.size(), build.feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+		if (!directory.empty())
+			glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(build.program);
+		build.sources.clear();
+		build.stats.milliseconds = millisecondsSince(start);
+		builds.push_back(std::move(build));
+		if (!deferred)
+			complete(builds.back());
+		return shader;
+	}
+
+	// Wait for the link, then report what failed or cache the binary
+	void complete(ProgramBuild& build)
+	{
+		auto start = std::chrono::steady_clock::now();
+		int success;
+		glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+		build.stats.milliseconds += millisecondsSince(start);
+		char infoLog[512];
+		for (unsigned int stage : build.stages)
+		{
+			int compiled;
+			glGetShaderiv(stage, GL_COMPILE_STATUS, &compiled);
+			if (!compiled)
+			{
+				GLint type;
+				glGetShaderiv(stage, GL_SHADER_TYPE, &type);
+				glGetShaderInfoLog(stage, 512, NULL, infoLog);
+				std::cout << "ERROR::SHADER::" << (type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT") << "::COMPILATION_FAILED\n"
+					<< build.stats.name << "\n" << infoLog << std::endl;
+			}
+			// Linked into the program now and no longer necessary
+			glDetachShader(build.program, stage);
+			glDeleteShader(stage);
+		}
+		build.stages.clear();
+		if (!success)
+		{
+			glGetProgramInfoLog(build.program, 512, NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+				<< build.stats.name << "\n" << infoLog << std::endl;
+			build.stats.failed = true;
+		}
+		else if (!directory.empty())
+			saveBinary(build);
+		build.done = true;
+	}
+
+	// False when there is no usable binary, e.g. after a driver update the key did not capture
+	bool loadBinary(ProgramBuild& build)
+	{
+		std::ifstream file(cachePath(build.key), std::ios::binary);
+		if (!file)
+			return false;
+		ProgramCacheHeader header;
+		if (!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_CACHE_MAGIC ||
+			header.version != PROGRAM_CACHE_VERSION || header.key != build.key)
+			return false;
+		std::vector<char> binary(header.binarySize);
+		if (!file.read(binary.data(), binary.size()))
+			return false;
+		glProgramBinary(build.program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+		int success;
+		glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+		if (!success)
+			return false;
+		build.stats.buildMilliseconds = header.buildMilliseconds;
+		return true;
+	}
+
+	void saveBinary(const ProgramBuild& build)
+	{
+		GLint length = 0;
+		glGetProgramiv(build.program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(build.program, length, &length, &format, binary.data());
+
+		ProgramCacheHeader header = {};
+		header.magic = PROGRAM_CACHE_MAGIC;
+		header.version = PROGRAM_CACHE_VERSION;
+		header.binaryFormat = format;
+		header.binarySize = (uint32_t)length;
+		header.key = build.key;
+		header.buildMilliseconds = build.stats.milliseconds;
+		std::ofstream file(cachePath(build.key), std::ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write(binary.data(), length);
+		if (!file)
+			std::cout << "Could not write " << cachePath(build.key) << std::endl;
+	}
+};
+
+ShaderManager& shaderManager()
+{
+	static ShaderManager manager;
+	return manager;
+}
+
+#endif
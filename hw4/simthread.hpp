@@ -0,0 +1,131 @@
+#ifndef SIMTHREAD_HPP
+#define SIMTHREAD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <glm/glm.hpp>
+
+// State handed from the simulation to the renderer. Each side owns one slot of a triple buffer and
+// swaps it with a shared middle slot, so neither ever waits for the other: the simulation always has
+// a slot to fill, and the renderer always draws the newest complete step.
+
+// Lock-free exchange between one writing thread and one reading thread
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Give every slot the same starting value, before either thread uses the buffer. Slots that
+	// start out the right size keep later copies into them free of allocation.
+	void fill(const T& value)
+	{
+		for (T& slot : slots)
+			slot = value;
+	}
+
+	// The slot the writer fills, untouched by the reader
+	T& writeBuffer()
+	{
+		return slots[writeIndex];
+	}
+
+	// Hand the filled slot over and take the middle one to fill next
+	void publish()
+	{
+		unsigned int previous = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+		writeIndex = previous & indexMask;
+	}
+
+	// Switch to the newest published slot; false when nothing was published since the last call
+	bool acquire()
+	{
+		if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+			return false;
+		unsigned int previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & indexMask;
+		return true;
+	}
+
+	// The slot the reader holds, untouched by the writer
+	const T& readBuffer() const
+	{
+		return slots[readIndex];
+	}
+
+private:
+	static const unsigned int indexMask = 3;
+	// Set in the middle index while it holds a slot the reader has not taken yet
+	static const unsigned int freshBit = 4;
+
+	T slots[3];
+	unsigned int writeIndex = 0;
+	unsigned int readIndex = 1;
+	std::atomic<unsigned int> middle{ 2 };
+};
+
+// The last simulation step and the one before it, for drawing the state in between
+struct PoseSnapshot
+{
+	// Steps taken and simulated seconds at the last one
+	unsigned long long step = 0;
+	double time = 0.0;
+	// When the last step was published, to tell how far the renderer is into the next one
+	std::chrono::steady_clock::time_point published;
+
+	glm::vec3 previousCameraPos = glm::vec3(0.0f);
+	glm::vec3 cameraPos = glm::vec3(0.0f);
+	glm::vec3 previousCharacterPos = glm::vec3(0.0f);
+	glm::vec3 characterPos = glm::vec3(0.0f);
+	// World transforms of the scene nodes by sceneTransforms() slot, and the step each node last
+	// moved in. Nodes that did not move in the last step have the same transform in both lists.
+	std::vector<glm::mat4> previousNodeTransforms;
+	std::vector<glm::mat4> nodeTransforms;
+	std::vector<unsigned long long> nodeSteps;
+	// The animator's bone palette
+	std::vector<glm::mat4> previousBones;
+	std::vector<glm::mat4> bones;
+};
+
+// Copy from into a slot that holds the same scene at an older step. Node transforms that have not
+// changed since that step are the same in both and skipped, so a scene that holds still costs the
+// copy of the camera, the character and the bones.
+inline void copyPose(PoseSnapshot& into, const PoseSnapshot& from)
+{
+	bool whole = into.nodeSteps.size() != from.nodeSteps.size() || into.step > from.step;
+	if (whole)
+	{
+		into.previousNodeTransforms = from.previousNodeTransforms;
+		into.nodeTransforms = from.nodeTransforms;
+		into.nodeSteps = from.nodeSteps;
+	}
+	else
+	{
+		for (size_t i = 0; i < from.nodeSteps.size(); i++)
+		{
+			if (from.nodeSteps[i] < into.step)
+				continue;
+			into.previousNodeTransforms[i] = from.previousNodeTransforms[i];
+			into.nodeTransforms[i] = from.nodeTransforms[i];
+			into.nodeSteps[i] = from.nodeSteps[i];
+		}
+	}
+	into.step = from.step;
+	into.time = from.time;
+	into.published = from.published;
+	into.previousCameraPos = from.previousCameraPos;
+	into.cameraPos = from.cameraPos;
+	into.previousCharacterPos = from.previousCharacterPos;
+	into.characterPos = from.characterPos;
+	into.previousBones = from.previousBones;
+	into.bones = from.bones;
+}
+
+// Blend two lists of matrices alpha of the way into into, which must already have their size.
+// Blending skinning matrices and node transforms linearly is close enough over one short step.
+inline void interpolateMatrices(const std::vector<glm::mat4>& previous, const std::vector<glm::mat4>& current, float alpha, std::vector<glm::mat4>& into)
+{
+	for (size_t i = 0; i < into.size(); i++)
+		into[i] = alpha >= 1.0f ? current[i] : previous[i] * (1.0f - alpha) + current[i] * alpha;
+}
+
+#endif
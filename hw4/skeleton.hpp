@@ -0,0 +1,69 @@
+#ifndef SKELETON_HPP
+#define SKELETON_HPP
+
+#include <glm/glm.hpp>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// The part of a model that animation needs, without meshes, textures or GL. Model numbers the bones
+// of its meshes while importing them; loadSkeleton numbers them the same way from the file alone,
+// so headless tools pose the same bone IDs the renderer skins with.
+
+struct BoneProps
+{
+	std::string name;
+	glm::mat4 offset;
+};
+
+inline glm::mat4 aiMatrix4x4ToGlm(const aiMatrix4x4* from)
+{
+	glm::mat4 to;
+	to[0][0] = from->a1; to[1][0] = from->a2; to[2][0] = from->a3; to[3][0] = from->a4;
+	to[0][1] = from->b1; to[1][1] = from->b2; to[2][1] = from->b3; to[3][1] = from->b4;
+	to[0][2] = from->c1; to[1][2] = from->c2; to[2][2] = from->c3; to[3][2] = from->c4;
+	to[0][3] = from->d1; to[1][3] = from->d2; to[2][3] = from->d3; to[3][3] = from->d4;
+	return to;
+}
+
+// Add the mesh's bones that boneProps does not have yet, in the order Model assigns their IDs
+inline void appendMeshBones(const aiMesh* mesh, std::vector<BoneProps>& boneProps, std::map<std::string, int>& boneIDs)
+{
+	for (unsigned int i = 0; i < mesh->mNumBones; i++)
+	{
+		std::string name = mesh->mBones[i]->mName.C_Str();
+		if (boneIDs.find(name) != boneIDs.end())
+			continue;
+		boneProps.push_back({ name, aiMatrix4x4ToGlm(&mesh->mBones[i]->mOffsetMatrix) });
+		boneIDs[name] = (int)boneProps.size() - 1;
+	}
+}
+
+inline void appendNodeBones(const aiNode* node, const aiScene* scene, std::vector<BoneProps>& boneProps, std::map<std::string, int>& boneIDs)
+{
+	// Same traversal as Model::processNode: a node's meshes, then its children
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		appendMeshBones(scene->mMeshes[node->mMeshes[i]], boneProps, boneIDs);
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		appendNodeBones(node->mChildren[i], scene, boneProps, boneIDs);
+}
+
+// The bones of a model file. Returns false if the file cannot be imported.
+inline bool loadSkeleton(const std::string& path, std::vector<BoneProps>& boneProps)
+{
+	Assimp::Importer importer;
+	// Bones only need the node tree; no triangulation or normals
+	const aiScene* scene = importer.ReadFile(path, 0);
+	if (!scene || !scene->mRootNode)
+		return false;
+
+	boneProps.clear();
+	std::map<std::string, int> boneIDs;
+	appendNodeBones(scene->mRootNode, scene, boneProps, boneIDs);
+	return true;
+}
+
+#endif
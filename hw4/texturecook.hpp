@@ -0,0 +1,476 @@
+#ifndef TEXTURECOOK_HPP
+#define TEXTURECOOK_HPP
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "bcencode.hpp"
+#include "profiler.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// CPU side of the texture pipeline: decode, mip-chain generation, block compression and the
+// cooked mip container. Nothing here touches GL, so it runs on worker threads and in headless
+// cook tools.
+//
+// Cooked container (<source>.mips or <source>.<format>.mips, little endian):
+//   CookedHeader
+//   CookedLevel[levelCount]
+//   level data, each level starting on a 16-byte boundary
+
+const uint32_t COOKED_MAGIC = 0x5350494D; // "MIPS"
+const uint32_t COOKED_VERSION = 2;
+
+struct CookedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t levelCount;
+	uint32_t srgb;
+	// TextureCompression of the stored levels, and the one the cook was asked for. They differ
+	// when the source cannot be block compressed and was stored uncompressed instead.
+	uint32_t format;
+	uint32_t requestedFormat;
+	uint32_t reserved;
+	// Size and modification time of the source image; a mismatch means the cache is stale
+	uint64_t sourceSize;
+	int64_t sourceTime;
+};
+
+struct CookedLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+			data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			size = (size_t)info.st_size;
+			void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address != MAP_FAILED)
+				data = (const uint8_t*)address;
+		}
+		::close(fd);
+#endif
+		if (!data)
+			close();
+		return data != nullptr;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap((void*)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const uint8_t* getData() const { return data; }
+	size_t getSize() const { return size; }
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+};
+
+// A full mip chain, either built in memory or mapped from a cooked file
+struct CookedTexture
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t channels = 0;
+	bool srgb = false;
+	TextureCompression format = COMPRESS_NONE;
+	std::vector<CookedLevel> levels;
+
+	std::vector<uint8_t> storage;
+	MappedFile mapping;
+
+	const uint8_t* levelData(size_t level) const
+	{
+		const uint8_t* base = mapping.getData() ? mapping.getData() : storage.data();
+		return base + levels[level].offset;
+	}
+
+	size_t totalBytes() const
+	{
+		size_t bytes = 0;
+		for (const CookedLevel& level : levels)
+			bytes += (size_t)level.size;
+		return bytes;
+	}
+};
+
+inline float srgbToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linearToSrgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+inline float lanczos2(float x)
+{
+	x = fabs(x);
+	if (x < 1e-6f)
+		return 1.0f;
+	if (x >= 2.0f)
+		return 0.0f;
+	const float pi = 3.14159265358979f;
+	float px = pi * x;
+	return 2.0f * sinf(px) * sinf(px * 0.5f) / (px * px);
+}
+
+// Separable Lanczos-2 downsample of one float image to dstWidth x dstHeight, clamping at the edges
+void downsampleLanczos(const std::vector<float>& src, int srcWidth, int srcHeight, int channels,
+	std::vector<float>& dst, int dstWidth, int dstHeight)
+{
+	struct Tap { int index; float weight; };
+	auto buildTaps = [](int srcSize, int dstSize, std::vector<std::vector<Tap>>& taps)
+	{
+		float scale = (float)srcSize / (float)dstSize;
+		float support = 2.0f * scale;
+		taps.resize(dstSize);
+		for (int i = 0; i < dstSize; i++)
+		{
+			float center = (i + 0.5f) * scale;
+			int first = (int)floorf(center - support);
+			int last = (int)ceilf(center + support);
+			float total = 0.0f;
+			for (int j = first; j <= last; j++)
+			{
+				float weight = lanczos2((j + 0.5f - center) / scale);
+				if (weight == 0.0f)
+					continue;
+				taps[i].push_back({ std::min(std::max(j, 0), srcSize - 1), weight });
+				total += weight;
+			}
+			for (Tap& tap : taps[i])
+				tap.weight /= total;
+		}
+	};
+
+	std::vector<std::vector<Tap>> horizontal, vertical;
+	buildTaps(srcWidth, dstWidth, horizontal);
+	buildTaps(srcHeight, dstHeight, vertical);
+
+	std::vector<float> rows((size_t)dstWidth * srcHeight * channels, 0.0f);
+	for (int y = 0; y < srcHeight; y++)
+	{
+		for (int x = 0; x < dstWidth; x++)
+		{
+			float* out = &rows[((size_t)y * dstWidth + x) * channels];
+			for (const Tap& tap : horizontal[x])
+			{
+				const float* in = &src[((size_t)y * srcWidth + tap.index) * channels];
+				for (int c = 0; c < channels; c++)
+					out[c] += in[c] * tap.weight;
+			}
+		}
+	}
+
+	dst.assign((size_t)dstWidth * dstHeight * channels, 0.0f);
+	for (int y = 0; y < dstHeight; y++)
+	{
+		float* out = &dst[(size_t)y * dstWidth * channels];
+		for (const Tap& tap : vertical[y])
+		{
+			const float* in = &rows[(size_t)tap.index * dstWidth * channels];
+			for (int i = 0; i < dstWidth * channels; i++)
+				out[i] += in[i] * tap.weight;
+		}
+	}
+}
+
+// Build the full mip chain on the CPU. sRGB color channels are filtered in linear space; alpha is always linear.
+void generateMipChain(const uint8_t* pixels, int width, int height, int channels, bool srgb, CookedTexture& out)
+{
+	out.width = width;
+	out.height = height;
+	out.channels = channels;
+	out.srgb = srgb;
+	out.format = COMPRESS_NONE;
+	out.levels.clear();
+	out.storage.clear();
+
+	auto isColor = [&](int c) { return srgb && c < 3 && !(channels == 2 && c == 1); };
+
+	std::vector<float> current((size_t)width * height * channels);
+	for (size_t i = 0; i < current.size(); i++)
+	{
+		float value = pixels[i] / 255.0f;
+		current[i] = isColor((int)(i % channels)) ? srgbToLinear(value) : value;
+	}
+
+	auto appendLevel = [&](const uint8_t* data, int w, int h)
+	{
+		size_t size = (size_t)w * h * channels;
+		size_t offset = (out.storage.size() + 15) & ~(size_t)15;
+		out.storage.resize(offset + size);
+		memcpy(out.storage.data() + offset, data, size);
+		out.levels.push_back({ (uint32_t)w, (uint32_t)h, offset, size });
+	};
+
+	appendLevel(pixels, width, height);
+
+	std::vector<float> next;
+	std::vector<uint8_t> quantized;
+	int w = width, h = height;
+	while (w > 1 || h > 1)
+	{
+		int nw = std::max(1, w / 2);
+		int nh = std::max(1, h / 2);
+		downsampleLanczos(current, w, h, channels, next, nw, nh);
+
+		quantized.resize(next.size());
+		for (size_t i = 0; i < next.size(); i++)
+		{
+			float value = std::min(std::max(next[i], 0.0f), 1.0f);
+			if (isColor((int)(i % channels)))
+				value = linearToSrgb(value);
+			quantized[i] = (uint8_t)(value * 255.0f + 0.5f);
+		}
+		appendLevel(quantized.data(), nw, nh);
+
+		current.swap(next);
+		w = nw;
+		h = nh;
+	}
+}
+
+// Block compress every level of an uncompressed chain. Base levels that are not a multiple of 4
+// stay uncompressed, since GL only accepts partial blocks on the small mip levels.
+bool compressMipChain(const CookedTexture& source, TextureCompression compression, CookedTexture& out)
+{
+	if (compression == COMPRESS_NONE || source.width % 4 != 0 || source.height % 4 != 0)
+		return false;
+
+	out.width = source.width;
+	out.height = source.height;
+	out.channels = source.channels;
+	out.srgb = source.srgb;
+	out.format = compression;
+	out.levels.clear();
+	out.storage.clear();
+	for (size_t level = 0; level < source.levels.size(); level++)
+	{
+		const CookedLevel& info = source.levels[level];
+		size_t size = compressedLevelBytes(compression, info.width, info.height);
+		size_t offset = (out.storage.size() + 15) & ~(size_t)15;
+		out.storage.resize(offset + size);
+		compressImage(source.levelData(level), info.width, info.height, source.channels, compression, out.storage.data() + offset);
+		out.levels.push_back({ info.width, info.height, offset, size });
+	}
+	return true;
+}
+
+inline std::string cookedPathFor(const std::string& sourcePath, TextureCompression compression)
+{
+	if (compression == COMPRESS_NONE)
+		return sourcePath + ".mips";
+	return sourcePath + "." + compressionName(compression) + ".mips";
+}
+
+inline bool sourceStamp(const std::string& path, uint64_t& size, int64_t& time)
+{
+	std::error_code error;
+	size = (uint64_t)std::filesystem::file_size(path, error);
+	if (error)
+		return false;
+	time = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	return !error;
+}
+
+// Write to a temporary file and rename, so a concurrent reader never maps a partial file
+bool writeCookedTexture(const std::string& path, const CookedTexture& texture, TextureCompression requested,
+	uint64_t sourceSize, int64_t sourceTime)
+{
+	CookedHeader header = {};
+	header.magic = COOKED_MAGIC;
+	header.version = COOKED_VERSION;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.channels = texture.channels;
+	header.levelCount = (uint32_t)texture.levels.size();
+	header.srgb = texture.srgb ? 1 : 0;
+	header.format = texture.format;
+	header.requestedFormat = requested;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+
+	size_t dataStart = (sizeof(CookedHeader) + sizeof(CookedLevel) * texture.levels.size() + 15) & ~(size_t)15;
+	std::vector<CookedLevel> levels = texture.levels;
+	for (CookedLevel& level : levels)
+		level.offset += dataStart;
+
+	std::string temporary = path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(levels.data(), sizeof(CookedLevel), levels.size(), file) == levels.size();
+	std::vector<uint8_t> padding(dataStart - sizeof(CookedHeader) - sizeof(CookedLevel) * levels.size(), 0);
+	ok = ok && fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+	ok = ok && fwrite(texture.storage.data(), 1, texture.storage.size(), file) == texture.storage.size();
+	ok = fclose(file) == 0 && ok;
+
+	std::error_code error;
+	if (ok)
+		std::filesystem::rename(temporary, path, error);
+	if (!ok || error)
+	{
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+	return true;
+}
+
+// Map a cooked file. Fails when it is missing, malformed or older than the source.
+bool loadCookedTexture(const std::string& path, uint64_t sourceSize, int64_t sourceTime, bool srgb,
+	TextureCompression requested, CookedTexture& out)
+{
+	if (!out.mapping.open(path))
+		return false;
+
+	const uint8_t* data = out.mapping.getData();
+	size_t size = out.mapping.getSize();
+	if (size < sizeof(CookedHeader))
+		return false;
+
+	CookedHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != COOKED_MAGIC || header.version != COOKED_VERSION || header.sourceSize != sourceSize ||
+		header.sourceTime != sourceTime || (header.srgb != 0) != srgb || header.requestedFormat != requested ||
+		header.format > COMPRESS_BC7 || header.levelCount == 0 ||
+		sizeof(CookedHeader) + sizeof(CookedLevel) * header.levelCount > size)
+		return false;
+
+	out.width = header.width;
+	out.height = header.height;
+	out.channels = header.channels;
+	out.srgb = header.srgb != 0;
+	out.format = (TextureCompression)header.format;
+	out.levels.resize(header.levelCount);
+	memcpy(out.levels.data(), data + sizeof(CookedHeader), sizeof(CookedLevel) * header.levelCount);
+	for (const CookedLevel& level : out.levels)
+	{
+		if (level.offset + level.size > size)
+			return false;
+	}
+	return true;
+}
+
+// Map the cooked mip chain if it is current, otherwise decode the source, build the chain, compress
+// it and cook it. warm reports which of the two happened.
+bool cookOrLoadTexture(const std::string& sourcePath, bool srgb, TextureCompression compression, CookedTexture& out, bool& warm)
+{
+	PROFILE_SCOPE("Cook or load texture");
+	uint64_t size = 0;
+	int64_t time = 0;
+	if (!sourceStamp(sourcePath, size, time))
+		return false;
+
+	std::string cookedPath = cookedPathFor(sourcePath, compression);
+	warm = loadCookedTexture(cookedPath, size, time, srgb, compression, out);
+	if (warm)
+		return true;
+	out.mapping.close();
+
+	int width, height, channels;
+	ProfileScope decodeScope("Decode and build mips");
+	unsigned char* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, 0);
+	if (!pixels)
+		return false;
+	generateMipChain(pixels, width, height, channels, srgb, out);
+	stbi_image_free(pixels);
+	decodeScope.end();
+
+	ProfileScope compressScope("Compress mips");
+	CookedTexture compressed;
+	bool compressedOk = compressMipChain(out, compression, compressed);
+	compressScope.end();
+	if (compressedOk)
+	{
+		out.format = compressed.format;
+		out.levels.swap(compressed.levels);
+		out.storage.swap(compressed.storage);
+	}
+
+	if (!writeCookedTexture(cookedPath, out, compression, size, time))
+		printf("Warning: could not write cooked texture %s\n", cookedPath.c_str());
+	return true;
+}
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef TEXTUREMANAGER_HPP
+#define TEXTUREMANAGER_HPP
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "glext.hpp"
+#include "profiler.hpp"
+#include "texturecook.hpp"
+#include "workerpool.hpp"
+
+struct SamplerSettings
+{
+	GLint wrapS = GL_REPEAT;
+	GLint wrapT = GL_REPEAT;
+	GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+	GLint magFilter = GL_LINEAR;
+	bool gamma = false;
+
+	bool operator<(const SamplerSettings& other) const
+	{
+		return std::tie(wrapS, wrapT, minFilter, magFilter, gamma) <
+			std::tie(other.wrapS, other.wrapT, other.minFilter, other.magFilter, other.gamma);
+	}
+};
+
+struct TextureStats
+{
+	unsigned int hits = 0;
+	unsigned int misses = 0;
+	unsigned int failures = 0;
+	unsigned int residentTextures = 0;
+	size_t residentBytes = 0;
+
+	// Cold loads decode and cook the source, warm loads map the cooked file
+	unsigned int pending = 0;
+	unsigned int coldLoads = 0;
+	unsigned int warmLoads = 0;
+	double coldMilliseconds = 0.0;
+	double warmMilliseconds = 0.0;
+	double uploadMilliseconds = 0.0;
+
+	float hitRate() const
+	{
+		unsigned int requests = hits + misses;
+		return requests == 0 ? 0.0f : (float)hits / (float)requests;
+	}
+};
+
+inline GLenum compressedInternalFormat(TextureCompression compression, bool srgb)
+{
+	switch (compression)
+	{
+	case COMPRESS_BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case COMPRESS_BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case COMPRESS_BC4: return GL_COMPRESSED_RED_RGTC1;
+	case COMPRESS_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case COMPRESS_BC7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return 0;
+	}
+}
+
+void uploadUncompressedTexture(unsigned int textureID, const CookedTexture& texture, const SamplerSettings& sampler)
+{
+	GLenum format = GL_RGB;
+	GLenum internalFormat = GL_RGB8;
+	if (texture.channels == 1)
+	{
+		format = GL_RED;
+		internalFormat = GL_R8;
+	}
+	else if (texture.channels == 2)
+	{
+		format = GL_RG;
+		internalFormat = GL_RG8;
+	}
+	else if (texture.channels == 3)
+	{
+		format = GL_RGB;
+		internalFormat = sampler.gamma ? GL_SRGB8 : GL_RGB8;
+	}
+	else if (texture.channels == 4)
+	{
+		format = GL_RGBA;
+		internalFormat = sampler.gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexStorage2D(GL_TEXTURE_2D, (GLsizei)texture.levels.size(), internalFormat, texture.width, texture.height);
+
+	// Mip rows are tightly packed, which RGB levels narrower than 4 pixels are not by default
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t level = 0; level < texture.levels.size(); level++)
+	{
+		const CookedLevel& info = texture.levels[level];
+		glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, info.width, info.height, format, GL_UNSIGNED_BYTE, texture.levelData(level));
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Block compressed levels go up as they are stored. BC4 textures are swizzled to (r, r, r, 1) so
+// shaders can keep sampling them as color.
+void uploadCompressedTexture(unsigned int textureID, const CookedTexture& texture, const SamplerSettings& sampler)
+{
+	GLenum internalFormat = compressedInternalFormat(texture.format, sampler.gamma);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexStorage2D(GL_TEXTURE_2D, (GLsizei)texture.levels.size(), internalFormat, texture.width, texture.height);
+	for (size_t level = 0; level < texture.levels.size(); level++)
+	{
+		const CookedLevel& info = texture.levels[level];
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, info.width, info.height, internalFormat,
+			(GLsizei)info.size, texture.levelData(level));
+	}
+
+	if (texture.format == COMPRESS_BC4)
+	{
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+}
+
+// Upload a CPU-built or mapped mip chain into immutable storage of an existing texture name
+void uploadCookedTexture(unsigned int textureID, const CookedTexture& texture, const SamplerSettings& sampler)
+{
+	if (texture.format != COMPRESS_NONE)
+		uploadCompressedTexture(textureID, texture, sampler);
+	else
+		uploadUncompressedTexture(textureID, texture, sampler);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrapS);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrapT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.minFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.magFilter);
+}
+
+const size_t FALLBACK_TEXTURE_BYTES = 4;
+
+// One magenta texel, which stands out where a texture is missing. A single 1x1 level is a complete
+// mip chain for any filter, and the storage is mutable so a later load can still give the name its
+// immutable one.
+void uploadFallbackTexture(unsigned int textureID)
+{
+	const unsigned char magenta[4] = { 255, 0, 255, 255 };
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, magenta);
+}
+
+// Shares GL textures between meshes and model instances. Textures are keyed by the resolved file
+// path and the sampler settings, and are deleted when the last reference is released.
+//
+// With asyncLoading, acquire returns a texture name right away while a worker thread decodes the
+// image (or maps its cooked mip chain); processUploads, called once per frame on the GL thread,
+// fills in the storage of every finished texture.
+//
+// A texture that fails to load keeps its name, filled with a fallback texel, so its holders stay
+// valid. The next acquire of the same file loads it again into that name.
+class TextureManager
+{
+public:
+	bool asyncLoading = true;
+
+	unsigned int acquire(const std::string& path, const std::string& directory, const SamplerSettings& sampler = SamplerSettings(),
+		TextureCompression compression = COMPRESS_NONE)
+	{
+		TextureKey key = { resolvePath(path, directory), sampler, compression };
+
+		auto found = textures.find(key);
+		if (found != textures.end())
+		{
+			stats.hits++;
+			found->second.references++;
+			// A file that appeared or was fixed since is picked up without the holders letting go
+			if (found->second.failed && !found->second.pending)
+				load(found->first, found->second);
+			return found->second.id;
+		}
+
+		stats.misses++;
+		unsigned int id;
+		glGenTextures(1, &id);
+		keysByID[id] = key;
+		auto entry = textures.insert({ key, { id, 1, 0, nullptr, false } }).first;
+		load(entry->first, entry->second);
+		return id;
+	}
+
+	// Upload every texture whose worker finished; call on the GL thread
+	void processUploads()
+	{
+		std::vector<std::unique_ptr<LoadJob>> finished;
+		{
+			std::lock_guard<std::mutex> lock(completedMutex);
+			finished.swap(completed);
+		}
+		for (std::unique_ptr<LoadJob>& job : finished)
+		{
+			stats.pending--;
+			// Released while loading; the name may since have been handed to another texture, which
+			// then waits for a job of its own
+			auto key = keysByID.find(job->textureID);
+			if (key == keysByID.end())
+				continue;
+			auto entry = textures.find(key->second);
+			if (entry->second.pending != job.get())
+				continue;
+			entry->second.pending = nullptr;
+			finishJob(entry->second, *job);
+		}
+	}
+
+	// Block until every queued texture is uploaded
+	void waitForUploads()
+	{
+		while (stats.pending > 0)
+		{
+			processUploads();
+			std::this_thread::yield();
+		}
+	}
+
+	void release(unsigned int id)
+	{
+		auto key = keysByID.find(id);
+		if (key == keysByID.end())
+			return;
+
+		auto entry = textures.find(key->second);
+		if (--entry->second.references > 0)
+			return;
+
+		glDeleteTextures(1, &id);
+		if (entry->second.bytes > 0)
+		{
+			stats.residentTextures--;
+			stats.residentBytes -= entry->second.bytes;
+		}
+		textures.erase(entry);
+		keysByID.erase(key);
+	}
+
+	unsigned int referenceCount(unsigned int id) const
+	{
+		auto key = keysByID.find(id);
+		return key == keysByID.end() ? 0 : textures.at(key->second).references;
+	}
+
+	const TextureStats& getStats() const { return stats; }
+
+	void printStats() const
+	{
+		std::cout << "Textures: " << stats.residentTextures << " resident, "
+			<< stats.residentBytes / 1024 << " KiB, "
+			<< stats.hits << " hits / " << stats.misses << " misses ("
+			<< stats.hitRate() * 100.0f << "% hit rate)";
+		if (stats.failures > 0)
+			std::cout << ", " << stats.failures << " failed";
+		if (stats.pending > 0)
+			std::cout << ", " << stats.pending << " loading";
+		std::cout << std::endl;
+		if (stats.coldLoads > 0)
+			std::cout << "  cold loads (decode + mips + cook): " << stats.coldLoads << ", "
+				<< stats.coldMilliseconds / stats.coldLoads << " ms avg" << std::endl;
+		if (stats.warmLoads > 0)
+			std::cout << "  warm loads (mapped cooked file): " << stats.warmLoads << ", "
+				<< stats.warmMilliseconds / stats.warmLoads << " ms avg" << std::endl;
+		if (stats.coldLoads + stats.warmLoads > 0)
+			std::cout << "  upload: " << stats.uploadMilliseconds / (stats.coldLoads + stats.warmLoads) << " ms avg" << std::endl;
+	}
+
+private:
+	struct TextureKey
+	{
+		std::string path;
+		SamplerSettings sampler;
+		TextureCompression compression;
+
+		bool operator<(const TextureKey& other) const
+		{
+			if (path != other.path)
+				return path < other.path;
+			if (compression != other.compression)
+				return compression < other.compression;
+			return sampler < other.sampler;
+		}
+	};
+
+	struct LoadJob
+	{
+		unsigned int textureID = 0;
+		std::string path;
+		SamplerSettings sampler;
+		TextureCompression compression = COMPRESS_NONE;
+		CookedTexture texture;
+		bool ok = false;
+		bool warm = false;
+		double loadMilliseconds = 0.0;
+	};
+
+	struct TextureEntry
+	{
+		unsigned int id;
+		unsigned int references;
+		// 0 until the storage is uploaded
+		size_t bytes;
+		// The load that fills the storage, null once it is done; jobs of names released and
+		// generated again while they ran do not match
+		const LoadJob* pending;
+		// The last load failed and the name holds the fallback texel
+		bool failed;
+	};
+
+	std::map<TextureKey, TextureEntry> textures;
+	std::map<unsigned int, TextureKey> keysByID;
+	TextureStats stats;
+
+	std::mutex completedMutex;
+	std::vector<std::unique_ptr<LoadJob>> completed;
+	// Declared last so the workers are joined before the members they write to are destroyed
+	std::unique_ptr<WorkerPool> workers;
+
+	// Worker side: no GL calls
+	static void runJob(LoadJob& job)
+	{
+		auto start = std::chrono::steady_clock::now();
+		job.ok = cookOrLoadTexture(job.path, job.sampler.gamma, job.compression, job.texture, job.warm);
+		job.loadMilliseconds = millisecondsSince(start);
+	}
+
+	// Fill the entry's name from its file, right away or on a worker
+	void load(const TextureKey& key, TextureEntry& entry)
+	{
+		std::unique_ptr<LoadJob> job(new LoadJob());
+		job->textureID = entry.id;
+		job->path = key.path;
+		job->sampler = key.sampler;
+		job->compression = key.compression;
+
+		if (!asyncLoading)
+		{
+			runJob(*job);
+			finishJob(entry, *job);
+			return;
+		}
+
+		entry.pending = job.get();
+		stats.pending++;
+		if (!workers)
+			workers.reset(new WorkerPool("Texture loader"));
+		LoadJob* raw = job.release();
+		workers->submit([this, raw]()
+		{
+			runJob(*raw);
+			std::lock_guard<std::mutex> lock(completedMutex);
+			completed.emplace_back(raw);
+		});
+	}
+
+	// GL side: upload and account
+	void finishJob(TextureEntry& entry, LoadJob& job)
+	{
+		if (!job.ok)
+		{
+			std::cout << "Texture failed to load at path: " << job.path << std::endl;
+			stats.failures++;
+			if (!entry.failed)
+			{
+				uploadFallbackTexture(entry.id);
+				entry.failed = true;
+				setResidentBytes(entry, FALLBACK_TEXTURE_BYTES);
+			}
+			return;
+		}
+
+		PROFILE_SCOPE("Upload texture");
+		auto start = std::chrono::steady_clock::now();
+		uploadCookedTexture(job.textureID, job.texture, job.sampler);
+		stats.uploadMilliseconds += millisecondsSince(start);
+
+		if (job.warm)
+		{
+			stats.warmLoads++;
+			stats.warmMilliseconds += job.loadMilliseconds;
+		}
+		else
+		{
+			stats.coldLoads++;
+			stats.coldMilliseconds += job.loadMilliseconds;
+		}
+
+		entry.failed = false;
+		setResidentBytes(entry, job.texture.totalBytes());
+	}
+
+	// A fallback counts as resident until a load replaces it
+	void setResidentBytes(TextureEntry& entry, size_t bytes)
+	{
+		if (entry.bytes == 0)
+			stats.residentTextures++;
+		stats.residentBytes = stats.residentBytes - entry.bytes + bytes;
+		entry.bytes = bytes;
+	}
+
+	// "a/./textures/../textures/x.png" and "a/textures/x.png" must share an entry
+	static std::string resolvePath(const std::string& path, const std::string& directory)
+	{
+		std::filesystem::path full = std::filesystem::path(directory) / path;
+		std::error_code error;
+		std::filesystem::path resolved = std::filesystem::weakly_canonical(full, error);
+		if (error)
+			resolved = full.lexically_normal();
+		return resolved.generic_string();
+	}
+};
+
+TextureManager& textureManager()
+{
+	static TextureManager manager;
+	return manager;
+}
+
+#endif
@@ -7,53 +7,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <vector>
+#include <cstddef>
 
 #include "mesh.hpp"
-
-void computeTangentBasis(
-	std::vector<glm::vec3>& vertices,
-	std::vector<glm::vec2>& uvs,
-	std::vector<glm::vec3>& normals,
-	std::vector<glm::vec3>& tangents,
-	std::vector<glm::vec3>& bitangents)
-{
-	for (size_t i = 0; i < vertices.size() - 2; i += 3)
-	{
-
-		// Shortcuts for vertices
-		glm::vec3& v0 = vertices[i + 0];
-		glm::vec3& v1 = vertices[i + 1];
-		glm::vec3& v2 = vertices[i + 2];
-
-		// Shortcuts for UVs
-		glm::vec2& uv0 = uvs[i + 0];
-		glm::vec2& uv1 = uvs[i + 1];
-		glm::vec2& uv2 = uvs[i + 2];
-
-		// Edges of the triangle : position delta
-		glm::vec3 deltaPos1 = v1 - v0;
-		glm::vec3 deltaPos2 = v2 - v0;
-
-		// UV delta
-		glm::vec2 deltaUV1 = uv1 - uv0;
-		glm::vec2 deltaUV2 = uv2 - uv0;
-
-		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-		glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
-		glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r;
-
-		// Set the same tangent for all three vertices of the triangle.
-		// They will be merged later, in vboindexer.cpp
-		tangents.push_back(tangent);
-		tangents.push_back(tangent);
-		tangents.push_back(tangent);
-
-		// Same thing for bitangents
-		bitangents.push_back(bitangent);
-		bitangents.push_back(bitangent);
-		bitangents.push_back(bitangent);
-	}
-}
+#include "vertexformat.hpp"
 
 template <class T>
 unsigned int generateAttribute(int id, int elementsPerEntry, std::vector<T> data, bool normalize, bool integer = false)
@@ -70,6 +27,57 @@ unsigned int generateAttribute(int id, int elementsPerEntry, std::vector<T> data
 	return bufferID;
 }
 
+// The full mesh's indices followed by those of every LOD, all in one element buffer
+std::vector<unsigned int> elementIndices(const Mesh& mesh)
+{
+	std::vector<unsigned int> indices = mesh.indices;
+	for (const MeshLod& lod : mesh.lods)
+		indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+	return indices;
+}
+
+// Where a mesh of a batch lives in the combined buffers: indices are local to the mesh and drawn with
+// baseVertex, firstIndex is where elementIndices(mesh) starts in the combined element buffer
+struct BatchRange
+{
+	unsigned int baseVertex;
+	unsigned int firstIndex;
+};
+
+// Concatenate meshes into one with every attribute present, so they can share a VAO. Tangents are
+// computed per mesh the way the upload functions would.
+Mesh combineMeshes(const std::vector<Mesh*>& meshes, std::vector<BatchRange>& ranges)
+{
+	Mesh combined;
+	ranges.clear();
+	for (Mesh* mesh : meshes)
+	{
+		ranges.push_back({ (unsigned int)combined.vertices.size(), (unsigned int)combined.indices.size() });
+
+		std::vector<glm::vec3> tangents = mesh->tangents;
+		std::vector<glm::vec3> bitangents = mesh->bitangents;
+		if (tangents.empty() && !mesh->textureCoordinates.empty())
+			computeTangentBasis(mesh->vertices, mesh->textureCoordinates, mesh->normals, tangents, bitangents);
+
+		for (size_t i = 0; i < mesh->vertices.size(); i++)
+		{
+			glm::vec3 normal = i < mesh->normals.size() ? mesh->normals[i] : glm::vec3(0, 0, 1);
+			glm::vec3 tangent = i < tangents.size() ? tangents[i] : anyPerpendicular(normal);
+			combined.vertices.push_back(mesh->vertices[i]);
+			combined.normals.push_back(normal);
+			combined.textureCoordinates.push_back(i < mesh->textureCoordinates.size() ? mesh->textureCoordinates[i] : glm::vec2(0.0f));
+			combined.tangents.push_back(tangent);
+			combined.bitangents.push_back(i < bitangents.size() ? bitangents[i] : glm::cross(normal, tangent));
+			combined.boneIDs.push_back(i < mesh->boneIDs.size() ? mesh->boneIDs[i] : glm::ivec4(-1));
+			combined.weights.push_back(i < mesh->weights.size() ? mesh->weights[i] : glm::vec4(0.0f));
+		}
+
+		std::vector<unsigned int> indices = elementIndices(*mesh);
+		combined.indices.insert(combined.indices.end(), indices.begin(), indices.end());
+	}
+	return combined;
+}
+
 unsigned int generateBuffer(Mesh& mesh)
 {
 	unsigned int vaoID;
@@ -113,7 +121,72 @@ unsigned int generateBuffer(Mesh& mesh)
 	unsigned int indexBufferID;
 	glGenBuffers(1, &indexBufferID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
+	std::vector<unsigned int> indices = elementIndices(mesh);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+	return vaoID;
+}
+
+// Upload a mesh using the interleaved PackedVertex layout. indexType receives GL_UNSIGNED_SHORT
+// when all indices fit in 16 bits and GL_UNSIGNED_INT otherwise.
+template <class W>
+unsigned int generatePackedBuffer(Mesh& mesh, unsigned int& indexType)
+{
+	unsigned int vaoID;
+	glGenVertexArrays(1, &vaoID);
+	glBindVertexArray(vaoID);
+
+	// Init tangents
+	std::vector<glm::vec3> tangents;
+	std::vector<glm::vec3> bitangents;
+
+	if (mesh.tangents.size() == 0 && mesh.textureCoordinates.size() > 0)
+	{
+		// Compute tangents
+		computeTangentBasis(mesh.vertices, mesh.textureCoordinates, mesh.normals, tangents, bitangents);
+	}
+	else
+	{
+		// Use loaded tangets/bitangents
+		tangents = mesh.tangents;
+		bitangents = mesh.bitangents;
+	}
+
+	std::vector<PackedVertex<W>> packed = packVertices<W>(mesh, tangents, bitangents);
+	const GLsizei stride = sizeof(PackedVertex<W>);
+	const GLenum weightType = sizeof(W) == 1 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+
+	unsigned int bufferID;
+	glGenBuffers(1, &bufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * stride, packed.data(), GL_STATIC_DRAW);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex<W>, position));
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(1, 4, GL_SHORT, stride, (void*)offsetof(PackedVertex<W>, frame));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex<W>, uv));
+	glEnableVertexAttribArray(2);
+	glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, stride, (void*)offsetof(PackedVertex<W>, boneIDs));
+	glEnableVertexAttribArray(5);
+	glVertexAttribPointer(6, 4, weightType, GL_TRUE, stride, (void*)offsetof(PackedVertex<W>, weights));
+	glEnableVertexAttribArray(6);
+
+	unsigned int indexBufferID;
+	glGenBuffers(1, &indexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+	std::vector<unsigned int> indices = elementIndices(mesh);
+	if (fitsShortIndices(mesh))
+	{
+		std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+		indexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+		indexType = GL_UNSIGNED_INT;
+	}
 
 	return vaoID;
 }
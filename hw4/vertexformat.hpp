@@ -0,0 +1,145 @@
+#ifndef VERTEXFORMAT_HPP
+#define VERTEXFORMAT_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+// Interleaved, quantized vertex layout used for skinned meshes.
+//
+//   location 0  position   3 x float32
+//   location 1  frame      4 x int16    octahedral normal.xy, octahedral tangent.xy
+//                                        (LSB of tangent.y holds the bitangent sign)
+//   location 2  uv         2 x float16
+//   location 5  bone IDs   4 x uint8
+//   location 6  weights    4 x unorm8 or unorm16
+//
+// 32 bytes per vertex with 8-bit weights and 36 with 16-bit weights, against 88 bytes
+// for the seven separate float/int streams uploaded by generateBuffer.
+template <class W>
+struct PackedVertex
+{
+	float position[3];
+	int16_t frame[4];
+	uint16_t uv[2];
+	uint8_t boneIDs[4];
+	W weights[4];
+};
+
+typedef PackedVertex<uint8_t> PackedVertex8;
+typedef PackedVertex<uint16_t> PackedVertex16;
+
+// Bone IDs at or above this value cannot be addressed by the shaders' palette
+const int PACKED_MAX_BONES = 100;
+
+inline float signNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Map a unit vector onto the [-1, 1] square (octahedral projection)
+inline glm::vec2 octEncode(glm::vec3 n)
+{
+	n /= (fabs(n.x) + fabs(n.y) + fabs(n.z));
+	glm::vec2 p(n.x, n.y);
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - fabs(n.y)) * signNotZero(n.x), (1.0f - fabs(n.x)) * signNotZero(n.y));
+	return p;
+}
+
+inline glm::vec3 octDecode(glm::vec2 e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+	float t = glm::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+inline int16_t quantizeSnorm16(float v)
+{
+	return (int16_t)glm::round(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+template <class W>
+inline W quantizeUnorm(float v)
+{
+	const float maxValue = (float)((1u << (8 * sizeof(W))) - 1);
+	return (W)glm::round(glm::clamp(v, 0.0f, 1.0f) * maxValue);
+}
+
+// Any unit vector perpendicular to n, used when a mesh carries no tangents
+inline glm::vec3 anyPerpendicular(const glm::vec3& n)
+{
+	glm::vec3 axis = fabs(n.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+	return glm::normalize(glm::cross(n, axis));
+}
+
+template <class W>
+PackedVertex<W> packVertex(const glm::vec3& position, glm::vec3 normal, glm::vec3 tangent, const glm::vec3& bitangent,
+	const glm::vec2& uv, const glm::ivec4& boneIDs, const glm::vec4& weights)
+{
+	PackedVertex<W> v;
+	v.position[0] = position.x;
+	v.position[1] = position.y;
+	v.position[2] = position.z;
+
+	normal = glm::normalize(normal);
+	// Gram-Schmidt so the decoded frame is orthonormal; the bitangent is rebuilt as sign * cross(n, t)
+	tangent = tangent - normal * glm::dot(normal, tangent);
+	if (glm::dot(tangent, tangent) < 1e-12f)
+		tangent = anyPerpendicular(normal);
+	tangent = glm::normalize(tangent);
+	bool flipped = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f;
+
+	glm::vec2 n = octEncode(normal);
+	glm::vec2 t = octEncode(tangent);
+	v.frame[0] = quantizeSnorm16(n.x);
+	v.frame[1] = quantizeSnorm16(n.y);
+	v.frame[2] = quantizeSnorm16(t.x);
+	v.frame[3] = (int16_t)((quantizeSnorm16(t.y) & ~1) | (flipped ? 1 : 0));
+
+	v.uv[0] = glm::packHalf1x16(uv.x);
+	v.uv[1] = glm::packHalf1x16(uv.y);
+
+	// Empty or unaddressable slots become bone 0 with zero weight so the shader needs no branch
+	for (int i = 0; i < 4; i++)
+	{
+		bool valid = boneIDs[i] >= 0 && boneIDs[i] < PACKED_MAX_BONES;
+		v.boneIDs[i] = valid ? (uint8_t)boneIDs[i] : 0;
+		v.weights[i] = valid ? quantizeUnorm<W>(weights[i]) : 0;
+	}
+	return v;
+}
+
+// Build the interleaved vertex stream for a mesh. Missing streams fall back to neutral values.
+template <class W>
+std::vector<PackedVertex<W>> packVertices(const Mesh& mesh, const std::vector<glm::vec3>& tangents, const std::vector<glm::vec3>& bitangents)
+{
+	std::vector<PackedVertex<W>> packed;
+	packed.reserve(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		glm::vec3 normal = i < mesh.normals.size() ? mesh.normals[i] : glm::vec3(0, 0, 1);
+		glm::vec3 tangent = i < tangents.size() ? tangents[i] : anyPerpendicular(normal);
+		glm::vec3 bitangent = i < bitangents.size() ? bitangents[i] : glm::cross(normal, tangent);
+		glm::vec2 uv = i < mesh.textureCoordinates.size() ? mesh.textureCoordinates[i] : glm::vec2(0.0f);
+		glm::ivec4 boneIDs = i < mesh.boneIDs.size() ? mesh.boneIDs[i] : glm::ivec4(-1);
+		glm::vec4 weights = i < mesh.weights.size() ? mesh.weights[i] : glm::vec4(0.0f);
+		packed.push_back(packVertex<W>(mesh.vertices[i], normal, tangent, bitangent, uv, boneIDs, weights));
+	}
+	return packed;
+}
+
+// True when every index fits in 16 bits
+inline bool fitsShortIndices(const Mesh& mesh)
+{
+	return mesh.vertices.size() <= 0xFFFF;
+}
+
+#endif
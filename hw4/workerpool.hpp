@@ -0,0 +1,110 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.hpp"
+
+// Small fixed-size thread pool. submit queues jobs that run in any order; parallelFor splits one
+// job into ranges that the workers and the calling thread share.
+class WorkerPool
+{
+public:
+	// Threads are named "<name> <index>" in profiles. The default leaves a core to the main thread,
+	// but keeps one worker when the core count is unknown.
+	explicit WorkerPool(const std::string& name, unsigned int threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1)
+	{
+		for (unsigned int i = 0; i < threadCount; i++)
+			threads.emplace_back([this, name, i]() { setProfilerThreadName(name + " " + std::to_string(i)); run(); });
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	// Run body for every range in [0, ranges) and return once all are done. The calling thread claims
+	// ranges too, so a pool without threads, or one busy with other jobs, still finishes the work.
+	void parallelFor(size_t ranges, const std::function<void(size_t)>& body)
+	{
+		std::atomic<size_t> nextRange{ 0 };
+		auto runRanges = [&]()
+		{
+			for (size_t range = nextRange++; range < ranges; range = nextRange++)
+				body(range);
+		};
+
+		// Helpers refer to this frame, so it is left only after every one of them has returned
+		std::mutex doneMutex;
+		std::condition_variable done;
+		size_t helpers = std::min(threads.size(), ranges > 0 ? ranges - 1 : 0);
+		size_t finishedHelpers = 0;
+		for (size_t i = 0; i < helpers; i++)
+		{
+			submit([&]()
+			{
+				runRanges();
+				std::lock_guard<std::mutex> lock(doneMutex);
+				finishedHelpers++;
+				done.notify_one();
+			});
+		}
+		runRanges();
+		std::unique_lock<std::mutex> lock(doneMutex);
+		done.wait(lock, [&]() { return finishedHelpers == helpers; });
+	}
+
+	unsigned int threadCount() const { return (unsigned int)threads.size(); }
+
+private:
+	std::vector<std::thread> threads;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	void run()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+};
+
+#endif
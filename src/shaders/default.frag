@@ -9,7 +9,13 @@ in vec3 bitangents;
 out vec4 FragColor;
 
 layout (location = 3) uniform vec3 camPos;
+#ifdef MULTI_DRAW
+// The node type of the draw, from its DrawData record
+flat in uint drawType;
+#define type drawType
+#else
 layout (location = 4) uniform uint type;
+#endif
 layout (location = 5) uniform mat4 lightSpaceMatrix;
 
 layout (binding = 0) uniform sampler2D texSampler;
@@ -81,7 +87,13 @@ void main()
 
         // TBN x}BzkuK
         mat3 TBN = mat3(tangents, bitangents, norm);
+#ifdef NORMAL_MAP_RG
+        // Two channel (BC5) normal map: rebuild z from the unit length
+        vec2 xy = 2 * texture(normSampler, texCoords).rg - 1;
+        norm = TBN * vec3(xy, sqrt(max(1 - dot(xy, xy), 0)));
+#else
         norm = TBN * ((2 * vec3(texture(normSampler, texCoords))) - 1);
+#endif
         norm = normalize(norm);
     }
 
@@ -1,5 +1,15 @@
 #version 430 core
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in ivec4 aFrame; // octahedral normal.xy, tangent.xy; LSB of tangent.y is the bitangent sign
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in uvec4 boneIds;
+layout (location = 6) in vec4 weights;
+#else
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
@@ -7,11 +17,29 @@ layout (location = 3) in vec3 aTangents;
 layout (location = 4) in vec3 aBitangents;
 layout (location = 5) in ivec4 boneIds; 
 layout (location = 6) in vec4 weights;
+#endif
+#ifdef PRESKINNED
+// Written by skin.vert; aPos is already skinned for characters
+layout (location = 7) in vec3 aSkinnedNormal;
+#endif
 
-layout (location = 0) uniform mat4 M;
 layout (location = 1) uniform mat4 V;
 layout (location = 2) uniform mat4 P;
+#ifdef MULTI_DRAW
+// One record per indirect command, written by RenderQueue::uploadIndirect; a command's baseInstance
+// is the index of its record
+struct DrawData
+{
+    mat4 model;
+    uint type;
+    uint paletteOffset;
+};
+layout (std430, binding = 0) readonly buffer DrawBuffer { DrawData draws[]; };
+flat out uint drawType;
+#else
+layout (location = 0) uniform mat4 M;
 layout (location = 4) uniform uint type;
+#endif
 
 out vec3 normal;
 out vec3 FragPos;
@@ -19,18 +47,63 @@ out vec2 texCoords;
 out vec3 tangents;
 out vec3 bitangents;
 
+#ifndef PRESKINNED
 const int MAX_BONES = 100;
+// INFLUENCE_COUNT specializes the shader for a bucket of vertices with at most that many influences
+#ifdef INFLUENCE_COUNT
+const int MAX_BONE_INFLUENCE = INFLUENCE_COUNT;
+#else
 const int MAX_BONE_INFLUENCE = 4;
+#endif
+#ifdef MULTI_DRAW
+// The palettes of all characters; a draw's bones start at its paletteOffset
+layout (std430, binding = 1) readonly buffer BoneBuffer { mat4 bones[]; };
+uint paletteOffset = 0u;
+mat4 boneTransform(int id) { return bones[paletteOffset + uint(id)]; }
+#else
 uniform mat4 boneTransforms[MAX_BONES];
+mat4 boneTransform(int id) { return boneTransforms[id]; }
+#endif
+#endif
+
+#ifdef PACKED_VERTEX
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+#endif
 
 void main()
 {
+#ifdef MULTI_DRAW
+    DrawData draw = draws[gl_BaseInstanceARB];
+    mat4 M = draw.model;
+    uint type = draw.type;
+    drawType = type;
+#ifndef PRESKINNED
+    paletteOffset = draw.paletteOffset;
+#endif
+#endif
+#ifdef PACKED_VERTEX
+    vec3 aNormal = octDecode(vec2(aFrame.xy) / 32767.0);
+    vec3 aTangents = octDecode(vec2(aFrame.z, aFrame.w & ~1) / 32767.0);
+    vec3 aBitangents = cross(aNormal, aTangents) * ((aFrame.w & 1) != 0 ? -1.0 : 1.0);
+#endif
+
     vec4 updatedPosition = vec4(0.0f);
     vec3 updatedNormal = vec3(0.0f);
 
+#ifdef PRESKINNED
+    updatedPosition = vec4(aPos, 1.0f);
+    updatedNormal = type == 5 ? aSkinnedNormal : aNormal;
+#else
     if(type == 5) {
         for(int i = 0 ; i < MAX_BONE_INFLUENCE ; i++)
         {
+#ifndef PACKED_VERTEX
             // Current bone-weight pair is non-existing
             if(boneIds[i] == -1) 
                 continue;
@@ -41,17 +114,21 @@ void main()
                 updatedPosition = vec4(aPos,1.0f);
                 break;
             }
+#else
+            // Unused slots are packed as bone 0 with zero weight, so no branch is needed
+#endif
             // Set pos
-            vec4 localPosition = boneTransforms[boneIds[i]] * vec4(aPos,1.0f);
+            vec4 localPosition = boneTransform(int(boneIds[i])) * vec4(aPos,1.0f);
             updatedPosition += localPosition * weights[i];
             // Set normal
-            vec3 localNormal = mat3(boneTransforms[boneIds[i]]) * aNormal;
+            vec3 localNormal = mat3(boneTransform(int(boneIds[i]))) * aNormal;
             updatedNormal += localNormal * weights[i];
         }
     } else {
         updatedPosition = vec4(aPos, 1.0f);
         updatedNormal = aNormal;
     }
+#endif
  
     gl_Position = P * V * M * updatedPosition;
     FragPos = vec3(M * vec4(vec3(updatedPosition), 1.0));
@@ -1,24 +1,71 @@
 #version 430 core
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout (location = 0) in vec3 aPos;
+#ifdef PACKED_VERTEX
+layout (location = 5) in uvec4 boneIds;
+#else
 layout (location = 5) in ivec4 boneIds; 
+#endif
 layout (location = 6) in vec4 weights;
 
 layout (location = 1) uniform mat4 lightSpaceMatrix;
-layout (location = 0) uniform mat4 model;
+#ifdef MULTI_DRAW
+// One record per indirect command, written by RenderQueue::uploadIndirect; a command's baseInstance
+// is the index of its record
+struct DrawData
+{
+    mat4 model;
+    uint type;
+    uint paletteOffset;
+};
+layout (std430, binding = 0) readonly buffer DrawBuffer { DrawData draws[]; };
+#else
+layout (location = 0) uniform mat4 M;
 layout (location = 4) uniform uint type;
+#endif
 
+#ifndef PRESKINNED
 const int MAX_BONES = 100;
+// INFLUENCE_COUNT specializes the shader for a bucket of vertices with at most that many influences
+#ifdef INFLUENCE_COUNT
+const int MAX_BONE_INFLUENCE = INFLUENCE_COUNT;
+#else
 const int MAX_BONE_INFLUENCE = 4;
+#endif
+#ifdef MULTI_DRAW
+// The palettes of all characters; a draw's bones start at its paletteOffset
+layout (std430, binding = 1) readonly buffer BoneBuffer { mat4 bones[]; };
+uint paletteOffset = 0u;
+mat4 boneTransform(int id) { return bones[paletteOffset + uint(id)]; }
+#else
 uniform mat4 boneTransforms[MAX_BONES];
+mat4 boneTransform(int id) { return boneTransforms[id]; }
+#endif
+#endif
 
 void main()
 {
+#ifdef MULTI_DRAW
+    DrawData draw = draws[gl_BaseInstanceARB];
+    mat4 M = draw.model;
+    uint type = draw.type;
+#ifndef PRESKINNED
+    paletteOffset = draw.paletteOffset;
+#endif
+#endif
     vec4 updatedPosition = vec4(0.0f);
     vec3 updatedNormal = vec3(0.0f);
 
+#ifdef PRESKINNED
+    // Characters are drawn from the skin.vert output, so aPos is final for every node type
+    updatedPosition = vec4(aPos, 1.0f);
+#else
     if(type == 5) {
         for(int i = 0 ; i < MAX_BONE_INFLUENCE ; i++)
         {
+#ifndef PACKED_VERTEX
             // Current bone-weight pair is non-existing
             if(boneIds[i] == -1) 
                 continue;
@@ -29,12 +76,14 @@ void main()
                 updatedPosition = vec4(aPos,1.0f);
                 break;
             }
+#endif
             // Set pos
-            vec4 localPosition = boneTransforms[boneIds[i]] * vec4(aPos,1.0f);
+            vec4 localPosition = boneTransform(int(boneIds[i])) * vec4(aPos,1.0f);
             updatedPosition += localPosition * weights[i];
         }
     } else {
         updatedPosition = vec4(aPos, 1.0f);
     }
-    gl_Position = lightSpaceMatrix * model * updatedPosition;
+#endif
+    gl_Position = lightSpaceMatrix * M * updatedPosition;
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+#version 430 core
+
+// Skins every vertex of a character once per frame. Run with GL_RASTERIZER_DISCARD; the outputs
+// are captured with transform feedback and drawn by the PRESKINNED variants of default.vert and
+// depth.vert.
+
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in ivec4 aFrame; // octahedral normal.xy, tangent.xy; LSB of tangent.y is the bitangent sign
+layout (location = 5) in uvec4 boneIds;
+layout (location = 6) in vec4 weights;
+#else
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 5) in ivec4 boneIds; 
+layout (location = 6) in vec4 weights;
+#endif
+
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+
+const int MAX_BONES = 100;
+const int MAX_BONE_INFLUENCE = 4;
+uniform mat4 boneTransforms[MAX_BONES];
+
+#ifdef PACKED_VERTEX
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}
+#endif
+
+void main()
+{
+#ifdef PACKED_VERTEX
+    vec3 aNormal = octDecode(vec2(aFrame.xy) / 32767.0);
+#endif
+
+    vec4 updatedPosition = vec4(0.0f);
+    vec3 updatedNormal = vec3(0.0f);
+
+    for(int i = 0 ; i < MAX_BONE_INFLUENCE ; i++)
+    {
+#ifndef PACKED_VERTEX
+        // Current bone-weight pair is non-existing
+        if(boneIds[i] == -1) 
+            continue;
+
+        // Ignore all bones over count MAX_BONES
+        if(boneIds[i] >= MAX_BONES) 
+        {
+            updatedPosition = vec4(aPos,1.0f);
+            break;
+        }
+#endif
+        updatedPosition += boneTransforms[boneIds[i]] * vec4(aPos,1.0f) * weights[i];
+        updatedNormal += mat3(boneTransforms[boneIds[i]]) * aNormal * weights[i];
+    }
+
+    skinnedPosition = vec3(updatedPosition);
+    skinnedNormal = updatedNormal;
+}